@@ -1,13 +1,21 @@
 #include "application.h"
 #include "settings.h"
 #include "impl/sdl_audio_codec.h"
-#include "impl/sdl_audio_processor.h"
+#include "audio_pipeline.h"
+#include "audio_processing/noise_suppressor.h"
+#include "audio_processing/automatic_gain_control.h"
 #include "protocols/mqtt_protocol.h"
+#include "protocols/websocket_protocol.h"
 #include <cjson/cJSON.h>
 #include "board.h"
 #include "display/display.h"
+#include "metrics.h"
+#include "playback_engine.h"
+#include "trace.h"
 #include "httplib.h"
 #include <esp_log.h>
+#include <algorithm>
+#include <chrono>
 
 #define TAG "Application"
 
@@ -37,17 +45,73 @@ constexpr int HEIGHT = 240;
 constexpr int SAMPLE_RATE = 16000;
 constexpr int CHANNELS = 1;
 
+// Frame durations the uplink may be configured to
+bool IsValidFrameDuration(int duration_ms) {
+  return duration_ms == 10 || duration_ms == 20 || duration_ms == 40 || duration_ms == 60;
+}
+
+// Playback buffering, see the "playback" settings
+bool IsValidPlaybackLead(int low_watermark_ms, int target_lead_ms) {
+  return low_watermark_ms >= 10 && target_lead_ms <= 2000 && low_watermark_ms < target_lead_ms;
+}
+
+// The longest packet Opus allows, a decode never starts without room for it
+constexpr int MAX_OPUS_FRAME_MS = 120;
+
+constexpr int MIN_UPLINK_BITRATE = 8000;
+constexpr int MAX_UPLINK_BITRATE = 32000;
+// A handoff this close to the end of the playback does not wait for it
+constexpr int64_t HANDOFF_TOLERANCE_US = 2000;
+// How much longer than estimated at the end of the reply a handoff waits
+// for the playback, e.g. when the output device has stalled
+constexpr int64_t HANDOFF_MARGIN_US = 500000;
+
 
 } // namespace
 
-Application::Application() {
+Application::Application()
+    : rate_controller_(MIN_UPLINK_BITRATE, MAX_UPLINK_BITRATE,
+                       Settings("audio", false).GetInt("bitrate", OpusEncoderWrapper::DEFAULT_BITRATE)) {
   event_group_ = xEventGroupCreate();
   background_task_ = new BackgroundTask(4096 * 8);
 
-  audio_processor_ = std::make_unique<SdlAudioProcessor>();
+  audio_processor_ = std::make_unique<AudioPipeline>();
+
+  esp_timer_create_args_t abort_timer_args = {};
+  abort_timer_args.callback = [](void* arg) {
+    ((Application*)arg)->OnAbortTimer();
+  };
+  abort_timer_args.arg = this;
+  abort_timer_args.dispatch_method = ESP_TIMER_TASK;
+  abort_timer_args.name = "abort_timer";
+  esp_timer_create(&abort_timer_args, &abort_timer_);
+
+  esp_timer_create_args_t handoff_timer_args = {};
+  handoff_timer_args.callback = [](void* arg) {
+    auto app = (Application*)arg;
+    app->Schedule([app]() {
+      app->ContinueHandoff();
+    });
+  };
+  handoff_timer_args.arg = this;
+  handoff_timer_args.dispatch_method = ESP_TIMER_TASK;
+  handoff_timer_args.name = "handoff_timer";
+  esp_timer_create(&handoff_timer_args, &handoff_timer_);
 }
 
 Application::~Application() {
+    // The pacing thread schedules decoding on the background task
+    if (playback_) {
+        playback_->Stop();
+    }
+    if (abort_timer_ != nullptr) {
+        esp_timer_stop(abort_timer_);
+        esp_timer_delete(abort_timer_);
+    }
+    if (handoff_timer_ != nullptr) {
+        esp_timer_stop(handoff_timer_);
+        esp_timer_delete(handoff_timer_);
+    }
     //if (clock_timer_handle_ != nullptr) {
     //    esp_timer_stop(clock_timer_handle_);
     //    esp_timer_delete(clock_timer_handle_);
@@ -111,13 +175,120 @@ void Application::Start() {
   auto& board = Board::GetInstance();
   SetDeviceState(kDeviceStateStarting);
 
+  auto& metrics = Metrics::GetInstance();
+  metrics.AddCollector([this]() {
+    static auto& decode_queue = Metrics::GetInstance().GetGauge("xiaozhi_decode_queue_packets", "Downlink packets waiting for the decoder.");
+    static auto& uplink_queue = Metrics::GetInstance().GetGauge("xiaozhi_uplink_pending_packets", "Encoded packets not yet handed to the protocol.");
+    static auto& timestamp_queue = Metrics::GetInstance().GetGauge("xiaozhi_timestamp_queue_size", "Playback timestamps kept for the server AEC.");
+    static auto& state = Metrics::GetInstance().GetGauge("xiaozhi_device_state", "Current device state, see DeviceState.");
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      decode_queue.Set((double)audio_decode_queue_.size());
+    }
+    {
+      std::lock_guard<std::mutex> lock(timestamp_mutex_);
+      timestamp_queue.Set((double)timestamp_queue_.size());
+    }
+    uplink_queue.Set((double)uplink_pending_.load());
+    state.Set(device_state_);
+  });
+  {
+    // Timeline of the hot paths, written at exit and served on demand
+    Settings settings("trace", false);
+    static std::string trace_file = settings.GetString("file", "xiaozhi_trace.json");
+    if (settings.GetInt("enable", 0) != 0) {
+      Tracer::GetInstance().Start();
+    }
+    std::atexit([]() {
+      if (Tracer::GetInstance().enabled()) {
+        Tracer::GetInstance().WriteJson(trace_file);
+      }
+    });
+    metrics.AddEndpoint("/trace", "application/json", []() {
+      return Tracer::GetInstance().ExportJson();
+    });
+    metrics.AddEndpoint("/trace/start", "text/plain", []() {
+      Tracer::GetInstance().Start();
+      return std::string("started\n");
+    });
+    metrics.AddEndpoint("/trace/stop", "text/plain", []() {
+      Tracer::GetInstance().Stop();
+      return std::string("stopped\n");
+    });
+  }
+  {
+    // Local scrape endpoint for the fleet monitoring, port 0 turns it off
+    Settings settings("metrics", false);
+    int port = settings.GetInt("port", 9464);
+    if (port > 0) {
+      metrics.StartServer(settings.GetString("host", "127.0.0.1"), port);
+    }
+  }
+
   /* Setup the display */
   auto display = board.GetDisplay();
 
   /* Setup the audio codec */
   auto codec = board.GetAudioCodec();
+  // Shorter frames lower the latency, longer ones the packet rate
+  frame_duration_ms_ = Settings("audio", false).GetInt("frame_duration", OPUS_FRAME_DURATION_MS);
+  if (!IsValidFrameDuration(frame_duration_ms_)) {
+    ESP_LOGW(TAG, "Unsupported frame duration %d ms, using %d ms", frame_duration_ms_, OPUS_FRAME_DURATION_MS);
+    frame_duration_ms_ = OPUS_FRAME_DURATION_MS;
+  }
   opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-  opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+  opus_encoder_ = std::make_unique<OpusEncoderWrapper>(SAMPLE_RATE, 1, frame_duration_ms_);
+  {
+    Settings settings("playback", false);
+    PlaybackEngine::Config config;
+    config.device_ms = std::clamp(settings.GetInt("device_ms", config.device_ms), 10, 500);
+    playback_ = std::make_unique<PlaybackEngine>(codec, codec->output_sample_rate(), config);
+
+    PlaybackChannel::Config tts;
+    tts.name = "tts";
+    tts.low_watermark_ms = settings.GetInt("low_watermark_ms", tts.low_watermark_ms);
+    tts.target_lead_ms = settings.GetInt("target_lead_ms", tts.target_lead_ms);
+    if (!IsValidPlaybackLead(tts.low_watermark_ms, tts.target_lead_ms)) {
+      PlaybackChannel::Config defaults;
+      ESP_LOGW(TAG, "Unsupported playback low watermark %d ms and target lead %d ms, using %d and %d ms",
+          tts.low_watermark_ms, tts.target_lead_ms, defaults.low_watermark_ms, defaults.target_lead_ms);
+      tts.low_watermark_ms = defaults.low_watermark_ms;
+      tts.target_lead_ms = defaults.target_lead_ms;
+    }
+    tts_channel_ = playback_->AddChannel(tts);
+
+    // Prompts play over the reply, which steps back while they do
+    PlaybackChannel::Config prompt;
+    prompt.name = "prompt";
+    prompt.priority = 1;
+    prompt.duck_db = std::clamp(settings.GetInt("prompt_duck_db", 12), 0, 60);
+    prompt_channel_ = playback_->AddChannel(prompt);
+  }
+  // Decoded once here, a prompt never waits behind the reply's decoding
+  sounds_.Load(Settings("sounds", false).GetString("directory", "sounds"), playback_->sample_rate());
+  tts_channel_->OnRefill([this](size_t samples) {
+    return DecodeAhead(samples);
+  });
+  prompt_channel_->OnRefill([this](size_t samples) {
+    FillPrompt(samples);
+    return false;
+  });
+  tts_channel_->OnPlayed([this](uint32_t timestamp) {
+    {
+      std::lock_guard<std::mutex> lock(timestamp_mutex_);
+      timestamp_queue_.push_back(timestamp);
+      last_output_timestamp_ = timestamp;
+    }
+    last_output_time_ = std::chrono::steady_clock::now();
+  });
+  playback_->Start();
+  // Most of the listening time is silence, let the encoder drop it
+  opus_encoder_->SetDtx(dtx_setting_.Get());
+  dtx_setting_.Subscribe([this](const bool& enable) {
+    background_task_->Schedule([this, enable]() {
+      opus_encoder_->SetDtx(enable);
+    });
+  });
 
   codec->Start();
 
@@ -133,31 +304,52 @@ void Application::Start() {
   // Initialize the protocol
   display->SetStatus("LOADING_PROTOCOL");
 
-  if (ota_.HasMqttConfig()) {
+  // MQTT is preferred, unless the websocket transport is forced for networks
+  // where UDP is throttled
+  bool prefer_websocket = Settings("websocket", false).GetInt("prefer", 0) != 0;
+  if (ota_.HasWebsocketConfig() && (prefer_websocket || !ota_.HasMqttConfig())) {
+    protocol_ = std::make_unique<WebsocketProtocol>();
+  } else if (ota_.HasMqttConfig()) {
     protocol_ = std::make_unique<MqttProtocol>();
   } else {
     ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
     protocol_ = std::make_unique<MqttProtocol>();
   }
 
+  protocol_->SetClientAudioParams(SAMPLE_RATE, frame_duration_ms_);
   protocol_->OnNetworkError([this](const std::string& message) {
     SetDeviceState(kDeviceStateIdle);
     Alert("ERROR", message.c_str(), "sad", "P3_EXCLAMATION");
   });
   protocol_->OnIncomingAudio([this](AudioStreamPacket&& packet) {
-        const int max_packets_in_queue = 600 / OPUS_FRAME_DURATION_MS;
+        recorder_.Record(SessionRecorder::kDownlink, packet.payload);
+        // The server keeps sending until it has seen the abort
+        if (aborted_) {
+            return;
+        }
+        // Bound the jitter buffer by time, whatever the server frame size
+        const int max_packets_in_queue = 600 / protocol_->server_frame_duration();
         std::lock_guard<std::mutex> lock(mutex_);
         if (audio_decode_queue_.size() < max_packets_in_queue) {
             audio_decode_queue_.emplace_back(std::move(packet));
+        } else {
+            static auto& overflows = Metrics::GetInstance().GetCounter("xiaozhi_decode_queue_overflows_total",
+                "Downlink packets dropped because the decode queue was full.");
+            overflows.Increment();
         }
   });
-  protocol_->OnAudioChannelOpened([this, &board, codec]() {
+  protocol_->OnAudioChannelOpened([this, &board]() {
         board.SetPowerSaveMode(false);
-        if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
-            ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
-                protocol_->server_sample_rate(), codec->output_sample_rate());
-        }
         SetDecodeSampleRate(protocol_->server_sample_rate(), protocol_->server_frame_duration());
+        if (recorder_enable_.Get()) {
+            recorder_.Start(recorder_directory_.Get(), protocol_->session_id(),
+                SAMPLE_RATE, protocol_->server_sample_rate());
+        }
+        background_task_->Schedule([this]() {
+            rate_controller_.Reset();
+            opus_encoder_->SetBitrate(rate_controller_.bitrate());
+            opus_encoder_->SetComplexity(rate_controller_.complexity());
+        });
         //auto& thing_manager = iot::ThingManager::GetInstance();
         //protocol_->SendIotDescriptors(thing_manager.GetDescriptorsJson());
         //std::string states;
@@ -167,6 +359,7 @@ void Application::Start() {
     });
   protocol_->OnAudioChannelClosed([this, &board]() {
         board.SetPowerSaveMode(true);
+        recorder_.Stop();
         Schedule([this]() {
             auto display = Board::GetInstance().GetDisplay();
             display->SetChatMessage("system", "");
@@ -181,6 +374,11 @@ void Application::Start() {
             if (strcmp(state->valuestring, "start") == 0) {
                 Schedule([this]() {
                     aborted_ = false;
+                    // More to play, a handoff still waiting is off
+                    if (handoff_pending_) {
+                        handoff_pending_ = false;
+                        esp_timer_stop(handoff_timer_);
+                    }
                     if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
                         SetDeviceState(kDeviceStateSpeaking);
                     }
@@ -189,11 +387,13 @@ void Application::Start() {
                 Schedule([this]() {
                     background_task_->WaitForCompletion();
                     if (device_state_ == kDeviceStateSpeaking) {
-                        if (listening_mode_ == kListeningModeManualStop) {
-                            SetDeviceState(kDeviceStateIdle);
-                        } else {
-                            SetDeviceState(kDeviceStateListening);
-                        }
+                        // The reply is all here but not yet all played
+                        handoff_pending_ = true;
+                        handoff_start_us_ = esp_timer_get_time();
+                        int64_t overlap_us = (int64_t)handoff_overlap_ms_.Get() * 1000;
+                        handoff_deadline_us_ = handoff_start_us_ + GetPlaybackRemainingUs() +
+                            std::max<int64_t>(-overlap_us, 0) + HANDOFF_MARGIN_US;
+                        ContinueHandoff();
                     }
                 });
             } else if (strcmp(state->valuestring, "sentence_start") == 0) {
@@ -255,13 +455,47 @@ void Application::Start() {
     });
     bool protocol_started = protocol_->Start();
 
-  audio_processor_->Initialize(codec);
+  audio_processor_->Initialize(codec, frame_duration_ms_);
+  {
+    Settings settings("audio", false);
+    // Cleaner input costs fewer uplink bits and helps the server ASR, 0 turns it off
+    int suppression_db = settings.GetInt("noise_suppression_db", 15);
+    if (suppression_db > 0) {
+      audio_processor_->AddStage(std::make_unique<NoiseSuppressor>(SAMPLE_RATE, suppression_db));
+      stage_names_.push_back("ns");
+      ESP_LOGI(TAG, "Noise suppression %d dB", suppression_db);
+    }
+    // After the noise suppression, so the level it sees is the speech
+    if (settings.GetInt("agc", 1) != 0) {
+      audio_processor_->AddStage(std::make_unique<AutomaticGainControl>(SAMPLE_RATE,
+          settings.GetInt("agc_target_dbfs", -18), settings.GetInt("agc_max_gain_db", 24)));
+      stage_names_.push_back("agc");
+    }
+    // Speech from just before the listening starts, e.g. right after the
+    // wake word or the button
+    audio_processor_->SetPreroll(settings.GetInt("preroll_ms", 500));
+  }
+  ApplyStageBypass(bypass_stages_.Get());
+  bypass_stages_.Subscribe([this](const std::string& stages) {
+    ApplyStageBypass(stages);
+  });
   audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
     background_task_->Schedule([this, data = std::move(data)]() mutable {
       if (protocol_->IsAudioChannelBusy()) {
         return;
       }
-      opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
+      auto encode_start = std::chrono::steady_clock::now();
+      opus_encoder_->Encode(std::move(data), [this, encode_start](std::vector<uint8_t>&& opus) {
+        auto encode_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - encode_start).count();
+        auto stats = protocol_->GetNetworkStats();
+        if (rate_controller_.Update(uplink_pending_ + stats.send_queue, stats.received_packets,
+                stats.lost_packets, (int)encode_us, frame_duration_ms_ * 1000)) {
+            opus_encoder_->SetBitrate(rate_controller_.bitrate());
+            opus_encoder_->SetComplexity(rate_controller_.complexity());
+        }
+        recorder_.Record(SessionRecorder::kUplink, opus);
+
         AudioStreamPacket packet;
                 packet.payload = std::move(opus);
                 uint32_t last_output_timestamp_value = last_output_timestamp_.load();
@@ -279,15 +513,42 @@ void Application::Start() {
                         return;
                     }
                 }
+                if (StageUplink(packet)) {
+                    return;
+                }
+                uplink_pending_++;
                 Schedule([this, last_output_timestamp_value, packet = std::move(packet)]() {
                     protocol_->SendAudio(packet);
-                    ESP_LOGI(TAG, "Send %zu bytes, timestamp %lu, last_ts %lu, qsize %zu",
+                    uplink_pending_--;
+                    ESP_LOGD(TAG, "Send %zu bytes, timestamp %u, last_ts %u, qsize %zu",
                          packet.payload.size(), packet.timestamp, last_output_timestamp_value, timestamp_queue_.size());
                 });
       });
     });
   });
 
+#if CONFIG_USE_WAKE_WORD_DETECT
+  wake_word_detect_.Initialize(codec);
+  wake_word_detect_.OnWakeWordDetected([this](const std::string& wake_word) {
+    Schedule([this, wake_word]() {
+      if (device_state_ == kDeviceStateIdle) {
+        SetDeviceState(kDeviceStateConnecting);
+        if (!protocol_->OpenAudioChannel()) {
+          wake_word_detect_.StartDetection();
+          return;
+        }
+        protocol_->SendWakeWordDetected(wake_word);
+        ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
+        SetListeningMode(realtime_chat_enabled_ ? kListeningModeRealtime : kListeningModeAutoStop);
+      } else if (device_state_ == kDeviceStateSpeaking) {
+        AbortSpeaking(kAbortReasonWakeWordDetected);
+      } else if (device_state_ == kDeviceStateActivating) {
+        SetDeviceState(kDeviceStateIdle);
+      }
+    });
+  });
+#endif
+
   audio_processor_->Start();
 
   SetDeviceState(kDeviceStateIdle);
@@ -326,6 +587,7 @@ void Application::MainEventLoop() {
             std::list<std::function<void()>> tasks = std::move(main_tasks_);
             lock.unlock();
             for (auto& task : tasks) {
+                TRACE_SCOPE("MainEventLoop task");
                 task();
             }
         }
@@ -343,11 +605,9 @@ void Application::AudioLoop() {
     }
 }
 
+// Decoding and feeding the device is up to the playback engine, the audio
+// loop only keeps an eye on the queue
 void Application::OnAudioOutput() {
-    if (busy_decoding_audio_) {
-        return;
-    }
-
     auto now = std::chrono::steady_clock::now();
     auto codec = Board::GetInstance().GetAudioCodec();
     const int max_silence_seconds = 10;
@@ -355,7 +615,7 @@ void Application::OnAudioOutput() {
     std::unique_lock<std::mutex> lock(mutex_);
     if (audio_decode_queue_.empty()) {
         // Disable the output if there is no audio data for a long time
-        if (device_state_ == kDeviceStateIdle) {
+        if (device_state_ == kDeviceStateIdle && playback_->buffered_samples() == 0) {
             auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_output_time_).count();
             if (duration > max_silence_seconds) {
                 codec->EnableOutput(false);
@@ -367,51 +627,97 @@ void Application::OnAudioOutput() {
     if (device_state_ == kDeviceStateListening) {
         audio_decode_queue_.clear();
         audio_decode_cv_.notify_all();
-        return;
     }
+}
 
-    auto packet = std::move(audio_decode_queue_.front());
-    audio_decode_queue_.pop_front();
+// Called by the prompt channel when its ring runs low. The sound is PCM
+// already, so the next slice is pushed right here on the playback thread.
+void Application::FillPrompt(size_t samples) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!sound_) {
+        return;
+    }
+    // Taken with the slice, a slice of a replaced sound is then dropped
+    uint32_t generation = prompt_channel_->generation();
+    size_t count = std::min(samples, sound_->size() - sound_offset_);
+    std::vector<int16_t> pcm(sound_->begin() + sound_offset_, sound_->begin() + sound_offset_ + count);
+    sound_offset_ += count;
+    if (sound_offset_ == sound_->size()) {
+        sound_.reset();
+    }
     lock.unlock();
-    audio_decode_cv_.notify_all();
+    prompt_channel_->Push(pcm, 0, generation);
+}
 
-    busy_decoding_audio_ = true;
-    background_task_->Schedule([this, codec, packet = std::move(packet)]() mutable {
-        busy_decoding_audio_ = false;
-        if (aborted_) {
-            return;
+// Called by the reply channel when its ring runs low. Decodes packets in
+// one batch on the background task, next to the other decoder calls, until
+// the channel holds the wanted number of samples or the queue is empty.
+bool Application::DecodeAhead(size_t samples) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (audio_decode_queue_.empty() || device_state_ == kDeviceStateListening) {
+            return false;
         }
+    }
 
+    uint32_t generation = tts_channel_->generation();
+    background_task_->Schedule([this, samples, generation]() {
+        TRACE_SCOPE("DecodeAhead");
         std::vector<int16_t> pcm;
-        if (!opus_decoder_->Decode(std::move(packet.payload), pcm)) {
-            return;
-        }
-        // Resample if the sample rate is different
-        //if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-        //    int target_size = output_resampler_.GetOutputSamples(pcm.size());
-        //    std::vector<int16_t> resampled(target_size);
-        //    output_resampler_.Process(pcm.data(), pcm.size(), resampled.data());
-        //    pcm = std::move(resampled);
-        //}
-        codec->OutputData(pcm);
-        {
-            std::lock_guard<std::mutex> lock(timestamp_mutex_);
-            timestamp_queue_.push_back(packet.timestamp);
-            last_output_timestamp_ = packet.timestamp;
+        size_t decoded = 0;
+        size_t max_frame = (size_t)playback_->sample_rate() * MAX_OPUS_FRAME_MS / 1000;
+        while (decoded < samples && !aborted_ && generation == tts_channel_->generation()) {
+            // A packet is only taken off the queue when what it decodes to
+            // fits, a full ring leaves it for the next refill
+            if (tts_channel_->free_samples() < max_frame) {
+                break;
+            }
+            AudioStreamPacket packet;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (audio_decode_queue_.empty()) {
+                    break;
+                }
+                packet = std::move(audio_decode_queue_.front());
+                audio_decode_queue_.pop_front();
+            }
+            audio_decode_cv_.notify_all();
+
+            if (!opus_decoder_->Decode(std::move(packet.payload), pcm)) {
+                continue;
+            }
+            // Resample if the sample rate is different
+            //if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
+            //    int target_size = output_resampler_.GetOutputSamples(pcm.size());
+            //    std::vector<int16_t> resampled(target_size);
+            //    output_resampler_.Process(pcm.data(), pcm.size(), resampled.data());
+            //    pcm = std::move(resampled);
+            //}
+            if (!tts_channel_->Push(pcm, packet.timestamp, generation)) {
+                break;
+            }
+            decoded += pcm.size();
         }
-        last_output_time_ = std::chrono::steady_clock::now();
+        tts_channel_->RefillDone();
     });
+    return true;
 }
 
+// The capture is read all the time, the processor keeps what comes in
+// while nobody listens as its pre-roll
 void Application::OnAudioInput() {
-    if (audio_processor_->IsRunning()) {
+    int samples = audio_processor_->GetFeedSize();
+    if (samples > 0) {
+        TRACE_SCOPE("OnAudioInput");
         std::vector<int16_t> data;
-        int samples = audio_processor_->GetFeedSize();
-        if (samples > 0) {
-            ReadAudio(data, 16000, samples);
-            audio_processor_->Feed(data);
-            return;
+        ReadAudio(data, 16000, samples);
+#if CONFIG_USE_WAKE_WORD_DETECT
+        if (wake_word_detect_.IsDetectionRunning() && Board::GetInstance().GetAudioCodec()->input_enabled()) {
+            wake_word_detect_.Feed(data);
         }
+#endif
+        audio_processor_->Feed(data);
+        return;
     }
 
     vTaskDelay(pdMS_TO_TICKS(30));
@@ -437,7 +743,6 @@ void Application::Alert(const char* status, const char* message, const char* emo
     display->SetEmotion(emotion);
     display->SetChatMessage("system", message);
     if (!sound.empty()) {
-        ResetDecoder();
         PlaySound(sound);
     }
 }
@@ -459,6 +764,8 @@ void Application::SetDeviceState(DeviceState state) {
     auto previous_state = device_state_;
     device_state_ = state;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
+    Metrics::GetInstance().GetCounter("xiaozhi_state_transitions_total", "Device state changes by target state.",
+        std::string("state=\"") + STATE_STRINGS[device_state_] + "\"").Increment();
     // The state is changed, wait for all background tasks to finish
     background_task_->WaitForCompletion();
 
@@ -472,6 +779,7 @@ void Application::SetDeviceState(DeviceState state) {
             display->SetStatus("STANDBY");
             display->SetEmotion("neutral");
             audio_processor_->Stop();
+            EndUplinkStaging(false);
             
 #if CONFIG_USE_WAKE_WORD_DETECT
             wake_word_detect_.StartDetection();
@@ -483,6 +791,13 @@ void Application::SetDeviceState(DeviceState state) {
             display->SetChatMessage("system", "");
             timestamp_queue_.clear();
             last_output_timestamp_ = 0;
+            // Capture from the press on, the packets wait for the channel
+            // instead of the user waiting for it
+            StartUplinkStaging();
+#if CONFIG_USE_WAKE_WORD_DETECT
+            wake_word_detect_.StopDetection();
+#endif
+            audio_processor_->Start();
             break;
         case kDeviceStateListening:
             display->SetStatus("LISTENING");
@@ -491,12 +806,17 @@ void Application::SetDeviceState(DeviceState state) {
             UpdateIotStates();
 
             // Make sure the audio processor is running
-            if (!audio_processor_->IsRunning()) {
+            if (previous_state == kDeviceStateConnecting) {
+                // It has been since the connecting, what it encoded follows
+                // the start listening command
+                protocol_->SendStartListening(listening_mode_);
+                EndUplinkStaging(true);
+            } else if (!audio_processor_->IsRunning()) {
                 // Send the start listening command
                 protocol_->SendStartListening(listening_mode_);
-                if (listening_mode_ == kListeningModeAutoStop && previous_state == kDeviceStateSpeaking) {
-                    // FIXME: Wait for the speaker to empty the buffer
-                    // vTaskDelay(pdMS_TO_TICKS(120));
+                // Before a reply the pre-roll is the speaker, not the user
+                if (previous_state == kDeviceStateSpeaking) {
+                    audio_processor_->DiscardPreroll();
                 }
                 // opus_encoder_->ResetState();
 #if CONFIG_USE_WAKE_WORD_DETECT
@@ -522,9 +842,57 @@ void Application::SetDeviceState(DeviceState state) {
     }
 }
 
+void Application::StartUplinkStaging() {
+    std::lock_guard<std::mutex> lock(uplink_mutex_);
+    uplink_staging_.clear();
+    staging_uplink_ = true;
+}
+
+bool Application::StageUplink(AudioStreamPacket& packet) {
+    std::lock_guard<std::mutex> lock(uplink_mutex_);
+    if (!staging_uplink_) {
+        return false;
+    }
+    uplink_staging_.push_back(std::move(packet));
+    // A slow hello costs the oldest audio rather than unbounded memory
+    size_t capacity = std::max(1, uplink_staging_ms_.Get() / frame_duration_ms_);
+    if (uplink_staging_.size() > capacity) {
+        static auto& overflows = Metrics::GetInstance().GetCounter("xiaozhi_uplink_staging_overflows_total",
+            "Encoded frames dropped because the channel took longer to open than the staging holds.");
+        overflows.Increment();
+        uplink_staging_.pop_front();
+    }
+    return true;
+}
+
+// On the main loop, so packets encoded after this are scheduled behind the
+// burst and keep their order
+void Application::EndUplinkStaging(bool send) {
+    std::deque<AudioStreamPacket> packets;
+    {
+        std::lock_guard<std::mutex> lock(uplink_mutex_);
+        if (!staging_uplink_) {
+            return;
+        }
+        staging_uplink_ = false;
+        packets.swap(uplink_staging_);
+    }
+    if (!send) {
+        return;
+    }
+    ESP_LOGI(TAG, "Sending %zu packets, %zu ms of audio staged while the channel opened",
+        packets.size(), packets.size() * frame_duration_ms_);
+    for (auto& packet : packets) {
+        protocol_->SendAudio(packet);
+    }
+}
+
 void Application::ResetDecoder() {
     std::lock_guard<std::mutex> lock(mutex_);
-    opus_decoder_->ResetState();
+    // The decoder belongs to the background task
+    background_task_->Schedule([this]() {
+        opus_decoder_->ResetState();
+    });
     audio_decode_queue_.clear();
     audio_decode_cv_.notify_all();
     last_output_time_ = std::chrono::steady_clock::now();
@@ -533,19 +901,25 @@ void Application::ResetDecoder() {
 }
 
 void Application::SetDecodeSampleRate(int sample_rate, int frame_duration) {
-    if (opus_decoder_->sample_rate() == sample_rate && opus_decoder_->duration_ms() == frame_duration) {
-        return;
-    }
-
-    opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
-
-    auto codec = Board::GetInstance().GetAudioCodec();
-    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        static_cast<SdlAudioCodec*>(codec)->SetOutputFormat(opus_decoder_->sample_rate(), 1);
-        //output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
+    // Opus decodes to any of its rates whatever the stream was encoded at,
+    // so replies come out at the mixer's rate (48 kHz keeps every band the
+    // server may send) and only the device stream resamples
+    int output_rate = playback_->sample_rate();
+    if (sample_rate != output_rate) {
+        ESP_LOGI(TAG, "Decoding %d Hz audio at %d Hz", sample_rate, output_rate);
     }
+    // Applied in order with the decoding on the background task, packets
+    // queued before the switch are still decoded with the old parameters
+    background_task_->Schedule([this, output_rate, frame_duration]() {
+        if (opus_decoder_->sample_rate() == output_rate && opus_decoder_->duration_ms() == frame_duration) {
+            return;
+        }
+        if (!opus_decoder_->Configure(output_rate, frame_duration)) {
+            // A failed init leaves the state unusable, start from a new one
+            ESP_LOGE(TAG, "Failed to configure the decoder for %d Hz, %d ms", output_rate, frame_duration);
+            opus_decoder_ = std::make_unique<OpusDecoderWrapper>(output_rate, 1, frame_duration);
+        }
+    });
 }
 
 void Application::SetListeningMode(ListeningMode mode) {
@@ -586,14 +960,155 @@ void Application::ToggleChatState() {
 
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
+    TRACE_INSTANT("AbortSpeaking");
     aborted_ = true;
+    FlushPlayback();
     protocol_->SendAbortSpeaking(reason);
 }
 
+// Silences every playback stage at once instead of letting the jitter
+// buffer, the pending decode tasks and the SDL stream play out
+void Application::FlushPlayback() {
+    abort_time_us_ = esp_timer_get_time();
+    // Drops the decoded ring and the device queue, and with the generation
+    // any batch still decoding
+    abort_flushed_samples_ = playback_->Flush(ABORT_FADE_MS);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        audio_decode_queue_.clear();
+        sound_.reset();
+    }
+    audio_decode_cv_.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(timestamp_mutex_);
+        timestamp_queue_.clear();
+    }
+    // The next reply must not continue from the cut off one
+    background_task_->Schedule([this]() {
+        opus_decoder_->ResetState();
+    });
+
+
+    // Silence is reached once the stream has handed the ramp to the device
+    esp_timer_stop(abort_timer_);
+    esp_timer_start_periodic(abort_timer_, 2000);
+}
+
+// What is left of the reply: packets waiting for the decoder, the reply's
+// ring and what the device still has queued. A prompt in its own ring does
+// not hold the turn.
+int64_t Application::GetPlaybackRemainingUs() {
+    int64_t remaining_us;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        remaining_us = (int64_t)audio_decode_queue_.size() * protocol_->server_frame_duration() * 1000;
+    }
+    auto codec = Board::GetInstance().GetAudioCodec();
+    size_t samples = tts_channel_->buffered_samples() + codec->GetOutputQueuedSamples();
+    return remaining_us + (int64_t)samples * 1000000 / playback_->sample_rate();
+}
+
+// On the main loop. Leaves Speaking once the last sample has played, less
+// the configured overlap, and otherwise sleeps until it should have. The
+// estimate is taken again on every wake up, decoding may still add to it,
+// but the wait never goes past the deadline set at the end of the reply.
+void Application::ContinueHandoff() {
+    if (!handoff_pending_) {
+        return;
+    }
+    if (device_state_ != kDeviceStateSpeaking) {
+        handoff_pending_ = false;
+        return;
+    }
+
+    int64_t wait_us = GetPlaybackRemainingUs() - (int64_t)handoff_overlap_ms_.Get() * 1000;
+    if (wait_us > HANDOFF_TOLERANCE_US) {
+        int64_t left_us = handoff_deadline_us_ - esp_timer_get_time();
+        if (left_us > 0) {
+            esp_timer_stop(handoff_timer_);
+            esp_timer_start_once(handoff_timer_, std::min(wait_us, left_us));
+            return;
+        }
+        ESP_LOGW(TAG, "Playback still %.1f ms from done at the handoff deadline, handing over anyway",
+            wait_us / 1000.0);
+    }
+    handoff_pending_ = false;
+
+    static auto& latency = Metrics::GetInstance().GetHistogram("xiaozhi_turn_handoff_seconds",
+        "Time from the end of a reply until the device listens again, waiting for the playback to drain.",
+        Histogram::ExponentialBounds(0.01, 2, 10));
+    int64_t elapsed_us = esp_timer_get_time() - handoff_start_us_;
+    latency.Observe(elapsed_us / 1e6);
+    ESP_LOGI(TAG, "Turn handed over %.1f ms after the end of the reply", elapsed_us / 1000.0);
+
+    if (listening_mode_ == kListeningModeManualStop) {
+        SetDeviceState(kDeviceStateIdle);
+    } else {
+        SetDeviceState(kDeviceStateListening);
+    }
+}
+
+void Application::OnAbortTimer() {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    int64_t elapsed_us = esp_timer_get_time() - abort_time_us_;
+    if (codec->GetOutputQueuedSamples() > 0 && elapsed_us < 1000000) {
+        return;
+    }
+    esp_timer_stop(abort_timer_);
+
+    static auto& latency = Metrics::GetInstance().GetHistogram("xiaozhi_abort_to_silence_seconds",
+        "Time from a barge-in until the playback queue is empty.", Histogram::ExponentialBounds(0.002, 2, 8));
+    latency.Observe(elapsed_us / 1e6);
+    ESP_LOGI(TAG, "Abort to silence in %.1f ms, %zu queued samples dropped",
+        elapsed_us / 1000.0, abort_flushed_samples_);
+}
+
+// Runs on the thread that changed the setting, the pipeline only flips a
+// flag the audio loop picks up on its next frame
+void Application::ApplyStageBypass(const std::string& stages) {
+    std::vector<std::string> bypassed;
+    size_t start = 0;
+    while (start <= stages.size()) {
+        size_t end = std::min(stages.find(',', start), stages.size());
+        auto name = stages.substr(start, end - start);
+        name.erase(0, name.find_first_not_of(' '));
+        name.erase(name.find_last_not_of(' ') + 1);
+        if (!name.empty()) {
+            bypassed.push_back(name);
+        }
+        start = end + 1;
+    }
+
+    for (auto& name : stage_names_) {
+        bool bypass = std::find(bypassed.begin(), bypassed.end(), name) != bypassed.end();
+        audio_processor_->SetStageBypass(name, bypass);
+    }
+    for (auto& name : bypassed) {
+        if (std::find(stage_names_.begin(), stage_names_.end(), name) == stage_names_.end()) {
+            ESP_LOGW(TAG, "No capture stage named %s to bypass", name.c_str());
+        }
+    }
+}
+
 void Application::OnClockTimer() {
 }
 
 void Application::PlaySound(const std::string_view& sound) {
+    auto pcm = sounds_.Get(sound);
+    if (!pcm) {
+        ESP_LOGW(TAG, "No sound named %.*s", (int)sound.size(), sound.data());
+        return;
+    }
+    auto codec = Board::GetInstance().GetAudioCodec();
+    codec->EnableOutput(true);
+    last_output_time_ = std::chrono::steady_clock::now();
+
+    // Mixed over whatever else plays, a newer prompt replaces an older one.
+    // The next refill of the channel starts it.
+    std::lock_guard<std::mutex> lock(mutex_);
+    prompt_channel_->Clear();
+    sound_ = pcm;
+    sound_offset_ = 0;
 }
 
 void Application::UpdateIotStates() {
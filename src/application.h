@@ -9,7 +9,13 @@
 #include "impl/opus_wrapper.h"
 #include "background_task.h"
 #include "protocols/protocol.h"
+#include "protocols/rate_controller.h"
+#include "session_recorder.h"
+#include "playback_engine.h"
+#include "sound_cache.h"
+#include "settings.h"
 #include "ota.h"
+#include <deque>
 #include <functional>
 #include <list>
 #include <mutex>
@@ -37,7 +43,10 @@ enum DeviceState {
     kDeviceStateFatalError
 };
 
+// Default uplink frame duration, see the "frame_duration" audio setting
 #define OPUS_FRAME_DURATION_MS 60
+// Ramp applied to the playback cut by a barge-in
+#define ABORT_FADE_MS 5
 
 
 class Application {
@@ -82,6 +91,9 @@ private:
   void AudioDisplay(bool input);
   void UpdateSampleDisplay(bool input, int16_t *samples, int size);
 
+#if CONFIG_USE_WAKE_WORD_DETECT
+  WakeWordDetect wake_word_detect_;
+#endif
   std::unique_ptr<AudioProcessor> audio_processor_;
   Ota ota_;
   std::mutex mutex_;
@@ -92,13 +104,31 @@ private:
   std::chrono::steady_clock::time_point last_output_time_;
   std::list<AudioStreamPacket> audio_decode_queue_;
   std::condition_variable audio_decode_cv_;
-  bool aborted_ = false;
+  std::atomic<bool> aborted_ = false;
+  // Decoded PCM ahead of the device, flushed by every abort
+  std::unique_ptr<PlaybackEngine> playback_;
+  PlaybackChannel* tts_channel_ = nullptr;
+  PlaybackChannel* prompt_channel_ = nullptr;
+  SoundCache sounds_;
+  // The prompt being played and how much of it is in the ring, under mutex_
+  SoundCache::Pcm sound_;
+  size_t sound_offset_ = 0;
+  esp_timer_handle_t abort_timer_ = nullptr;
+  // Speaking ends when the playback has drained, see ContinueHandoff()
+  esp_timer_handle_t handoff_timer_ = nullptr;
+  bool handoff_pending_ = false;
+  int64_t handoff_start_us_ = 0;
+  int64_t handoff_deadline_us_ = 0;
+  // Listening starts this long before the last sample of a reply has
+  // played, negative to wait past it, e.g. for a slow output device
+  Setting<int32_t> handoff_overlap_ms_{"playback", "handoff_overlap_ms", 0};
+  int64_t abort_time_us_ = 0;
+  size_t abort_flushed_samples_ = 0;
   volatile DeviceState device_state_ = kDeviceStateUnknown;
   ListeningMode listening_mode_ = kListeningModeAutoStop;
 
   std::list<uint32_t> timestamp_queue_;
     std::mutex timestamp_mutex_;
-    bool busy_decoding_audio_ = false;
     bool realtime_chat_enabled_ = false;
 
   AudioCodec *codec_ = nullptr;
@@ -110,7 +140,35 @@ private:
 
   std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
   std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
+  // Only touched on the background task, next to the encoder
+  AudioRateController rate_controller_;
+  int frame_duration_ms_ = OPUS_FRAME_DURATION_MS;
+  SessionRecorder recorder_;
+  Setting<bool> dtx_setting_{"audio", "dtx", true};
+  Setting<bool> recorder_enable_{"recorder", "enable", false};
+  Setting<std::string> recorder_directory_{"recorder", "directory", "recordings"};
+  // Comma separated names of the capture stages to skip, e.g. "ns,agc"
+  Setting<std::string> bypass_stages_{"audio", "bypass_stages", ""};
+  std::vector<std::string> stage_names_;
+  std::atomic<size_t> uplink_pending_ = 0;
+  // Packets encoded while the audio channel opens, sent in a burst once
+  // it is up
+  Setting<int32_t> uplink_staging_ms_{"audio", "uplink_staging_ms", 5000};
+  std::mutex uplink_mutex_;
+  std::deque<AudioStreamPacket> uplink_staging_;
+  bool staging_uplink_ = false;
 
   void MainEventLoop();
+  bool DecodeAhead(size_t samples);
+  void FillPrompt(size_t samples);
+  void FlushPlayback();
+  void OnAbortTimer();
+  int64_t GetPlaybackRemainingUs();
+  void ContinueHandoff();
+  void ApplyStageBypass(const std::string& stages);
+  void StartUplinkStaging();
+  // True if the packet was kept for the channel being opened
+  bool StageUplink(AudioStreamPacket& packet);
+  void EndUplinkStaging(bool send);
   void ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples);
 };
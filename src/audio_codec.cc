@@ -1,4 +1,19 @@
 #include "audio_codec.h"
+#include "settings.h"
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "AudioCodec"
+
+namespace {
+
+// Roughly even loudness steps, 70 is about -6 dB
+float VolumeToGain(int volume) {
+  float scale = volume / 100.0f;
+  return scale * scale;
+}
+
+} // namespace
 
 void AudioCodec::EnableInput(bool enable) {
   if (enable == input_enabled_) {
@@ -17,32 +32,86 @@ void AudioCodec::EnableOutput(bool enable) {
 }
 
 void AudioCodec::SetOutputVolume(int volume) {
-  output_volume_ = volume;
-  //  ESP_LOGI(TAG, "Set output volume to %d", output_volume_);
-    
-  //  Settings settings("audio", true);
-  //settings.SetInt("output_volume", output_volume_);
+  output_volume_ = std::clamp(volume, 0, 100);
+  output_gain_ = VolumeToGain(output_volume_);
+  ESP_LOGI(TAG, "Set output volume to %d", output_volume_);
+
+  Settings settings("audio", true);
+  settings.SetInt("output_volume", output_volume_);
+}
+
+size_t AudioCodec::FlushOutput(int fade_ms) {
+  return 0;
+}
+
+size_t AudioCodec::GetOutputQueuedSamples() {
+  return 0;
+}
+
+size_t AudioCodec::GetInputAvailableSamples() {
+  return 0;
 }
 
 void AudioCodec::OutputData(std::vector<int16_t>& data) {
+    limiter_.Process(data.data(), data.size(), output_gain_);
+    FeedTaps(AudioTap::kOutput, data.data(), data.size());
     Write(data.data(), data.size());
 }
 
 bool AudioCodec::InputData(std::vector<int16_t>& data) {
     int samples = Read(data.data(), data.size());
     if (samples > 0) {
+        FeedTaps(AudioTap::kInput, data.data(), samples);
         return true;
     }
     return false;
 }
 
+std::shared_ptr<AudioTap> AudioCodec::AddTap(AudioTap::Direction direction, size_t capacity) {
+  auto tap = std::make_shared<AudioTap>(direction, capacity);
+  std::lock_guard<std::mutex> lock(taps_mutex_);
+  taps_.push_back(tap);
+  tap_count_[direction]++;
+  return tap;
+}
+
+void AudioCodec::RemoveTap(const std::shared_ptr<AudioTap>& tap) {
+  std::lock_guard<std::mutex> lock(taps_mutex_);
+  for (auto it = taps_.begin(); it != taps_.end(); ++it) {
+    if (*it == tap) {
+      tap_count_[tap->direction()]--;
+      taps_.erase(it);
+      return;
+    }
+  }
+}
+
+void AudioCodec::FeedTaps(AudioTap::Direction direction, const int16_t* samples, size_t count) {
+  if (tap_count_[direction].load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  // Only subscribing and unsubscribing take the lock, the audio thread
+  // skips the block rather than waiting for them
+  std::unique_lock<std::mutex> lock(taps_mutex_, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return;
+  }
+  for (auto& tap : taps_) {
+    if (tap->direction() == direction) {
+      tap->Push(samples, count);
+    }
+  }
+}
+
 void AudioCodec::Start() {
-  //Settings settings("audio", false);
-  //  output_volume_ = settings.GetInt("output_volume", output_volume_);
-  //  if (output_volume_ <= 0) {
-  //      ESP_LOGW(TAG, "Output volume value (%d) is too small, setting to default (10)", output_volume_);
-  //      output_volume_ = 10;
-  //  }
+  Settings settings("audio", false);
+  output_volume_ = settings.GetInt("output_volume", output_volume_);
+  if (output_volume_ <= 0) {
+    ESP_LOGW(TAG, "Output volume value (%d) is too small, setting to default (10)", output_volume_);
+    output_volume_ = 10;
+  }
+  output_volume_ = std::min(output_volume_, 100);
+  output_gain_ = VolumeToGain(output_volume_);
 
   //  ESP_ERROR_CHECK(i2s_channel_enable(tx_handle_));
   //  ESP_ERROR_CHECK(i2s_channel_enable(rx_handle_));
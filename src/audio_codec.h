@@ -1,6 +1,11 @@
 #pragma once
 #include <cstdint>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include "audio_tap.h"
+#include "audio_processing/limiter.h"
 
 class AudioCodec {
 public:
@@ -11,10 +16,25 @@ public:
   void OutputData(std::vector<int16_t>& data);
   bool InputData(std::vector<int16_t>& data);
 
+  // Subscribe to a copy of the captured or played samples. The audio
+  // thread never waits for a subscriber, and without any the taps cost
+  // an atomic load per call.
+  std::shared_ptr<AudioTap> AddTap(AudioTap::Direction direction, size_t capacity);
+  void RemoveTap(const std::shared_ptr<AudioTap>& tap);
+
+  // 0 to 100, applied to everything played and kept in the settings
   virtual void SetOutputVolume(int volume);
   virtual void EnableInput(bool enable);
   virtual void EnableOutput(bool enable);
 
+  // Drops what is queued for playback, fading the first fade_ms of it out
+  // so the cut does not click. Returns the number of samples dropped.
+  virtual size_t FlushOutput(int fade_ms);
+  // Samples written but not handed to the output device yet
+  virtual size_t GetOutputQueuedSamples();
+  // Captured samples waiting to be read
+  virtual size_t GetInputAvailableSamples();
+
   inline bool duplex() const { return duplex_; }
   inline bool input_reference() const { return input_reference_; }
   inline int input_sample_rate() const { return input_sample_rate_; }
@@ -35,7 +55,17 @@ protected:
   int output_volume_ = 70;
   bool input_reference_ = false;
   bool duplex_ = false;
+  // Volume and peak limiting of OutputData, on the thread that plays
+  Limiter limiter_;
+  std::atomic<float> output_gain_ = 1.0f;
 
   virtual int Read(int16_t* dest, int samples) = 0;
   virtual int Write(const int16_t* data, int samples) = 0;
+
+private:
+  std::mutex taps_mutex_;
+  std::vector<std::shared_ptr<AudioTap>> taps_;
+  std::atomic<int> tap_count_[2] = {};
+
+  void FeedTaps(AudioTap::Direction direction, const int16_t* samples, size_t count);
 };
@@ -0,0 +1,156 @@
+#include "audio_pipeline.h"
+#include "metrics.h"
+#include "trace.h"
+#include <esp_log.h>
+#include <chrono>
+
+#define TAG "AudioPipeline"
+
+void AudioPipeline::Initialize(AudioCodec* codec, int frame_duration_ms) {
+    codec_ = codec;
+    frame_duration_ms_ = frame_duration_ms;
+    frame_samples_ = (size_t)frame_duration_ms * codec_->input_sample_rate() / 1000;
+}
+
+void AudioPipeline::SetPreroll(int duration_ms) {
+    // Whole frames, rounded up so at least duration_ms is kept
+    size_t frames = duration_ms > 0 ? (size_t)(duration_ms + frame_duration_ms_ - 1) / frame_duration_ms_ : 0;
+    preroll_frames_ = frames;
+    ESP_LOGI(TAG, "Pre-roll of %u frames, %d ms", (unsigned)frames, (int)frames * frame_duration_ms_);
+}
+
+void AudioPipeline::DiscardPreroll() {
+    discard_preroll_ = true;
+}
+
+size_t AudioPipeline::GetFeedSize() {
+    if (!codec_) {
+        return 0;
+    }
+    return codec_->GetInputAvailableSamples() >= frame_samples_ ? frame_samples_ : 0;
+}
+
+void AudioPipeline::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
+    output_callback_ = callback;
+}
+
+void AudioPipeline::OnVadStateChange(std::function<void(bool speaking)> callback) {
+    vad_state_change_callback_ = callback;
+}
+
+void AudioPipeline::AddStage(std::unique_ptr<AudioStage> stage) {
+    if (running_) {
+        ESP_LOGE(TAG, "Stage %s added while running, ignored", stage->name());
+        return;
+    }
+    if (stage->frame_samples() == 0 || frame_samples_ % stage->frame_samples() != 0) {
+        ESP_LOGE(TAG, "Stage %s works on %u samples, which does not divide the %u sample frame, ignored",
+            stage->name(), (unsigned)stage->frame_samples(), (unsigned)frame_samples_);
+        return;
+    }
+
+    auto& timer = Metrics::GetInstance().GetHistogram("xiaozhi_audio_stage_seconds",
+        "Processing time per frame of each capture stage.", Histogram::ExponentialBounds(0.00001, 2, 12),
+        std::string("stage=\"") + stage->name() + "\"");
+    ESP_LOGI(TAG, "Stage %s, %u sample frames, %u samples latency", stage->name(),
+        (unsigned)stage->frame_samples(), (unsigned)stage->latency_samples());
+    slots_.emplace_back(std::move(stage), &timer);
+    UpdateLatency();
+}
+
+bool AudioPipeline::SetStageBypass(const std::string& name, bool bypass) {
+    for (auto& slot : slots_) {
+        if (name == slot.stage->name()) {
+            if (slot.bypassed.exchange(bypass) != bypass) {
+                ESP_LOGI(TAG, "Stage %s %s", slot.stage->name(), bypass ? "bypassed" : "enabled");
+                UpdateLatency();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t AudioPipeline::latency_samples() const {
+    size_t latency = 0;
+    for (auto& slot : slots_) {
+        if (!slot.bypassed) {
+            latency += slot.stage->latency_samples();
+        }
+    }
+    return latency;
+}
+
+void AudioPipeline::UpdateLatency() {
+    static auto& latency = Metrics::GetInstance().GetGauge("xiaozhi_audio_pipeline_latency_seconds",
+        "Delay the active capture stages add to the signal.");
+    latency.Set((double)latency_samples() / codec_->input_sample_rate());
+}
+
+void AudioPipeline::Feed(const std::vector<int16_t>& data) {
+    if (data.empty()) {
+        return;
+    }
+    if (discard_preroll_.exchange(false)) {
+        preroll_.clear();
+    }
+
+    if (!running_ || !codec_->input_enabled()) {
+        size_t capacity = preroll_frames_;
+        if (capacity > 0) {
+            preroll_.push_back(data);
+        }
+        while (preroll_.size() > capacity) {
+            preroll_.pop_front();
+        }
+        return;
+    }
+
+    // The stages start over on the oldest frame they are going to see
+    bool reset = reset_stages_.exchange(false);
+    if (!preroll_.empty()) {
+        ESP_LOGI(TAG, "Processing %u ms of pre-roll", (unsigned)(preroll_.size() * frame_duration_ms_));
+        for (auto& frame : preroll_) {
+            Process(std::move(frame), reset);
+            reset = false;
+        }
+        preroll_.clear();
+    }
+    Process(std::vector<int16_t>(data), reset);
+}
+
+void AudioPipeline::Process(std::vector<int16_t>&& frame, bool reset) {
+    for (auto& slot : slots_) {
+        bool active = !slot.bypassed.load(std::memory_order_relaxed);
+        if (active && (reset || !slot.active)) {
+            slot.stage->Reset();
+        }
+        slot.active = active;
+        if (!active) {
+            continue;
+        }
+
+        TRACE_SCOPE(slot.stage->name());
+        auto start = std::chrono::steady_clock::now();
+        slot.stage->Process(frame.data(), frame.size());
+        slot.timer->Observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    if (output_callback_) {
+        output_callback_(std::move(frame));
+    }
+}
+
+void AudioPipeline::Start() {
+    if (!running_.exchange(true)) {
+        reset_stages_ = true;
+    }
+}
+
+void AudioPipeline::Stop() {
+    running_ = false;
+}
+
+bool AudioPipeline::IsRunning() {
+    return running_;
+}
@@ -0,0 +1,80 @@
+#ifndef AUDIO_PIPELINE_H
+#define AUDIO_PIPELINE_H
+
+#include "audio_processor.h"
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+
+class Histogram;
+
+// The capture processor: a chain of stages run in place over each frame,
+// on the thread that feeds it. Feed() processes the frame and hands it to
+// the output callback before returning, so a stage costs its own CPU time
+// and nothing else, no thread or queue hop of its own.
+//
+// Frames are frame_duration_ms of input, and every stage's frame size
+// has to divide that. Stages can be bypassed while the pipeline runs; a
+// stage coming back from a bypass is reset first so it does not pick up
+// from a stale history.
+//
+// The capture is fed all the time. While the pipeline is stopped, or the
+// codec's input is disabled for push-to-talk, frames go unprocessed into
+// a bounded pre-roll; the first frame after that goes through the stages
+// behind the pre-roll, so speech that started before the listening did
+// is not clipped.
+class AudioPipeline : public AudioProcessor {
+public:
+    AudioPipeline() = default;
+    ~AudioPipeline() override = default;
+
+    void Initialize(AudioCodec* codec, int frame_duration_ms) override;
+    void Feed(const std::vector<int16_t>& data) override;
+    void Start() override;
+    void Stop() override;
+    bool IsRunning() override;
+    void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) override;
+    void OnVadStateChange(std::function<void(bool speaking)> callback) override;
+    size_t GetFeedSize() override;
+    void AddStage(std::unique_ptr<AudioStage> stage) override;
+    bool SetStageBypass(const std::string& name, bool bypass) override;
+    void SetPreroll(int duration_ms) override;
+    void DiscardPreroll() override;
+
+    // Delay of the active stages, in samples
+    size_t latency_samples() const;
+
+private:
+    struct Slot {
+        explicit Slot(std::unique_ptr<AudioStage> stage, Histogram* timer)
+            : stage(std::move(stage)), timer(timer) {}
+
+        std::unique_ptr<AudioStage> stage;
+        Histogram* timer;
+        std::atomic<bool> bypassed = false;
+        // Whether the last frame went through the stage, only touched by Feed
+        bool active = true;
+    };
+
+    AudioCodec* codec_ = nullptr;
+    size_t frame_samples_ = 0;
+    int frame_duration_ms_ = 0;
+    std::function<void(std::vector<int16_t>&& data)> output_callback_;
+    std::function<void(bool speaking)> vad_state_change_callback_;
+    std::atomic<bool> running_ = false;
+    // Set by Start, the next frame resets the stages
+    std::atomic<bool> reset_stages_ = false;
+    std::atomic<size_t> preroll_frames_ = 0;
+    std::atomic<bool> discard_preroll_ = false;
+    // Only touched by Feed
+    std::deque<std::vector<int16_t>> preroll_;
+    // Only grows before the pipeline is started, a deque so the slots
+    // never move
+    std::deque<Slot> slots_;
+
+    void UpdateLatency();
+    void Process(std::vector<int16_t>&& frame, bool reset);
+};
+
+#endif // AUDIO_PIPELINE_H
@@ -0,0 +1,27 @@
+#ifndef AUDIO_PROCESSING_AUDIO_STAGE_H
+#define AUDIO_PROCESSING_AUDIO_STAGE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// One step of the capture processing, working in place on mono int16
+// frames at a fixed sample rate. Stages are chained by the audio
+// pipeline on the thread that feeds it, so they need no locking of their
+// own.
+class AudioStage {
+public:
+    virtual ~AudioStage() = default;
+
+    // Short and stable, used as a metrics label
+    virtual const char* name() const = 0;
+    // Process() is handed a multiple of this many samples
+    virtual size_t frame_samples() const = 0;
+    // Fixed delay the stage adds to the signal, in samples
+    virtual size_t latency_samples() const = 0;
+
+    virtual void Process(int16_t* samples, size_t count) = 0;
+    // Forget the signal history, e.g. when a new session starts
+    virtual void Reset() = 0;
+};
+
+#endif // AUDIO_PROCESSING_AUDIO_STAGE_H
@@ -0,0 +1,69 @@
+#include "automatic_gain_control.h"
+#include "impl/dsp_kernels.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+constexpr float kMinGainDb = -12.0f;
+// Hops this far above the noise floor count as speech
+constexpr float kSpeechOverNoiseDb = 10.0f;
+constexpr float kSilenceDbfs = -70.0f;
+// Per 10 ms hop: the noise floor drops at once and rises 1 dB/s, the gain
+// comes down at 20 dB/s and goes up at 5 dB/s
+constexpr float kNoiseRiseDb = 0.01f;
+constexpr float kGainDownDb = 0.2f;
+constexpr float kGainUpDb = 0.05f;
+constexpr float kSpeechSmoothing = 0.1f;
+
+float DbToGain(float db) {
+    return std::pow(10.0f, db / 20.0f);
+}
+
+} // namespace
+
+AutomaticGainControl::AutomaticGainControl(int sample_rate, int target_dbfs, int max_gain_db)
+    : hop_(sample_rate / 100), target_dbfs_((float)target_dbfs), max_gain_db_((float)max_gain_db) {
+    Reset();
+}
+
+void AutomaticGainControl::Reset() {
+    // Keeps the gain, the microphone has not changed between sessions
+    speech_dbfs_ = target_dbfs_;
+    noise_dbfs_ = kSilenceDbfs;
+}
+
+void AutomaticGainControl::Process(int16_t* samples, size_t count) {
+    for (size_t offset = 0; offset + hop_ <= count; offset += hop_) {
+        ProcessHop(samples + offset);
+    }
+}
+
+void AutomaticGainControl::ProcessHop(int16_t* samples) {
+    double mean_square = (double)GetDspKernels().sum_of_squares(samples, hop_) / hop_;
+    float level_dbfs = mean_square > 0 ? (float)(10 * std::log10(mean_square / (32768.0 * 32768.0))) : kSilenceDbfs;
+    level_dbfs = std::max(level_dbfs, kSilenceDbfs);
+
+    noise_dbfs_ = std::min(level_dbfs, noise_dbfs_ + kNoiseRiseDb);
+    float previous_db = gain_db_;
+    if (level_dbfs > noise_dbfs_ + kSpeechOverNoiseDb) {
+        speech_dbfs_ += (level_dbfs - speech_dbfs_) * kSpeechSmoothing;
+        float wanted = std::clamp(target_dbfs_ - speech_dbfs_, kMinGainDb, max_gain_db_);
+        gain_db_ = wanted < gain_db_ ? std::max(wanted, gain_db_ - kGainDownDb)
+                                     : std::min(wanted, gain_db_ + kGainUpDb);
+    }
+
+    float start = DbToGain(previous_db);
+    float end = DbToGain(gain_db_);
+    // Never clip, a loud onset cuts the gain at once
+    int peak = GetDspKernels().peak(samples, hop_);
+    if (peak > 0 && peak * std::max(start, end) > 32767.0f) {
+        end = std::min(end, 32767.0f / peak);
+        start = std::min(start, end);
+        gain_db_ = 20 * std::log10(end);
+    }
+    if (start == 1.0f && end == 1.0f) {
+        return;
+    }
+    GetDspKernels().gain_ramp(samples, hop_, start, end);
+}
@@ -0,0 +1,34 @@
+#ifndef AUDIO_PROCESSING_AUTOMATIC_GAIN_CONTROL_H
+#define AUDIO_PROCESSING_AUTOMATIC_GAIN_CONTROL_H
+
+#include "audio_stage.h"
+
+// Brings speech on the capture path to a target level whatever the host
+// microphone gain. The level is measured on 10 ms hops and only followed
+// while it stands clear of the tracked noise floor, so pauses are not
+// pumped up. The gain moves in ramps across each hop and is cut at once
+// when a hop would clip.
+class AutomaticGainControl : public AudioStage {
+public:
+    AutomaticGainControl(int sample_rate, int target_dbfs = -18, int max_gain_db = 24);
+
+    const char* name() const override { return "agc"; }
+    size_t frame_samples() const override { return hop_; }
+    size_t latency_samples() const override { return 0; }
+    void Process(int16_t* samples, size_t count) override;
+    void Reset() override;
+
+    float gain_db() const { return gain_db_; }
+
+private:
+    int hop_;
+    float target_dbfs_;
+    float max_gain_db_;
+    float gain_db_ = 0;
+    float speech_dbfs_;
+    float noise_dbfs_;
+
+    void ProcessHop(int16_t* samples);
+};
+
+#endif // AUDIO_PROCESSING_AUTOMATIC_GAIN_CONTROL_H
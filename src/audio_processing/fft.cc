@@ -0,0 +1,152 @@
+#include "fft.h"
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FFT_USE_SSE2 1
+#endif
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+
+} // namespace
+
+Fft::Fft(int size) : size_(size), half_(size / 2) {
+    int bits = 0;
+    while ((1 << bits) < half_) {
+        bits++;
+    }
+    bit_reverse_.resize(half_);
+    for (int i = 0; i < half_; i++) {
+        int reversed = 0;
+        for (int b = 0; b < bits; b++) {
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        bit_reverse_[i] = reversed;
+    }
+
+    for (int length = 2; length <= half_; length <<= 1) {
+        for (int j = 0; j < length / 2; j++) {
+            double angle = -2 * kPi * j / length;
+            twiddle_re_.push_back((float)std::cos(angle));
+            twiddle_im_.push_back((float)std::sin(angle));
+        }
+    }
+
+    split_re_.resize(half_ + 1);
+    split_im_.resize(half_ + 1);
+    for (int k = 0; k <= half_; k++) {
+        double angle = -2 * kPi * k / size_;
+        split_re_[k] = (float)std::cos(angle);
+        split_im_[k] = (float)std::sin(angle);
+    }
+
+    work_re_.resize(half_);
+    work_im_.resize(half_);
+}
+
+void Fft::Transform(float* re, float* im) {
+    int offset = 0;
+    for (int length = 2; length <= half_; length <<= 1) {
+        int half = length / 2;
+        const float* wr = twiddle_re_.data() + offset;
+        const float* wi = twiddle_im_.data() + offset;
+        for (int i = 0; i < half_; i += length) {
+            int j = 0;
+#if FFT_USE_SSE2
+            for (; j + 4 <= half; j += 4) {
+                float* ar = re + i + j;
+                float* ai = im + i + j;
+                float* br = ar + half;
+                float* bi = ai + half;
+                __m128 xr = _mm_loadu_ps(br);
+                __m128 xi = _mm_loadu_ps(bi);
+                __m128 cr = _mm_loadu_ps(wr + j);
+                __m128 ci = _mm_loadu_ps(wi + j);
+                __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, cr), _mm_mul_ps(xi, ci));
+                __m128 ti = _mm_add_ps(_mm_mul_ps(xr, ci), _mm_mul_ps(xi, cr));
+                __m128 yr = _mm_loadu_ps(ar);
+                __m128 yi = _mm_loadu_ps(ai);
+                _mm_storeu_ps(br, _mm_sub_ps(yr, tr));
+                _mm_storeu_ps(bi, _mm_sub_ps(yi, ti));
+                _mm_storeu_ps(ar, _mm_add_ps(yr, tr));
+                _mm_storeu_ps(ai, _mm_add_ps(yi, ti));
+            }
+#endif
+            for (; j < half; j++) {
+                int a = i + j;
+                int b = a + half;
+                float tr = re[b] * wr[j] - im[b] * wi[j];
+                float ti = re[b] * wi[j] + im[b] * wr[j];
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+        offset += half;
+    }
+}
+
+void Fft::Forward(const float* input, float* re, float* im) {
+    // Even samples as the real part, odd ones as the imaginary part
+    for (int n = 0; n < half_; n++) {
+        work_re_[bit_reverse_[n]] = input[2 * n];
+        work_im_[bit_reverse_[n]] = input[2 * n + 1];
+    }
+    Transform(work_re_.data(), work_im_.data());
+
+    // X[k] = E[k] + W^k O[k], with E and O recovered from Z[k] and Z[N/2 - k]
+    for (int k = 0; k <= half_; k++) {
+        int a = k == half_ ? 0 : k;
+        int b = k == 0 ? 0 : half_ - k;
+        float zr = work_re_[a], zi = work_im_[a];
+        float cr = work_re_[b], ci = -work_im_[b];
+        float er = 0.5f * (zr + cr);
+        float ei = 0.5f * (zi + ci);
+        float or_ = 0.5f * (zi - ci);
+        float oi = -0.5f * (zr - cr);
+        re[k] = er + split_re_[k] * or_ - split_im_[k] * oi;
+        im[k] = ei + split_re_[k] * oi + split_im_[k] * or_;
+    }
+}
+
+void Fft::Inverse(const float* re, const float* im, float* output) {
+    // Z[k] = E[k] + i O[k], undoing the split of Forward
+    for (int k = 0; k < half_; k++) {
+        float xr = re[k], xi = im[k];
+        float cr = re[half_ - k], ci = -im[half_ - k];
+        float er = 0.5f * (xr + cr);
+        float ei = 0.5f * (xi + ci);
+        float dr = 0.5f * (xr - cr);
+        float di = 0.5f * (xi - ci);
+        // O = d * conj(W^k)
+        float or_ = dr * split_re_[k] + di * split_im_[k];
+        float oi = di * split_re_[k] - dr * split_im_[k];
+        // The inverse transform as a forward one of the conjugate
+        work_re_[bit_reverse_[k]] = er - oi;
+        work_im_[bit_reverse_[k]] = -(ei + or_);
+    }
+    Transform(work_re_.data(), work_im_.data());
+
+    float scale = 1.0f / half_;
+    for (int n = 0; n < half_; n++) {
+        output[2 * n] = work_re_[n] * scale;
+        output[2 * n + 1] = -work_im_[n] * scale;
+    }
+}
+
+void Fft::Power(const float* re, const float* im, float* power, int bins) {
+    int k = 0;
+#if FFT_USE_SSE2
+    for (; k + 4 <= bins; k += 4) {
+        __m128 r = _mm_loadu_ps(re + k);
+        __m128 i = _mm_loadu_ps(im + k);
+        _mm_storeu_ps(power + k, _mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(i, i)));
+    }
+#endif
+    for (; k < bins; k++) {
+        power[k] = re[k] * re[k] + im[k] * im[k];
+    }
+}
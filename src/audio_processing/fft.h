@@ -0,0 +1,42 @@
+#ifndef AUDIO_PROCESSING_FFT_H
+#define AUDIO_PROCESSING_FFT_H
+
+#include <vector>
+
+// Radix-2 FFT of real input, computed as a complex FFT of half the size.
+// Real and imaginary parts are kept in separate arrays so the butterflies
+// run four at a time with SSE2, with a scalar path for the short stages
+// and for other targets.
+class Fft {
+public:
+    // size is a power of two, at least 8
+    explicit Fft(int size);
+
+    int size() const { return size_; }
+    int bins() const { return size_ / 2 + 1; }
+
+    // size real samples in, bins() complex bins out
+    void Forward(const float* input, float* re, float* im);
+    // bins() complex bins in, size real samples out, scaled so that
+    // Inverse(Forward(x)) == x
+    void Inverse(const float* re, const float* im, float* output);
+    // |X[k]|^2 of the bins, bins() values out
+    static void Power(const float* re, const float* im, float* power, int bins);
+
+private:
+    int size_;
+    int half_;
+    std::vector<int> bit_reverse_;
+    // Per stage twiddles, concatenated, for the half size complex FFT
+    std::vector<float> twiddle_re_;
+    std::vector<float> twiddle_im_;
+    // exp(-2 pi i k / size) for splitting the packed result
+    std::vector<float> split_re_;
+    std::vector<float> split_im_;
+    std::vector<float> work_re_;
+    std::vector<float> work_im_;
+
+    void Transform(float* re, float* im);
+};
+
+#endif // AUDIO_PROCESSING_FFT_H
@@ -0,0 +1,49 @@
+#include "limiter.h"
+#include "impl/dsp_kernels.h"
+#include <algorithm>
+#include <cmath>
+
+Limiter::Limiter(int threshold, int lookahead, int release)
+    : threshold_((float)threshold), attack_step_(1.0f / lookahead),
+      release_coefficient_(1.0f / release) {
+}
+
+void Limiter::Reset() {
+    gain_ = 1.0f;
+}
+
+void Limiter::Process(int16_t* samples, size_t count, float volume) {
+    if (count == 0) {
+        return;
+    }
+    // Most buffers stay well below the threshold
+    auto& dsp = GetDspKernels();
+    if (gain_ >= 1.0f && dsp.peak(samples, count) * volume <= threshold_) {
+        if (volume != 1.0f) {
+            dsp.gain(samples, count, volume);
+        }
+        return;
+    }
+
+    // Backwards, the gain each sample needs, lowered further so that it
+    // falls by at most attack_step_ per sample towards the next peak
+    gains_.resize(count);
+    float next = 1.0f;
+    for (size_t i = count; i-- > 0;) {
+        float level = std::abs((float)samples[i]) * volume;
+        float needed = level > threshold_ ? threshold_ / level : 1.0f;
+        next = std::min(needed, next + attack_step_);
+        gains_[i] = next;
+    }
+
+    // Forwards, follow drops at once and recover with the release
+    float gain = gain_;
+    for (size_t i = 0; i < count; i++) {
+        float target = gains_[i];
+        gain = target < gain ? target : gain + (target - gain) * release_coefficient_;
+        gains_[i] = gain * volume;
+    }
+    // The release only approaches unity, snap to it for the fast path
+    gain_ = gain > 0.999f ? 1.0f : gain;
+    dsp.gain_curve(samples, gains_.data(), count);
+}
@@ -0,0 +1,33 @@
+#ifndef AUDIO_PROCESSING_LIMITER_H
+#define AUDIO_PROCESSING_LIMITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Peak limiter for the playback path, with the volume applied in the same
+// pass. It looks ahead within each buffer: the gain ramps down over the
+// look-ahead before a peak instead of clipping it, and recovers slowly
+// afterwards. Nothing is delayed, so a peak in the first samples of a
+// buffer is met with an immediate gain change rather than a ramp.
+class Limiter {
+public:
+    // Times in samples, they only need to be roughly right across the
+    // rates the decoder may produce
+    Limiter(int threshold = 29200, int lookahead = 48, int release = 4800);
+
+    // volume is a linear gain applied before limiting
+    void Process(int16_t* samples, size_t count, float volume);
+    void Reset();
+
+    float gain() const { return gain_; }
+
+private:
+    float threshold_;
+    float attack_step_;
+    float release_coefficient_;
+    float gain_ = 1.0f;
+    std::vector<float> gains_;
+};
+
+#endif // AUDIO_PROCESSING_LIMITER_H
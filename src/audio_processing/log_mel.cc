@@ -0,0 +1,116 @@
+#include "log_mel.h"
+#include "impl/dsp_kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LOG_MEL_USE_SSE2 1
+#endif
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+// Keeps silence out of the log's steep end
+constexpr float kEnergyFloor = 1e-3f;
+
+int FftSizeFor(int window) {
+    int size = 8;
+    while (size < window) {
+        size <<= 1;
+    }
+    return size;
+}
+
+double HzToMel(double hz) {
+    return 2595.0 * std::log10(1.0 + hz / 700.0);
+}
+
+double MelToHz(double mel) {
+    return 700.0 * (std::pow(10.0, mel / 2595.0) - 1.0);
+}
+
+void Multiply(const float* a, const float* b, float* dest, int count) {
+    int i = 0;
+#if LOG_MEL_USE_SSE2
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(dest + i, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+#endif
+    for (; i < count; i++) {
+        dest[i] = a[i] * b[i];
+    }
+}
+
+} // namespace
+
+LogMel::LogMel(int sample_rate, int window_ms, int hop_ms, int bands)
+    : window_(sample_rate * window_ms / 1000), hop_(sample_rate * hop_ms / 1000), bands_(bands),
+      fft_(FftSizeFor(sample_rate * window_ms / 1000)) {
+    history_.resize(window_);
+    hann_.resize(window_);
+    for (int i = 0; i < window_; i++) {
+        hann_[i] = (float)(0.5 - 0.5 * std::cos(2 * kPi * i / window_));
+    }
+    frame_.assign(fft_.size(), 0.0f);
+    re_.resize(fft_.bins());
+    im_.resize(fft_.bins());
+    power_.resize(fft_.bins());
+
+    // bands + 2 points evenly spaced on the mel scale, each filter rises
+    // from one point to the next and falls to the one after
+    double low = HzToMel(60.0);
+    double high = HzToMel(sample_rate / 2.0);
+    double bin_hz = (double)sample_rate / fft_.size();
+    std::vector<double> edges(bands_ + 2);
+    for (int i = 0; i < bands_ + 2; i++) {
+        edges[i] = MelToHz(low + (high - low) * i / (bands_ + 1)) / bin_hz;
+    }
+    filters_.resize(bands_);
+    for (int m = 0; m < bands_; m++) {
+        int first = (int)std::ceil(edges[m]);
+        int last = std::min((int)std::floor(edges[m + 2]), fft_.bins() - 1);
+        auto& filter = filters_[m];
+        filter.first_bin = first;
+        for (int k = first; k <= last; k++) {
+            double weight = k <= edges[m + 1]
+                ? (k - edges[m]) / (edges[m + 1] - edges[m])
+                : (edges[m + 2] - k) / (edges[m + 2] - edges[m + 1]);
+            filter.weights.push_back((float)std::max(weight, 0.0));
+        }
+    }
+}
+
+void LogMel::Reset() {
+    filled_ = 0;
+    std::fill(history_.begin(), history_.end(), 0.0f);
+}
+
+void LogMel::Skip(const int16_t* samples) {
+    std::memmove(history_.data(), history_.data() + hop_, (window_ - hop_) * sizeof(float));
+    GetDspKernels().to_float(samples, history_.data() + window_ - hop_, hop_);
+    filled_ = std::min(filled_ + hop_, window_);
+}
+
+bool LogMel::Process(const int16_t* samples, float* features) {
+    Skip(samples);
+    if (filled_ < window_) {
+        return false;
+    }
+
+    Multiply(history_.data(), hann_.data(), frame_.data(), window_);
+    fft_.Forward(frame_.data(), re_.data(), im_.data());
+    Fft::Power(re_.data(), im_.data(), power_.data(), fft_.bins());
+
+    for (int m = 0; m < bands_; m++) {
+        auto& filter = filters_[m];
+        const float* power = power_.data() + filter.first_bin;
+        float energy = 0;
+        for (size_t k = 0; k < filter.weights.size(); k++) {
+            energy += power[k] * filter.weights[k];
+        }
+        features[m] = std::log(std::max(energy, kEnergyFloor));
+    }
+    return true;
+}
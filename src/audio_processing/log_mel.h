@@ -0,0 +1,45 @@
+#ifndef AUDIO_PROCESSING_LOG_MEL_H
+#define AUDIO_PROCESSING_LOG_MEL_H
+
+#include "fft.h"
+#include <cstdint>
+#include <vector>
+
+// Streaming log-mel filterbank: a Hann window over the last window_ms of
+// input every hop_ms, zero padded to a power of two, triangular mel
+// filters over the power spectrum and the natural log of each band.
+class LogMel {
+public:
+    LogMel(int sample_rate = 16000, int window_ms = 25, int hop_ms = 10, int bands = 40);
+
+    int hop_samples() const { return hop_; }
+    int bands() const { return bands_; }
+
+    // Takes hop_samples() samples, writes bands() values. Returns false
+    // until the first full window has been seen.
+    bool Process(const int16_t* samples, float* features);
+    // Only slides the window, for hops whose features are not needed
+    void Skip(const int16_t* samples);
+    void Reset();
+
+private:
+    struct Filter {
+        int first_bin;
+        std::vector<float> weights;
+    };
+
+    int window_;
+    int hop_;
+    int bands_;
+    int filled_ = 0;
+    Fft fft_;
+    std::vector<float> history_;
+    std::vector<float> hann_;
+    std::vector<float> frame_;
+    std::vector<float> re_;
+    std::vector<float> im_;
+    std::vector<float> power_;
+    std::vector<Filter> filters_;
+};
+
+#endif // AUDIO_PROCESSING_LOG_MEL_H
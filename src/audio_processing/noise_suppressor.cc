@@ -0,0 +1,149 @@
+#include "noise_suppressor.h"
+#include "impl/dsp_kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NS_USE_SSE2 1
+#endif
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+// Frames averaged for the first noise estimate
+constexpr int kInitialFrames = 10;
+// How fast the noise estimate may follow a rising noise floor
+constexpr double kNoiseRiseDbPerSecond = 5.0;
+// The minimum of the smoothed power sits below the mean noise power
+constexpr float kMinimumBias = 1.5f;
+constexpr float kPowerSmoothing = 0.7f;
+// Weight of the previous frame in the decision directed estimate
+constexpr float kDecisionDirected = 0.98f;
+
+void Multiply(const float* a, const float* b, float* dest, int count) {
+    int i = 0;
+#if NS_USE_SSE2
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(dest + i, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+#endif
+    for (; i < count; i++) {
+        dest[i] = a[i] * b[i];
+    }
+}
+
+void ApplyGain(float* re, float* im, const float* gain, int count) {
+    int i = 0;
+#if NS_USE_SSE2
+    for (; i + 4 <= count; i += 4) {
+        __m128 g = _mm_loadu_ps(gain + i);
+        _mm_storeu_ps(re + i, _mm_mul_ps(_mm_loadu_ps(re + i), g));
+        _mm_storeu_ps(im + i, _mm_mul_ps(_mm_loadu_ps(im + i), g));
+    }
+#endif
+    for (; i < count; i++) {
+        re[i] *= gain[i];
+        im[i] *= gain[i];
+    }
+}
+
+int FftSizeFor(int window) {
+    int size = 8;
+    while (size < window) {
+        size <<= 1;
+    }
+    return size;
+}
+
+} // namespace
+
+NoiseSuppressor::NoiseSuppressor(int sample_rate, int suppression_db)
+    : hop_(sample_rate / 100), window_(sample_rate / 50), fft_(FftSizeFor(sample_rate / 50)) {
+    gain_floor_ = (float)std::pow(10.0, -suppression_db / 20.0);
+    noise_rise_ = (float)std::pow(10.0, kNoiseRiseDbPerSecond * 0.01 / 10.0);
+
+    // Square root of a periodic Hann, analysis and synthesis together sum
+    // to one at 50% overlap
+    window_coeffs_.resize(window_);
+    for (int i = 0; i < window_; i++) {
+        window_coeffs_[i] = (float)std::sqrt(0.5 - 0.5 * std::cos(2 * kPi * i / window_));
+    }
+    input_.resize(window_);
+    overlap_.resize(window_ - hop_);
+    frame_.resize(fft_.size());
+    int bins = fft_.bins();
+    re_.resize(bins);
+    im_.resize(bins);
+    power_.resize(bins);
+    smoothed_.resize(bins);
+    noise_.resize(bins);
+    gain_.resize(bins);
+    previous_snr_.resize(bins);
+    Reset();
+}
+
+void NoiseSuppressor::Reset() {
+    frames_seen_ = 0;
+    std::fill(input_.begin(), input_.end(), 0.0f);
+    std::fill(overlap_.begin(), overlap_.end(), 0.0f);
+    std::fill(smoothed_.begin(), smoothed_.end(), 0.0f);
+    std::fill(noise_.begin(), noise_.end(), 0.0f);
+    std::fill(previous_snr_.begin(), previous_snr_.end(), 0.0f);
+}
+
+void NoiseSuppressor::Process(int16_t* samples, size_t count) {
+    for (size_t offset = 0; offset + hop_ <= count; offset += hop_) {
+        ProcessHop(samples + offset);
+    }
+}
+
+void NoiseSuppressor::ProcessHop(int16_t* samples) {
+    std::memmove(input_.data(), input_.data() + hop_, (window_ - hop_) * sizeof(float));
+    GetDspKernels().to_float(samples, input_.data() + window_ - hop_, hop_);
+
+    Multiply(input_.data(), window_coeffs_.data(), frame_.data(), window_);
+    std::fill(frame_.begin() + window_, frame_.end(), 0.0f);
+    fft_.Forward(frame_.data(), re_.data(), im_.data());
+    Fft::Power(re_.data(), im_.data(), power_.data(), fft_.bins());
+
+    int bins = fft_.bins();
+    bool initial = frames_seen_ < kInitialFrames;
+    for (int k = 0; k < bins; k++) {
+        float smoothed = frames_seen_ == 0 ? power_[k]
+            : kPowerSmoothing * smoothed_[k] + (1 - kPowerSmoothing) * power_[k];
+        smoothed_[k] = smoothed;
+        if (initial) {
+            noise_[k] += (smoothed - noise_[k]) / (frames_seen_ + 1);
+        } else {
+            noise_[k] = std::min(smoothed, noise_[k] * noise_rise_);
+        }
+
+        float noise = noise_[k] * kMinimumBias + 1e-3f;
+        float posterior = power_[k] / noise;
+        float prior = kDecisionDirected * previous_snr_[k] +
+                      (1 - kDecisionDirected) * std::max(posterior - 1, 0.0f);
+        float gain = std::max(prior / (1 + prior), gain_floor_);
+        gain_[k] = gain;
+        previous_snr_[k] = gain * gain * posterior;
+    }
+    frames_seen_++;
+
+    ApplyGain(re_.data(), im_.data(), gain_.data(), bins);
+    fft_.Inverse(re_.data(), im_.data(), frame_.data());
+    Multiply(frame_.data(), window_coeffs_.data(), frame_.data(), window_);
+
+    // The first hop is complete, the rest waits for the next frame
+    for (int i = 0; i < hop_; i++) {
+        overlap_[i] += frame_[i];
+    }
+    GetDspKernels().from_float(overlap_.data(), samples, hop_);
+    std::memmove(overlap_.data(), overlap_.data() + hop_, (window_ - 2 * hop_) * sizeof(float));
+    for (int i = window_ - 2 * hop_; i < window_ - hop_; i++) {
+        overlap_[i] = 0;
+    }
+    for (int i = 0; i < window_ - hop_; i++) {
+        overlap_[i] += frame_[hop_ + i];
+    }
+}
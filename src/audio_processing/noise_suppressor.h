@@ -0,0 +1,50 @@
+#ifndef AUDIO_PROCESSING_NOISE_SUPPRESSOR_H
+#define AUDIO_PROCESSING_NOISE_SUPPRESSOR_H
+
+#include "audio_stage.h"
+#include "fft.h"
+#include <vector>
+
+// Streaming spectral noise suppression. Frames of 20 ms with 50% overlap
+// go through a square root Hann window and the FFT. The noise power of
+// each bin follows the minimum of the smoothed spectrum and rises
+// slowly, and the bins are scaled by a Wiener gain on the decision
+// directed a priori SNR, floored at the configured suppression. The output
+// is overlap-added, which delays the signal by one 10 ms hop.
+class NoiseSuppressor : public AudioStage {
+public:
+    // suppression_db limits how far noise is pulled down, more sounds
+    // cleaner but starts to warble
+    NoiseSuppressor(int sample_rate, int suppression_db = 15);
+
+    const char* name() const override { return "ns"; }
+    size_t frame_samples() const override { return hop_; }
+    size_t latency_samples() const override { return hop_; }
+    void Process(int16_t* samples, size_t count) override;
+    void Reset() override;
+
+private:
+    int hop_;
+    int window_;
+    float gain_floor_;
+    float noise_rise_;
+    int frames_seen_ = 0;
+    Fft fft_;
+
+    std::vector<float> window_coeffs_;
+    std::vector<float> input_;
+    std::vector<float> overlap_;
+    std::vector<float> frame_;
+    std::vector<float> re_;
+    std::vector<float> im_;
+    std::vector<float> power_;
+    std::vector<float> smoothed_;
+    std::vector<float> noise_;
+    std::vector<float> gain_;
+    // |G S|^2 of the previous frame over the noise, for the decision directed estimate
+    std::vector<float> previous_snr_;
+
+    void ProcessHop(int16_t* samples);
+};
+
+#endif // AUDIO_PROCESSING_NOISE_SUPPRESSOR_H
@@ -4,14 +4,16 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <memory>
 
 #include "audio_codec.h"
+#include "audio_processing/audio_stage.h"
 
 class AudioProcessor {
 public:
     virtual ~AudioProcessor() = default;
     
-    virtual void Initialize(AudioCodec* codec) = 0;
+    virtual void Initialize(AudioCodec* codec, int frame_duration_ms) = 0;
     virtual void Feed(const std::vector<int16_t>& data) = 0;
     virtual void Start() = 0;
     virtual void Stop() = 0;
@@ -19,6 +21,18 @@ public:
     virtual void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) = 0;
     virtual void OnVadStateChange(std::function<void(bool speaking)> callback) = 0;
     virtual size_t GetFeedSize() = 0;
+    // Stages run in the order they were added, on every fed frame before
+    // the output callback. Added before the processor is started.
+    virtual void AddStage(std::unique_ptr<AudioStage> stage) = 0;
+    // Lets the frames skip a stage while running, false if there is no
+    // stage of that name
+    virtual bool SetStageBypass(const std::string& name, bool bypass) = 0;
+    // How much input is kept while the processor is stopped or the input
+    // is disabled, and processed ahead of the first frame once it is
+    // neither. 0 drops that input.
+    virtual void SetPreroll(int duration_ms) = 0;
+    // Drops what the pre-roll holds, e.g. input that is only the speaker
+    virtual void DiscardPreroll() = 0;
 };
 
 #endif
@@ -0,0 +1,48 @@
+#include "audio_tap.h"
+#include <algorithm>
+#include <cstring>
+
+AudioTap::AudioTap(Direction direction, size_t capacity)
+: direction_(direction) {
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  buffer_.resize(size);
+  mask_ = size - 1;
+}
+
+size_t AudioTap::Push(const int16_t* samples, size_t count) {
+  // The indices only grow, their difference is the fill level
+  size_t write = write_index_.load(std::memory_order_relaxed);
+  size_t read = read_index_.load(std::memory_order_acquire);
+  size_t space = buffer_.size() - (write - read);
+  if (count > space) {
+    dropped_.fetch_add(count - space, std::memory_order_relaxed);
+    count = space;
+  }
+
+  size_t offset = write & mask_;
+  size_t first = std::min(count, buffer_.size() - offset);
+  memcpy(&buffer_[offset], samples, first * sizeof(int16_t));
+  memcpy(&buffer_[0], samples + first, (count - first) * sizeof(int16_t));
+  write_index_.store(write + count, std::memory_order_release);
+  return count;
+}
+
+size_t AudioTap::Pop(int16_t* dest, size_t count) {
+  size_t read = read_index_.load(std::memory_order_relaxed);
+  size_t write = write_index_.load(std::memory_order_acquire);
+  count = std::min(count, write - read);
+
+  size_t offset = read & mask_;
+  size_t first = std::min(count, buffer_.size() - offset);
+  memcpy(dest, &buffer_[offset], first * sizeof(int16_t));
+  memcpy(dest + first, &buffer_[0], (count - first) * sizeof(int16_t));
+  read_index_.store(read + count, std::memory_order_release);
+  return count;
+}
+
+size_t AudioTap::Available() const {
+  return write_index_.load(std::memory_order_acquire) - read_index_.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <atomic>
+
+// Single producer, single consumer ring of PCM samples. The producer is
+// the audio thread of the codec, the consumer is whoever subscribed to it
+// (the UI, a recorder, a level meter). Neither side ever blocks; what does
+// not fit is dropped and counted.
+class AudioTap {
+public:
+  enum Direction {
+    kInput = 0,
+    kOutput = 1,
+  };
+
+  // capacity is rounded up to a power of two
+  AudioTap(Direction direction, size_t capacity);
+
+  // Producer side
+  size_t Push(const int16_t* samples, size_t count);
+
+  // Consumer side
+  size_t Pop(int16_t* dest, size_t count);
+  size_t Available() const;
+
+  inline Direction direction() const { return direction_; }
+  inline size_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  const Direction direction_;
+  std::vector<int16_t> buffer_;
+  size_t mask_;
+  std::atomic<size_t> write_index_ = 0;
+  std::atomic<size_t> read_index_ = 0;
+  std::atomic<size_t> dropped_ = 0;
+};
@@ -1,10 +1,31 @@
 #include "background_task.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include <esp_log.h>
+#include <chrono>
 //#include <esp_task_wdt.h>
 
 #define TAG "BackgroundTask"
 
+namespace {
+
+struct TaskMetrics {
+    Counter& scheduled = Metrics::GetInstance().GetCounter("xiaozhi_background_tasks_total",
+        "Callbacks scheduled on background tasks.");
+    Gauge& pending = Metrics::GetInstance().GetGauge("xiaozhi_background_tasks_pending",
+        "Callbacks scheduled but not finished yet.");
+    Histogram& run_time = Metrics::GetInstance().GetHistogram("xiaozhi_background_task_run_seconds",
+        "Time spent in one background callback.", Histogram::ExponentialBounds(0.0001, 4, 8));
+};
+
+TaskMetrics& task_metrics() {
+    static TaskMetrics metrics;
+    return metrics;
+}
+
+}
+
 BackgroundTask::BackgroundTask(uint32_t stack_size) {
     xTaskCreate([](void* arg) {
         BackgroundTask* task = (BackgroundTask*)arg;
@@ -27,8 +48,17 @@ void BackgroundTask::Schedule(std::function<void()> callback) {
         //}
     }
     active_tasks_++;
+    task_metrics().scheduled.Increment();
+    task_metrics().pending.Add(1);
     main_tasks_.emplace_back([this, cb = std::move(callback)]() {
-        cb();
+        auto start = std::chrono::steady_clock::now();
+        {
+            TRACE_SCOPE("BackgroundTask task");
+            cb();
+        }
+        auto& metrics = task_metrics();
+        metrics.run_time.Observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        metrics.pending.Add(-1);
         {
             std::lock_guard<std::mutex> lock(mutex_);
             active_tasks_--;
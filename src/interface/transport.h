@@ -1,6 +1,7 @@
 #ifndef _TRANSPORT_H_
 #define _TRANSPORT_H_
 
+#include <atomic>
 #include <cstddef>
 
 class Transport {
@@ -10,11 +11,15 @@ public:
     virtual void Disconnect() = 0;
     virtual int Send(const char* data, size_t length) = 0;
     virtual int Receive(char* buffer, size_t bufferSize) = 0;
+    // Bytes written that the network stack has not sent yet, 0 where the
+    // platform does not tell
+    virtual size_t GetSendQueueBytes() { return 0; }
 
     bool connected() const { return connected_; }
 
 protected:
-    bool connected_ = false;
+    // Read by the sending and the receiving threads
+    std::atomic<bool> connected_ = false;
 };
 
 #endif // _TRANSPORT_H_
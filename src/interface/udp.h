@@ -11,6 +11,8 @@ public:
     virtual bool Connect(const std::string& host, int port) = 0;
     virtual void Disconnect() = 0;
     virtual int Send(const std::string& data) = 0;
+    // Datagrams accepted by Send but not yet handed to the network
+    virtual size_t GetSendQueueSize() { return 0; }
 
     virtual void OnMessage(std::function<void(const std::string& data)> callback) {
         message_callback_ = callback;
@@ -5,11 +5,16 @@
 #include <string>
 #include <map>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstdint>
 #include "transport.h"
 
 
 class WebSocket {
 public:
+    // Takes the ownership of transport
     WebSocket(Transport *transport);
     ~WebSocket();
 
@@ -19,28 +24,49 @@ public:
     bool Connect(const char* uri);
     bool Send(const std::string& data);
     bool Send(const void* data, size_t len, bool binary = false, bool fin = true);
+    // One frame whose payload is prefix followed by data, without gathering
+    // them in a buffer of the caller's first
+    bool Send(const void* prefix, size_t prefix_len, const void* data, size_t len, bool binary);
+    // Written but not yet sent by the network stack
+    size_t GetSendQueueBytes();
     void Ping();
     void Close();
 
     void OnConnected(std::function<void()> callback);
     void OnDisconnected(std::function<void()> callback);
+    // data points into the receive buffer and is only valid during the call,
+    // it is always followed by a NUL so text frames can be parsed in place
     void OnData(std::function<void(const char*, size_t, bool binary)> callback);
     void OnError(std::function<void(int)> callback);
+    void OnPong(std::function<void()> callback);
 
 private:
     Transport *transport_;
     std::thread receive_thread_;
     bool continuation_ = false;
     size_t receive_buffer_size_ = 2048;
+    std::atomic<bool> closing_ = false;
+
+    std::mutex send_mutex_;
+    std::vector<uint8_t> send_buffer_;
+    std::vector<char> receive_buffer_;
+    size_t received_ = 0;
+    std::string fragments_;
+    bool fragments_binary_ = false;
+    uint32_t mask_seed_ = 0;
 
     std::map<std::string, std::string> headers_;
     std::function<void(const char*, size_t, bool binary)> on_data_;
     std::function<void(int)> on_error_;
     std::function<void()> on_connected_;
     std::function<void()> on_disconnected_;
+    std::function<void()> on_pong_;
 
     void ReceiveTask();
+    bool HandleFrame(uint8_t opcode, bool fin, char* payload, size_t len);
     bool SendAllRaw(const void* data, size_t len);
+    bool SendFrame(uint8_t opcode, bool fin, const void* prefix, size_t prefix_len, const void* data, size_t len);
+    static void MaskCopy(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t* mask, size_t offset);
     bool SendControlFrame(uint8_t opcode, const void* data, size_t len);
 };
 
@@ -7,6 +7,7 @@
 
 #include "application.h"
 #include "system_info.h"
+#include "settings.h"
 
 #define TAG "main"
 
@@ -24,6 +25,16 @@ extern "C" void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
+    // Logging setup, e.g. levels "*:I,MQTT:D" and format "json"
+    {
+        Settings settings("log", false);
+        esp_log_port_set_levels(settings.GetString("levels").c_str());
+        if (settings.GetString("format") == "json") {
+            esp_log_port_set_format(ESP_LOG_FORMAT_JSON);
+        }
+        esp_log_port_set_rate_limit("*", settings.GetInt("rate_limit", 100));
+    }
+
     // Launch the application
     Application::GetInstance().Start();
 }
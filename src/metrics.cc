@@ -0,0 +1,241 @@
+#include "metrics.h"
+#include "impl/process_stats.h"
+#include "trace.h"
+#include "httplib.h"
+#include <esp_log.h>
+#include <algorithm>
+#include <cmath>
+
+#define TAG "Metrics"
+
+namespace {
+
+void AppendValue(std::string& out, double value) {
+    char buffer[32];
+    if (std::isinf(value)) {
+        snprintf(buffer, sizeof(buffer), value > 0 ? "+Inf" : "-Inf");
+    } else {
+        snprintf(buffer, sizeof(buffer), "%.15g", value);
+    }
+    out += buffer;
+}
+
+void AppendSeries(std::string& out, const std::string& name, const std::string& labels, double value) {
+    out += name;
+    if (!labels.empty()) {
+        out += "{" + labels + "}";
+    }
+    out += ' ';
+    AppendValue(out, value);
+    out += '\n';
+}
+
+} // namespace
+
+Histogram::Histogram(std::vector<double> bounds)
+    : bounds_(std::move(bounds)), buckets_(new std::atomic<uint64_t>[bounds_.size() + 1]) {
+    std::sort(bounds_.begin(), bounds_.end());
+    for (size_t i = 0; i <= bounds_.size(); i++) {
+        buckets_[i] = 0;
+    }
+}
+
+void Histogram::Observe(double value) {
+    size_t index = std::lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin();
+    buckets_[index].fetch_add(1, std::memory_order_relaxed);
+    double current = sum_.load(std::memory_order_relaxed);
+    while (!sum_.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {
+    }
+}
+
+void Histogram::Snapshot(std::vector<uint64_t>& counts, double& sum) const {
+    counts.resize(bounds_.size() + 1);
+    for (size_t i = 0; i <= bounds_.size(); i++) {
+        counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    }
+    sum = sum_.load(std::memory_order_relaxed);
+}
+
+std::vector<double> Histogram::ExponentialBounds(double start, double factor, int count) {
+    std::vector<double> bounds;
+    for (int i = 0; i < count; i++) {
+        bounds.push_back(start);
+        start *= factor;
+    }
+    return bounds;
+}
+
+Metrics::Metrics() {
+    AddCollector([this]() {
+        CollectProcessStats();
+    });
+}
+
+Metrics::Series& Metrics::Lookup(const std::string& name, const std::string& help, const std::string& labels, Type type) {
+    auto it = families_.find(name);
+    if (it == families_.end()) {
+        it = families_.emplace(name, Family{type, help, {}}).first;
+    } else if (it->second.type != type) {
+        // A programming error, still hand out something usable
+        ESP_LOGE(TAG, "Metric %s registered with another type", name.c_str());
+    }
+    for (auto& series : it->second.series) {
+        if (series.labels == labels) {
+            return series;
+        }
+    }
+    it->second.series.push_back(Series{labels, nullptr, nullptr, nullptr});
+    return it->second.series.back();
+}
+
+Counter& Metrics::GetCounter(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& series = Lookup(name, help, labels, kCounter);
+    if (!series.counter) {
+        series.counter = std::make_unique<Counter>();
+    }
+    return *series.counter;
+}
+
+Gauge& Metrics::GetGauge(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& series = Lookup(name, help, labels, kGauge);
+    if (!series.gauge) {
+        series.gauge = std::make_unique<Gauge>();
+    }
+    return *series.gauge;
+}
+
+Gauge& Metrics::GetSampledCounter(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& series = Lookup(name, help, labels, kCounter);
+    if (!series.gauge) {
+        series.gauge = std::make_unique<Gauge>();
+    }
+    return *series.gauge;
+}
+
+Histogram& Metrics::GetHistogram(const std::string& name, const std::string& help,
+                                 const std::vector<double>& bounds, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& series = Lookup(name, help, labels, kHistogram);
+    if (!series.histogram) {
+        series.histogram = std::make_unique<Histogram>(bounds);
+    }
+    return *series.histogram;
+}
+
+void Metrics::AddCollector(std::function<void()> collector) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    collectors_.push_back(std::move(collector));
+}
+
+std::string Metrics::Render() {
+    std::vector<std::function<void()>> collectors;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        collectors = collectors_;
+    }
+    // Collectors update gauges, which takes the lock again
+    for (auto& collector : collectors) {
+        collector();
+    }
+
+    static const char* type_names[] = {"counter", "gauge", "histogram"};
+    std::string out;
+    std::vector<uint64_t> counts;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& [name, family] : families_) {
+        out += "# HELP " + name + " " + family.help + "\n";
+        out += "# TYPE " + name + " " + type_names[family.type] + "\n";
+        for (auto& series : family.series) {
+            if (series.counter) {
+                AppendSeries(out, name, series.labels, (double)series.counter->value());
+            } else if (series.gauge) {
+                AppendSeries(out, name, series.labels, series.gauge->value());
+            } else if (series.histogram) {
+                double sum;
+                series.histogram->Snapshot(counts, sum);
+                auto& bounds = series.histogram->bounds();
+                std::string prefix = series.labels.empty() ? "" : series.labels + ",";
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i <= bounds.size(); i++) {
+                    cumulative += counts[i];
+                    std::string le;
+                    AppendValue(le, i < bounds.size() ? bounds[i] : INFINITY);
+                    AppendSeries(out, name + "_bucket", prefix + "le=\"" + le + "\"", (double)cumulative);
+                }
+                AppendSeries(out, name + "_sum", series.labels, sum);
+                AppendSeries(out, name + "_count", series.labels, (double)cumulative);
+            }
+        }
+    }
+    return out;
+}
+
+void Metrics::CollectProcessStats() {
+    static auto& resident = GetGauge("process_resident_memory_bytes", "Resident memory size in bytes.");
+    static auto& virtual_memory = GetGauge("process_virtual_memory_bytes", "Virtual memory size in bytes.");
+    static auto& cpu = GetSampledCounter("process_cpu_seconds_total", "User and system CPU time spent in seconds.");
+    static auto& threads = GetGauge("process_threads", "Number of OS threads.");
+    static auto& fds = GetGauge("process_open_fds", "Number of open file descriptors (handles on Windows).");
+    static auto& heap_used = GetGauge("xiaozhi_heap_used_bytes", "Bytes handed out by malloc.");
+    static auto& heap_free = GetGauge("xiaozhi_heap_free_bytes", "Bytes held free in the malloc arenas.");
+
+    ProcessStats stats;
+    if (!ReadProcessStats(stats)) {
+        return;
+    }
+    resident.Set((double)stats.resident_bytes);
+    virtual_memory.Set((double)stats.virtual_bytes);
+    cpu.Set(stats.cpu_seconds);
+    threads.Set(stats.threads);
+    fds.Set(stats.open_fds);
+    heap_used.Set((double)stats.heap_used_bytes);
+    heap_free.Set((double)stats.heap_free_bytes);
+}
+
+void Metrics::AddEndpoint(const std::string& path, const std::string& content_type, std::function<std::string()> handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    endpoints_.push_back({path, content_type, std::move(handler)});
+}
+
+bool Metrics::StartServer(const std::string& host, int port) {
+    if (server_) {
+        return true;
+    }
+    server_ = std::make_unique<httplib::Server>();
+    server_->Get("/metrics", [this](const httplib::Request&, httplib::Response& response) {
+        response.set_content(Render(), "text/plain; version=0.0.4");
+    });
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& endpoint : endpoints_) {
+            server_->Get(endpoint.path, [endpoint](const httplib::Request&, httplib::Response& response) {
+                response.set_content(endpoint.handler(), endpoint.content_type.c_str());
+            });
+        }
+    }
+    if (!server_->bind_to_port(host, port)) {
+        ESP_LOGW(TAG, "Failed to bind metrics endpoint to %s:%d", host.c_str(), port);
+        server_.reset();
+        return false;
+    }
+    server_thread_ = std::thread([this]() {
+        Tracer::SetThreadName("metrics_http");
+        server_->listen_after_bind();
+    });
+    ESP_LOGI(TAG, "Serving metrics on http://%s:%d/metrics", host.c_str(), port);
+    return true;
+}
+
+void Metrics::StopServer() {
+    if (!server_) {
+        return;
+    }
+    server_->stop();
+    if (server_thread_.joinable()) {
+        server_thread_.join();
+    }
+    server_.reset();
+}
@@ -0,0 +1,143 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace httplib {
+class Server;
+}
+
+class Counter {
+public:
+    void Increment(uint64_t n = 1) {
+        value_.fetch_add(n, std::memory_order_relaxed);
+    }
+    uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+class Gauge {
+public:
+    void Set(double value) {
+        value_.store(value, std::memory_order_relaxed);
+    }
+    void Add(double delta) {
+        double current = value_.load(std::memory_order_relaxed);
+        while (!value_.compare_exchange_weak(current, current + delta, std::memory_order_relaxed)) {
+        }
+    }
+    double value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<double> value_{0};
+};
+
+// Cumulative buckets as Prometheus expects them, bounds in ascending order
+class Histogram {
+public:
+    explicit Histogram(std::vector<double> bounds);
+
+    void Observe(double value);
+    const std::vector<double>& bounds() const { return bounds_; }
+    // counts gets one entry per bound plus the +Inf bucket, not cumulated
+    void Snapshot(std::vector<uint64_t>& counts, double& sum) const;
+
+    // start, start * factor, ... count bounds in total
+    static std::vector<double> ExponentialBounds(double start, double factor, int count);
+
+private:
+    std::vector<double> bounds_;
+    std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+    std::atomic<double> sum_{0};
+};
+
+/*
+ * Process wide registry. Metrics are created on first lookup and live
+ * until exit, so callers look them up once and keep the reference.
+ * Labels are passed preformatted, e.g. "direction=\"rx\"", series with the
+ * same name share a family and must share the type.
+ */
+class Metrics {
+public:
+    // Never destroyed, threads that outlive main keep references into it
+    static Metrics& GetInstance() {
+        static Metrics* instance = new Metrics();
+        return *instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    Counter& GetCounter(const std::string& name, const std::string& help, const std::string& labels = "");
+    Gauge& GetGauge(const std::string& name, const std::string& help, const std::string& labels = "");
+    // A counter whose total is kept elsewhere, e.g. by the OS, and sampled
+    // by a collector with Set(). Exposed with the counter type.
+    Gauge& GetSampledCounter(const std::string& name, const std::string& help, const std::string& labels = "");
+    Histogram& GetHistogram(const std::string& name, const std::string& help,
+                            const std::vector<double>& bounds, const std::string& labels = "");
+
+    // Run before every scrape, to sample values that are cheaper to read
+    // than to track. Must stay valid until exit.
+    void AddCollector(std::function<void()> collector);
+
+    // Prometheus text exposition format
+    std::string Render();
+
+    // More GET handlers on the same server, added before StartServer
+    void AddEndpoint(const std::string& path, const std::string& content_type, std::function<std::string()> handler);
+
+    // Serves GET /metrics, binding to loopback keeps it off the network
+    bool StartServer(const std::string& host, int port);
+    void StopServer();
+
+private:
+    Metrics();
+
+    enum Type {
+        kCounter,
+        kGauge,
+        kHistogram,
+    };
+
+    struct Series {
+        std::string labels;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+    };
+
+    struct Family {
+        Type type;
+        std::string help;
+        std::vector<Series> series;
+    };
+
+    Series& Lookup(const std::string& name, const std::string& help, const std::string& labels, Type type);
+    void CollectProcessStats();
+
+    std::mutex mutex_;
+    std::map<std::string, Family> families_;
+    std::vector<std::function<void()>> collectors_;
+
+    struct Endpoint {
+        std::string path;
+        std::string content_type;
+        std::function<std::string()> handler;
+    };
+    std::vector<Endpoint> endpoints_;
+
+    std::unique_ptr<httplib::Server> server_;
+    std::thread server_thread_;
+};
+
+#endif // METRICS_H
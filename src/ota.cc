@@ -20,13 +20,13 @@ constexpr const char * CONFIG_OTA_URL = "https://api.tenclass.net/xiaozhi/ota/";
 
 
 Ota::Ota() {
-    {
-        Settings settings("wifi", false);
-        check_version_url_ = settings.GetString("ota_url");
-        if (check_version_url_.empty()) {
-            check_version_url_ = CONFIG_OTA_URL;
-        }
+    check_version_url_ = ota_url_.Get();
+    if (check_version_url_.empty()) {
+        check_version_url_ = CONFIG_OTA_URL;
     }
+    ota_url_.Subscribe([](const std::string& url) {
+        ESP_LOGI(TAG, "OTA url changed to %s, used from the next check", url.c_str());
+    });
 
 #ifdef ESP_EFUSE_BLOCK_USR_DATA
     // Read Serial Number from efuse user_data
@@ -76,6 +76,10 @@ bool Ota::CheckVersion() {
     // current_version_ = app_desc->version;
     // ESP_LOGI(TAG, "Current version: %s", current_version_.c_str());
 
+    check_version_url_ = ota_url_.Get();
+    if (check_version_url_.empty()) {
+        check_version_url_ = CONFIG_OTA_URL;
+    }
     if (check_version_url_.length() < 10) {
         ESP_LOGE(TAG, "Check version URL is not properly set");
         return false;
@@ -7,6 +7,7 @@
 
 #include <esp_err.h>
 #include "board.h"
+#include "settings.h"
 
 class Ota {
 public:
@@ -17,10 +18,12 @@ public:
     bool CheckVersion();
     esp_err_t Activate();
     bool HasMqttConfig() { return has_mqtt_config_; }
+    bool HasWebsocketConfig() { return has_websocket_config_; }
 
     const std::string& GetCheckVersionUrl() const { return check_version_url_; }
 
 private:
+    Setting<std::string> ota_url_{"wifi", "ota_url"};
     std::string check_version_url_;
     std::string activation_message_;
     std::string activation_code_;
@@ -0,0 +1,296 @@
+#include "playback_engine.h"
+#include "audio_codec.h"
+#include "metrics.h"
+#include "trace.h"
+#include "impl/dsp_kernels.h"
+#include <esp_log.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+
+#define TAG "PlaybackEngine"
+
+namespace {
+
+// The device is topped up this often, well inside the device lead
+constexpr int kPacingIntervalMs = 10;
+// Room above the target lead for the last packet of a batch
+constexpr int kRingHeadroomMs = 500;
+
+} // namespace
+
+PlaybackChannel::PlaybackChannel(PlaybackEngine* engine, const Config& config)
+    : engine_(engine), config_(config), duck_gain_(std::pow(10.0f, -std::abs(config.duck_db) / 20.0f)) {
+    ring_.resize((size_t)engine_->sample_rate_ * (config_.target_lead_ms + kRingHeadroomMs) / 1000);
+    underruns_ = &Metrics::GetInstance().GetCounter("xiaozhi_playback_underruns_total",
+        "Times the output device ran dry while a channel was still being refilled.",
+        std::string("channel=\"") + config_.name + "\"");
+}
+
+void PlaybackChannel::OnRefill(std::function<bool(size_t samples)> callback) {
+    on_refill_ = std::move(callback);
+}
+
+void PlaybackChannel::OnPlayed(std::function<void(uint32_t timestamp)> callback) {
+    on_played_ = std::move(callback);
+}
+
+bool PlaybackChannel::Push(const std::vector<int16_t>& pcm, uint32_t timestamp, uint32_t generation) {
+    std::unique_lock<std::mutex> lock(engine_->mutex_);
+    if (generation != generation_) {
+        return false;
+    }
+    size_t buffered = available();
+    if (pcm.size() > ring_.size() - buffered) {
+        static auto& overflows = Metrics::GetInstance().GetCounter("xiaozhi_playback_ring_overflows_total",
+            "Decoded frames dropped because the playback ring was full.");
+        overflows.Increment();
+        return false;
+    }
+
+    size_t offset = write_position_ % ring_.size();
+    size_t first = std::min(pcm.size(), ring_.size() - offset);
+    std::copy(pcm.begin(), pcm.begin() + first, ring_.begin() + offset);
+    std::copy(pcm.begin() + first, pcm.end(), ring_.begin());
+    write_position_ += pcm.size();
+    marks_.push_back({write_position_, timestamp});
+    lock.unlock();
+
+    // Start playing right away rather than on the next tick
+    if (buffered == 0) {
+        engine_->condition_.notify_one();
+    }
+    return true;
+}
+
+void PlaybackChannel::RefillDone() {
+    std::lock_guard<std::mutex> lock(engine_->mutex_);
+    refill_pending_ = false;
+}
+
+size_t PlaybackChannel::Clear() {
+    std::lock_guard<std::mutex> lock(engine_->mutex_);
+    return ClearLocked();
+}
+
+size_t PlaybackChannel::ClearLocked() {
+    generation_++;
+    size_t dropped = available();
+    read_position_ = write_position_;
+    marks_.clear();
+    starving_ = false;
+    return dropped;
+}
+
+void PlaybackChannel::SetGain(float gain) {
+    std::lock_guard<std::mutex> lock(engine_->mutex_);
+    gain_ = gain;
+}
+
+size_t PlaybackChannel::buffered_samples() {
+    std::lock_guard<std::mutex> lock(engine_->mutex_);
+    return available();
+}
+
+size_t PlaybackChannel::free_samples() {
+    std::lock_guard<std::mutex> lock(engine_->mutex_);
+    return ring_.size() - available();
+}
+
+PlaybackEngine::PlaybackEngine(AudioCodec* codec, int sample_rate, const Config& config)
+    : codec_(codec), config_(config), sample_rate_(sample_rate) {
+}
+
+PlaybackEngine::~PlaybackEngine() {
+    Stop();
+}
+
+PlaybackChannel* PlaybackEngine::AddChannel(const PlaybackChannel::Config& config) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    channels_.emplace_back(new PlaybackChannel(this, config));
+    return channels_.back().get();
+}
+
+void PlaybackEngine::Start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        return;
+    }
+    running_ = true;
+    thread_ = std::thread([this]() {
+        PacingLoop();
+    });
+    ESP_LOGI(TAG, "Started at %d Hz, device %d ms, %zu channels", sample_rate_, config_.device_ms, channels_.size());
+    for (auto& channel : channels_) {
+        ESP_LOGI(TAG, "Channel %s, low watermark %d ms, target lead %d ms, priority %d, ducking %d dB",
+            channel->config_.name, channel->config_.low_watermark_ms, channel->config_.target_lead_ms,
+            channel->config_.priority, channel->config_.duck_db);
+    }
+}
+
+void PlaybackEngine::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    condition_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+size_t PlaybackEngine::MsToSamples(int ms) const {
+    return (size_t)sample_rate_ * ms / 1000;
+}
+
+size_t PlaybackEngine::Flush(int fade_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t dropped = 0;
+    for (auto& channel : channels_) {
+        dropped += channel->ClearLocked();
+    }
+    return dropped + codec_->FlushOutput(fade_ms);
+}
+
+size_t PlaybackEngine::buffered_samples() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t buffered = codec_->GetOutputQueuedSamples();
+    for (auto& channel : channels_) {
+        buffered += channel->available();
+    }
+    return buffered;
+}
+
+void PlaybackEngine::PacingLoop() {
+    Tracer::SetThreadName("playback");
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        condition_.wait_for(lock, std::chrono::milliseconds(kPacingIntervalMs));
+        if (!running_) {
+            break;
+        }
+        lock.unlock();
+        Feed();
+        lock.lock();
+    }
+}
+
+size_t PlaybackEngine::ReadChannel(PlaybackChannel& channel, size_t count, std::vector<uint32_t>& played) {
+    count = std::min(count, channel.available());
+    size_t offset = channel.read_position_ % channel.ring_.size();
+    size_t first = std::min(count, channel.ring_.size() - offset);
+    scratch_.assign(channel.ring_.begin() + offset, channel.ring_.begin() + offset + first);
+    scratch_.insert(scratch_.end(), channel.ring_.begin(), channel.ring_.begin() + (count - first));
+    channel.read_position_ += count;
+
+    while (!channel.marks_.empty() && channel.marks_.front().end <= channel.read_position_) {
+        played.push_back(channel.marks_.front().timestamp);
+        channel.marks_.pop_front();
+    }
+    return count;
+}
+
+void PlaybackEngine::Feed() {
+    static auto& buffered = Metrics::GetInstance().GetGauge("xiaozhi_playback_buffered_seconds",
+        "Decoded audio waiting in the playback channels and the device queue.");
+
+    std::vector<std::pair<PlaybackChannel*, std::vector<uint32_t>>> played;
+    std::vector<std::pair<PlaybackChannel*, size_t>> refills;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t queued = codec_->GetOutputQueuedSamples();
+        size_t device_target = MsToSamples(config_.device_ms);
+
+        for (auto& channel : channels_) {
+            size_t available = channel->available();
+            if (queued == 0 && available == 0) {
+                if (channel->refill_pending_ && !channel->starving_) {
+                    channel->underruns_->Increment();
+                }
+                channel->starving_ = channel->refill_pending_;
+            } else {
+                channel->starving_ = false;
+            }
+        }
+
+        // A round mixes only as much as every channel with audio holds, so
+        // none is padded with silence. A channel that ran out goes on
+        // without the others only once it is done; while its next batch is
+        // being decoded they wait for it, unless the device has run dry.
+        while (codec_->output_enabled() && queued < device_target) {
+            size_t count = device_target - queued;
+            bool any = false;
+            for (auto& channel : channels_) {
+                if (channel->available() > 0) {
+                    count = std::min(count, channel->available());
+                    any = true;
+                } else if (channel->refill_pending_ && !channel->starving_) {
+                    count = 0;
+                }
+            }
+            if (!any || count == 0) {
+                break;
+            }
+            TRACE_SCOPE("PlaybackEngine::Feed");
+            auto& dsp = GetDspKernels();
+            mix_.assign(count, 0);
+
+            // Ducking is decided on who has audio before any of it is read
+            std::vector<float> targets(channels_.size());
+            for (size_t i = 0; i < channels_.size(); i++) {
+                auto& channel = *channels_[i];
+                float target = channel.gain_;
+                for (auto& other : channels_) {
+                    if (other->config_.priority > channel.config_.priority && other->available() > 0) {
+                        target *= other->duck_gain_;
+                    }
+                }
+                targets[i] = target;
+            }
+
+            for (size_t i = 0; i < channels_.size(); i++) {
+                auto& channel = *channels_[i];
+                if (channel.available() == 0) {
+                    continue;
+                }
+                played.emplace_back(&channel, std::vector<uint32_t>());
+                size_t read = ReadChannel(channel, count, played.back().second);
+                // Gain changes ramp across the chunk instead of stepping
+                if (channel.current_gain_ != 1.0f || targets[i] != 1.0f) {
+                    dsp.gain_ramp(scratch_.data(), read, channel.current_gain_, targets[i]);
+                }
+                channel.current_gain_ = targets[i];
+                dsp.mix(mix_.data(), scratch_.data(), read, 1.0f);
+            }
+            queued += count;
+            codec_->OutputData(mix_);
+        }
+
+        size_t total = queued;
+        for (auto& channel : channels_) {
+            size_t available = channel->available();
+            total += available;
+            if (!channel->refill_pending_ && available < MsToSamples(channel->config_.low_watermark_ms)) {
+                refills.emplace_back(channel.get(), MsToSamples(channel->config_.target_lead_ms) - available);
+                channel->refill_pending_ = true;
+            }
+        }
+        buffered.Set((double)total / sample_rate_);
+    }
+
+    for (auto& [channel, timestamps] : played) {
+        if (channel->on_played_) {
+            for (auto timestamp : timestamps) {
+                channel->on_played_(timestamp);
+            }
+        }
+    }
+
+    for (auto& [channel, wanted] : refills) {
+        if (!(channel->on_refill_ && channel->on_refill_(wanted))) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            channel->refill_pending_ = false;
+        }
+    }
+}
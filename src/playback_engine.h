@@ -0,0 +1,150 @@
+#ifndef PLAYBACK_ENGINE_H
+#define PLAYBACK_ENGINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class AudioCodec;
+class Counter;
+class PlaybackEngine;
+
+// One source of the mix, e.g. the reply or the prompt sounds, with its own
+// ring of PCM at the engine's rate. The ring is refilled on demand: when
+// it drops below the low watermark the owner is asked for a batch, up to
+// the target lead.
+class PlaybackChannel {
+public:
+    struct Config {
+        // Short and stable, used as a metrics label
+        const char* name = "";
+        // Refilling starts when the ring holds less than this
+        int low_watermark_ms = 80;
+        // and stops once the ring holds this much
+        int target_lead_ms = 200;
+        // While this channel has audio, channels of a lower priority are
+        // lowered by duck_db
+        int priority = 0;
+        int duck_db = 0;
+    };
+
+    // Called on the pacing thread with the number of samples wanted. Returns
+    // false when there is nothing to add, otherwise the batch Push()es its
+    // PCM and ends with RefillDone(), from any thread. A callback may also
+    // Push() right away and return false.
+    void OnRefill(std::function<bool(size_t samples)> callback);
+    // Called on the pacing thread once the last sample of a pushed packet
+    // has been handed to the device
+    void OnPlayed(std::function<void(uint32_t timestamp)> callback);
+
+    // PCM pushed for an older generation is dropped, see Clear()
+    bool Push(const std::vector<int16_t>& pcm, uint32_t timestamp, uint32_t generation);
+    void RefillDone();
+    // Drops the ring and starts a new generation, what was already mixed
+    // into the device queue still plays. Returns the samples dropped.
+    size_t Clear();
+
+    // Linear, on top of any ducking
+    void SetGain(float gain);
+
+    const char* name() const { return config_.name; }
+    uint32_t generation() const { return generation_.load(); }
+    size_t buffered_samples();
+    // Room left in the ring
+    size_t free_samples();
+
+private:
+    struct Mark {
+        uint64_t end;
+        uint32_t timestamp;
+    };
+
+    PlaybackChannel(PlaybackEngine* engine, const Config& config);
+
+    PlaybackEngine* engine_;
+    Config config_;
+    float duck_gain_;
+    Counter* underruns_;
+    std::atomic<uint32_t> generation_ = 0;
+
+    // Under the engine's mutex
+    std::vector<int16_t> ring_;
+    uint64_t read_position_ = 0;
+    uint64_t write_position_ = 0;
+    std::deque<Mark> marks_;
+    float gain_ = 1.0f;
+    // The gain the last mixed sample had, ramps start from here
+    float current_gain_ = 1.0f;
+    bool refill_pending_ = false;
+    bool starving_ = false;
+
+    std::function<bool(size_t)> on_refill_;
+    std::function<void(uint32_t)> on_played_;
+
+    size_t available() const { return write_position_ - read_position_; }
+    size_t ClearLocked();
+
+    friend class PlaybackEngine;
+};
+
+// Mixes the playback channels into the output device. A pacing thread tops
+// the device queue up every few milliseconds, so playback no longer
+// depends on when the audio loop or the background task get to run. Each
+// round reads the channels that have audio, applies their gain and
+// ducking, and adds them up with saturation into one buffer for the codec.
+class PlaybackEngine {
+public:
+    struct Config {
+        // What the feeder keeps queued in the device stream
+        int device_ms = 40;
+    };
+
+    // Every channel runs at sample_rate, the device's output rate
+    PlaybackEngine(AudioCodec* codec, int sample_rate, const Config& config);
+    ~PlaybackEngine();
+
+    // Added before Start(), owned by the engine
+    PlaybackChannel* AddChannel(const PlaybackChannel::Config& config);
+
+    void Start();
+    void Stop();
+
+    // Clears every channel and drops the device queue, faded out over
+    // fade_ms. Returns the number of samples dropped.
+    size_t Flush(int fade_ms);
+
+    // Every channel and the device queue
+    size_t buffered_samples();
+    int sample_rate() const { return sample_rate_; }
+
+private:
+    AudioCodec* codec_;
+    Config config_;
+    const int sample_rate_;
+
+    // Guards the channels' rings, and is held across handing samples to the
+    // codec so a flush never races with a write
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::vector<std::unique_ptr<PlaybackChannel>> channels_;
+    std::vector<int16_t> mix_;
+    std::vector<int16_t> scratch_;
+    bool running_ = false;
+    std::thread thread_;
+
+    size_t MsToSamples(int ms) const;
+    void PacingLoop();
+    void Feed();
+    // Moves count samples of the channel's ring into scratch_
+    size_t ReadChannel(PlaybackChannel& channel, size_t count, std::vector<uint32_t>& played);
+
+    friend class PlaybackChannel;
+};
+
+#endif // PLAYBACK_ENGINE_H
@@ -0,0 +1,491 @@
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "trace.h"
+#include <stdarg.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Every thread formats its lines into a ring of its own, so logging from
+ * the audio and network paths costs a vsnprintf and a copy, never a lock
+ * or a write to the console. A log thread drains all rings a few times
+ * per second, merges them roughly in time order and writes each batch
+ * with a single fwrite. Warnings and errors wake it up at once.
+ */
+
+namespace {
+
+constexpr size_t kRingSize = 64 * 1024;
+// Longer messages are truncated
+constexpr size_t kMaxMessage = 1024;
+constexpr auto kFlushInterval = std::chrono::milliseconds(50);
+constexpr uint32_t kDefaultRateLimit = 100;
+constexpr int64_t kRateWindowUs = 1000000;
+
+struct RecordHeader {
+  int64_t time_us;
+  uint16_t tag_length;
+  uint16_t message_length;
+  uint8_t level;
+};
+
+// Single producer (the owning thread), single consumer (the log thread)
+struct ThreadRing {
+  uint32_t id = 0;
+  std::atomic<uint64_t> head = 0;
+  std::atomic<uint64_t> tail = 0;
+  std::atomic<uint32_t> dropped = 0;
+  std::atomic<bool> orphaned = false;
+  char data[kRingSize];
+
+  bool Push(const RecordHeader& header, const char* tag, const char* message) {
+    size_t size = sizeof(header) + header.tag_length + header.message_length;
+    uint64_t write = head.load(std::memory_order_relaxed);
+    if (kRingSize - (write - tail.load(std::memory_order_acquire)) < size) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    write = Copy(write, &header, sizeof(header));
+    write = Copy(write, tag, header.tag_length);
+    write = Copy(write, message, header.message_length);
+    head.store(write, std::memory_order_release);
+    return true;
+  }
+
+  size_t Used() const {
+    return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed);
+  }
+
+  uint64_t Copy(uint64_t position, const void* source, size_t size) {
+    size_t offset = position % kRingSize;
+    size_t first = std::min(size, kRingSize - offset);
+    memcpy(data + offset, source, first);
+    memcpy(data, (const char*)source + first, size - first);
+    return position + size;
+  }
+
+  uint64_t Read(uint64_t position, void* target, size_t size) const {
+    size_t offset = position % kRingSize;
+    size_t first = std::min(size, kRingSize - offset);
+    memcpy(target, data + offset, first);
+    memcpy((char*)target + first, data, size - first);
+    return position + size;
+  }
+};
+
+struct TagState {
+  std::atomic<int> level;
+  std::atomic<uint32_t> rate_limit;
+  std::atomic<int64_t> window_start = 0;
+  std::atomic<uint32_t> window_count = 0;
+  std::atomic<uint32_t> suppressed = 0;
+};
+
+struct Entry {
+  RecordHeader header;
+  uint32_t thread;
+  std::string tag;
+  std::string message;
+};
+
+struct Logger {
+  std::mutex tags_mutex;
+  std::unordered_map<std::string, std::unique_ptr<TagState>> tags;
+  int default_level = ESP_LOG_INFO;
+  uint32_t default_rate_limit = kDefaultRateLimit;
+
+  std::mutex rings_mutex;
+  std::vector<std::shared_ptr<ThreadRing>> rings;
+  uint32_t next_thread_id = 1;
+
+  // Held while draining, so only one thread writes out at a time
+  std::mutex flush_mutex;
+  std::vector<Entry> entries;
+  std::string output;
+
+  std::mutex wake_mutex;
+  std::condition_variable condition;
+  std::atomic<bool> wake = false;
+
+  std::atomic<esp_log_port_format_t> format = ESP_LOG_FORMAT_TEXT;
+  int64_t wall_clock_offset_us = 0;
+  std::once_flag started;
+};
+
+Logger& logger() {
+  // Never destroyed, threads may still log while statics go away
+  static Logger* instance = new Logger();
+  return *instance;
+}
+
+enum RingState : uint8_t {
+  kRingNone,
+  kRingActive,
+  kRingGone,
+};
+
+thread_local ThreadRing* t_ring = nullptr;
+thread_local RingState t_ring_state = kRingNone;
+// Tags are string literals, so the pointer is a good enough key
+thread_local std::unordered_map<const char*, TagState*> t_tag_cache;
+
+// Lets the log thread drop the ring once the thread is gone and it is empty
+struct RingOwner {
+  ~RingOwner() {
+    if (t_ring) {
+      t_ring->orphaned = true;
+    }
+    t_ring = nullptr;
+    t_ring_state = kRingGone;
+  }
+};
+
+char LevelLetter(int level) {
+  static const char letters[] = "NEWIDV";
+  return level >= 0 && level <= ESP_LOG_VERBOSE ? letters[level] : '?';
+}
+
+const char* LevelName(int level) {
+  static const char* names[] = {"none", "error", "warn", "info", "debug", "verbose"};
+  return level >= 0 && level <= ESP_LOG_VERBOSE ? names[level] : "unknown";
+}
+
+void AppendJsonString(std::string& out, const std::string& value) {
+  out += '"';
+  for (unsigned char c : value) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (c < 0x20) {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          out += escaped;
+        } else {
+          out += (char)c;
+        }
+    }
+  }
+  out += '"';
+}
+
+void FormatEntry(Logger& log, const Entry& entry, std::string& out) {
+  char prefix[96];
+  if (log.format.load(std::memory_order_relaxed) == ESP_LOG_FORMAT_JSON) {
+    snprintf(prefix, sizeof(prefix), "{\"ts\":%lld,\"level\":\"%s\",\"thread\":%u,\"tag\":",
+             (long long)(log.wall_clock_offset_us + entry.header.time_us), LevelName(entry.header.level), entry.thread);
+    out += prefix;
+    AppendJsonString(out, entry.tag);
+    out += ",\"msg\":";
+    AppendJsonString(out, entry.message);
+    out += "}\n";
+  } else {
+    long long ms = entry.header.time_us / 1000;
+    snprintf(prefix, sizeof(prefix), "%c (%lld.%03lld) [t%u] ",
+             LevelLetter(entry.header.level), ms / 1000, ms % 1000, entry.thread);
+    out += prefix;
+    out += entry.tag;
+    out += ": ";
+    out += entry.message;
+    out += '\n';
+  }
+}
+
+void Flush() {
+  auto& log = logger();
+  std::lock_guard<std::mutex> flush_lock(log.flush_mutex);
+
+  std::vector<std::shared_ptr<ThreadRing>> rings;
+  {
+    std::lock_guard<std::mutex> lock(log.rings_mutex);
+    rings = log.rings;
+  }
+
+  auto& entries = log.entries;
+  entries.clear();
+  for (auto& ring : rings) {
+    uint64_t read = ring->tail.load(std::memory_order_relaxed);
+    uint64_t end = ring->head.load(std::memory_order_acquire);
+    while (read < end) {
+      Entry entry;
+      entry.thread = ring->id;
+      read = ring->Read(read, &entry.header, sizeof(entry.header));
+      entry.tag.resize(entry.header.tag_length);
+      read = ring->Read(read, entry.tag.data(), entry.tag.size());
+      entry.message.resize(entry.header.message_length);
+      read = ring->Read(read, entry.message.data(), entry.message.size());
+      entries.push_back(std::move(entry));
+    }
+    ring->tail.store(read, std::memory_order_release);
+
+    uint32_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+      Entry entry;
+      entry.header = {esp_timer_get_time(), 0, 0, ESP_LOG_WARN};
+      entry.thread = ring->id;
+      entry.tag = "log";
+      entry.message = std::to_string(dropped) + " lines dropped, log buffer full";
+      entries.push_back(std::move(entry));
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(log.rings_mutex);
+    log.rings.erase(std::remove_if(log.rings.begin(), log.rings.end(), [](const std::shared_ptr<ThreadRing>& ring) {
+      return ring->orphaned && ring->Used() == 0;
+    }), log.rings.end());
+  }
+
+  if (entries.empty()) {
+    return;
+  }
+  std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+    return a.header.time_us < b.header.time_us;
+  });
+
+  auto& output = log.output;
+  output.clear();
+  for (auto& entry : entries) {
+    FormatEntry(log, entry, output);
+  }
+  fwrite(output.data(), 1, output.size(), stdout);
+  fflush(stdout);
+}
+
+void LogThread() {
+  Tracer::SetThreadName("esp_log");
+  auto& log = logger();
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(log.wake_mutex);
+      log.condition.wait_for(lock, kFlushInterval, [&log] {
+        return log.wake.load(std::memory_order_relaxed);
+      });
+      log.wake = false;
+    }
+    Flush();
+  }
+}
+
+void Start() {
+  auto& log = logger();
+  auto wall = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  log.wall_clock_offset_us = wall - esp_timer_get_time();
+  std::thread(LogThread).detach();
+  atexit(esp_log_port_flush);
+}
+
+void Wake() {
+  auto& log = logger();
+  // No lock taken here: a missed notification only costs one interval
+  if (!log.wake.exchange(true, std::memory_order_relaxed)) {
+    log.condition.notify_one();
+  }
+}
+
+ThreadRing* LocalRing() {
+  if (t_ring_state == kRingNone) {
+    static thread_local RingOwner owner;
+    auto ring = std::make_shared<ThreadRing>();
+    auto& log = logger();
+    {
+      std::lock_guard<std::mutex> lock(log.rings_mutex);
+      ring->id = log.next_thread_id++;
+      log.rings.push_back(ring);
+    }
+    t_ring = ring.get();
+    t_ring_state = kRingActive;
+  }
+  return t_ring;
+}
+
+TagState* LookupTag(const char* tag) {
+  auto it = t_tag_cache.find(tag);
+  if (it != t_tag_cache.end()) {
+    return it->second;
+  }
+
+  auto& log = logger();
+  std::lock_guard<std::mutex> lock(log.tags_mutex);
+  auto& state = log.tags[tag];
+  if (!state) {
+    state = std::make_unique<TagState>();
+    state->level = log.default_level;
+    state->rate_limit = log.default_rate_limit;
+  }
+  t_tag_cache[tag] = state.get();
+  return state.get();
+}
+
+void Enqueue(int level, const char* tag, int64_t time_us, const char* message, size_t length) {
+  RecordHeader header;
+  header.time_us = time_us;
+  header.tag_length = (uint16_t)std::min<size_t>(strlen(tag), 255);
+  header.message_length = (uint16_t)length;
+  header.level = (uint8_t)level;
+
+  auto ring = LocalRing();
+  if (ring == nullptr) {
+    // Thread is shutting down, write through
+    auto& log = logger();
+    Entry entry{header, 0, std::string(tag, header.tag_length), std::string(message, length)};
+    std::lock_guard<std::mutex> lock(log.flush_mutex);
+    std::string output;
+    FormatEntry(log, entry, output);
+    fwrite(output.data(), 1, output.size(), stdout);
+    return;
+  }
+
+  ring->Push(header, tag, message);
+  if (level <= ESP_LOG_WARN || ring->Used() > kRingSize / 2) {
+    Wake();
+  }
+}
+
+// Fixed one second windows, the first line of a new window reports what
+// the previous ones suppressed
+bool Admit(TagState& state, const char* tag, int64_t now) {
+  uint32_t limit = state.rate_limit.load(std::memory_order_relaxed);
+  if (limit == 0) {
+    return true;
+  }
+
+  int64_t start = state.window_start.load(std::memory_order_relaxed);
+  if (now - start >= kRateWindowUs && state.window_start.compare_exchange_strong(start, now)) {
+    state.window_count.store(0, std::memory_order_relaxed);
+    uint32_t suppressed = state.suppressed.exchange(0, std::memory_order_relaxed);
+    if (suppressed > 0) {
+      char message[64];
+      int length = snprintf(message, sizeof(message), "%u lines suppressed by the rate limit", suppressed);
+      Enqueue(ESP_LOG_WARN, tag, now, message, length);
+    }
+  }
+
+  if (state.window_count.fetch_add(1, std::memory_order_relaxed) < limit) {
+    return true;
+  }
+  state.suppressed.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+int ParseLevel(const std::string& name) {
+  if (name.empty()) {
+    return -1;
+  }
+  switch (toupper((unsigned char)name[0])) {
+    case 'N': return ESP_LOG_NONE;
+    case 'E': return ESP_LOG_ERROR;
+    case 'W': return ESP_LOG_WARN;
+    case 'I': return ESP_LOG_INFO;
+    case 'D': return ESP_LOG_DEBUG;
+    case 'V': return ESP_LOG_VERBOSE;
+    default: return -1;
+  }
+}
+
+} // namespace
+
+extern "C" void esp_log_level_set(const char* tag, esp_log_level_t level) {
+  auto& log = logger();
+  std::lock_guard<std::mutex> lock(log.tags_mutex);
+  if (strcmp(tag, "*") == 0) {
+    log.default_level = level;
+    for (auto& it : log.tags) {
+      it.second->level = level;
+    }
+    return;
+  }
+  auto& state = log.tags[tag];
+  if (!state) {
+    state = std::make_unique<TagState>();
+    state->rate_limit = log.default_rate_limit;
+  }
+  state->level = level;
+}
+
+extern "C" esp_log_level_t esp_log_level_get(const char* tag) {
+  return (esp_log_level_t)LookupTag(tag)->level.load(std::memory_order_relaxed);
+}
+
+extern "C" void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...) {
+  auto state = LookupTag(tag);
+  if (level > state->level.load(std::memory_order_relaxed)) {
+    return;
+  }
+  std::call_once(logger().started, Start);
+
+  int64_t now = esp_timer_get_time();
+  if (!Admit(*state, tag, now)) {
+    return;
+  }
+
+  char message[kMaxMessage];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  if (length < 0) {
+    return;
+  }
+  Enqueue(level, tag, now, message, std::min<size_t>(length, sizeof(message) - 1));
+}
+
+extern "C" void esp_log_port_set_format(esp_log_port_format_t format) {
+  logger().format = format;
+}
+
+extern "C" void esp_log_port_set_rate_limit(const char* tag, uint32_t per_second) {
+  auto& log = logger();
+  std::lock_guard<std::mutex> lock(log.tags_mutex);
+  if (strcmp(tag, "*") == 0) {
+    log.default_rate_limit = per_second;
+    for (auto& it : log.tags) {
+      it.second->rate_limit = per_second;
+    }
+    return;
+  }
+  auto& state = log.tags[tag];
+  if (!state) {
+    state = std::make_unique<TagState>();
+    state->level = log.default_level;
+  }
+  state->rate_limit = per_second;
+}
+
+extern "C" void esp_log_port_set_levels(const char* spec) {
+  std::string list = spec ? spec : "";
+  size_t begin = 0;
+  while (begin < list.size()) {
+    size_t end = list.find(',', begin);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    std::string item = list.substr(begin, end - begin);
+    begin = end + 1;
+
+    size_t colon = item.rfind(':');
+    std::string tag = colon == std::string::npos ? "*" : item.substr(0, colon);
+    int level = ParseLevel(colon == std::string::npos ? item : item.substr(colon + 1));
+    if (tag.empty() || level < 0) {
+      continue;
+    }
+    esp_log_level_set(tag.c_str(), (esp_log_level_t)level);
+  }
+}
+
+extern "C" void esp_log_port_flush(void) {
+  Flush();
+}
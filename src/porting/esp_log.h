@@ -1,8 +1,66 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
 
-#define ESP_LOGI(TAG, fmt, ...) (printf("I[" TAG "] " fmt "\n", ##__VA_ARGS__))
-#define ESP_LOGW(TAG, fmt, ...) (printf("W[" TAG "] " fmt "\n", ##__VA_ARGS__))
-#define ESP_LOGE(TAG, fmt, ...) (printf("E[" TAG "] " fmt "\n", ##__VA_ARGS__))
+typedef enum {
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+// Levels above this are compiled out, define it before the include (or
+// per target) to keep debug logs in a build
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ESP_LOG_PRINTF_ATTR(fmt, args) __attribute__((format(printf, fmt, args)))
+#else
+#define ESP_LOG_PRINTF_ATTR(fmt, args)
+#endif
+
+// "*" sets the level of every tag, including the ones not seen yet
+void esp_log_level_set(const char* tag, esp_log_level_t level);
+esp_log_level_t esp_log_level_get(const char* tag);
+
+// Formats on the calling thread, then queues the line for the log thread
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...) ESP_LOG_PRINTF_ATTR(3, 4);
+
+// Emulator extensions
+typedef enum {
+  ESP_LOG_FORMAT_TEXT,  // I (12.345678) [t3] TAG: message
+  ESP_LOG_FORMAT_JSON,  // one object per line, wall clock time in microseconds
+} esp_log_port_format_t;
+
+void esp_log_port_set_format(esp_log_port_format_t format);
+// Lines beyond per_second in a second are counted and dropped, 0 disables
+void esp_log_port_set_rate_limit(const char* tag, uint32_t per_second);
+// Applies a list such as "*:I,MQTT:D,Application:W"
+void esp_log_port_set_levels(const char* spec);
+// Writes out everything queued so far, also done at exit
+void esp_log_port_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ESP_LOG_LEVEL_LOCAL(level, tag, fmt, ...) do { \
+    if (LOG_LOCAL_LEVEL >= level) { \
+      esp_log_write(level, tag, fmt, ##__VA_ARGS__); \
+    } \
+  } while (0)
+
+#define ESP_LOGE(TAG, fmt, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_ERROR, TAG, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(TAG, fmt, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_WARN, TAG, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(TAG, fmt, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_INFO, TAG, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(TAG, fmt, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_DEBUG, TAG, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(TAG, fmt, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_VERBOSE, TAG, fmt, ##__VA_ARGS__)
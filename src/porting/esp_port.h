@@ -13,6 +13,7 @@ extern "C" {
 #define ESP_ERR_NVS_NOT_FOUND -3
 #define ESP_ERR_NVS_NO_FREE_PAGES -4
 #define ESP_ERR_NVS_NEW_VERSION_FOUND -5
+#define ESP_ERR_INVALID_STATE -6
 
 #define ESP_ERROR_CHECK(expr) expr
 
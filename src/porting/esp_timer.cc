@@ -0,0 +1,82 @@
+#include "esp_timer.h"
+#include "impl/reactor.h"
+#include <string>
+
+struct esp_timer {
+  Reactor::Timer timer;
+  std::string name;
+};
+
+extern "C" esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer_handle_t* out_handle) {
+  if (create_args == nullptr || create_args->callback == nullptr || out_handle == nullptr) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  auto handle = new esp_timer();
+  handle->name = create_args->name ? create_args->name : "";
+  handle->timer.callback = [cb = create_args->callback, arg = create_args->arg]() {
+    cb(arg);
+  };
+  *out_handle = handle;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+  if (timer == nullptr) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (esp_timer_is_active(timer)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  Reactor::GetInstance().StartTimer(&timer->timer, (int64_t)timeout_us, 0);
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+  if (timer == nullptr || period == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (esp_timer_is_active(timer)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  Reactor::GetInstance().StartTimer(&timer->timer, (int64_t)period, (int64_t)period);
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_timer_restart(esp_timer_handle_t timer, uint64_t timeout_us) {
+  if (timer == nullptr) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  int64_t period = timer->timer.period_us > 0 ? (int64_t)timeout_us : 0;
+  Reactor::GetInstance().StartTimer(&timer->timer, (int64_t)timeout_us, period);
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  if (timer == nullptr) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!esp_timer_is_active(timer)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  Reactor::GetInstance().StopTimer(&timer->timer);
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+  if (timer == nullptr) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  Reactor::GetInstance().DeleteTimer(&timer->timer);
+  delete timer;
+  return ESP_OK;
+}
+
+extern "C" bool esp_timer_is_active(esp_timer_handle_t timer) {
+  return timer != nullptr && Reactor::GetInstance().IsTimerArmed(&timer->timer);
+}
+
+extern "C" int64_t esp_timer_get_time(void) {
+  static const int64_t start = Reactor::Now();
+  return Reactor::Now() - start;
+}
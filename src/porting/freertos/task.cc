@@ -1,5 +1,7 @@
 #include "task.h"
+#include "trace.h"
 #include <thread>
+#include <string>
 
 BaseType_t xTaskCreate( TaskFunction_t pxTaskCode,
                             const char * const pcName,
@@ -7,7 +9,11 @@ BaseType_t xTaskCreate( TaskFunction_t pxTaskCode,
                             void * const pvParameters,
                             UBaseType_t uxPriority,
                             TaskHandle_t * const pxCreatedTask ) {
-  std::thread t(pxTaskCode, pvParameters);
+  std::string name = pcName ? pcName : "";
+  std::thread t([pxTaskCode, pvParameters, name]() {
+    Tracer::SetThreadName(name.c_str());
+    pxTaskCode(pvParameters);
+  });
   t.detach();
   if (pxCreatedTask)
     *pxCreatedTask = reinterpret_cast<TaskHandle_t>(t.native_handle());
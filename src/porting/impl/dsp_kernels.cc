@@ -0,0 +1,178 @@
+#include "dsp_kernels.h"
+#include "dsp_kernels_internal.h"
+#include <esp_log.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define DSP_CPUID_MSVC 1
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#define DSP_CPUID_GCC 1
+#endif
+
+#define TAG "DspKernels"
+
+namespace {
+
+void Gain(int16_t* samples, size_t count, float gain) {
+  for (size_t i = 0; i < count; i++) {
+    samples[i] = dsp::Saturate(samples[i] * gain);
+  }
+}
+
+void GainRamp(int16_t* samples, size_t count, float start, float end) {
+  if (count == 0) {
+    return;
+  }
+  float step = dsp::RampStep(count, start, end);
+  for (size_t i = 0; i < count; i++) {
+    samples[i] = dsp::Saturate(samples[i] * (start + step * (float)i));
+  }
+}
+
+void GainCurve(int16_t* samples, const float* gains, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    samples[i] = dsp::Saturate(samples[i] * gains[i]);
+  }
+}
+
+void Mix(int16_t* dest, const int16_t* source, size_t count, float gain) {
+  for (size_t i = 0; i < count; i++) {
+    dest[i] = dsp::Saturate(dest[i] + source[i] * gain);
+  }
+}
+
+void ToFloat(const int16_t* samples, float* dest, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    dest[i] = samples[i];
+  }
+}
+
+void FromFloat(const float* samples, int16_t* dest, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    dest[i] = dsp::Saturate(samples[i]);
+  }
+}
+
+int Peak(const int16_t* samples, size_t count) {
+  int peak = 0;
+  for (size_t i = 0; i < count; i++) {
+    peak = std::max(peak, std::abs((int)samples[i]));
+  }
+  return peak;
+}
+
+uint64_t SumOfSquares(const int16_t* samples, size_t count) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < count; i++) {
+    sum += (uint32_t)((int32_t)samples[i] * samples[i]);
+  }
+  return sum;
+}
+
+void DownmixStereo(const int16_t* stereo, int16_t* mono, size_t frames) {
+  for (size_t i = 0; i < frames; i++) {
+    mono[i] = (int16_t)((stereo[2 * i] + stereo[2 * i + 1]) >> 1);
+  }
+}
+
+const DspKernels kScalar = {
+  "scalar", Gain, GainRamp, GainCurve, Mix, ToFloat, FromFloat, Peak, SumOfSquares, DownmixStereo,
+};
+
+// AVX2 needs the OS to save the upper halves of the registers too
+bool CpuHasAvx2() {
+#if DSP_CPUID_MSVC
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+  __cpuid(info, 1);
+  if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)) || (_xgetbv(0) & 6) != 6) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#elif DSP_CPUID_GCC
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid_max(0, nullptr) < 7 || !__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) {
+    return false;
+  }
+  unsigned int xcr0_low, xcr0_high;
+  __asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+  if ((xcr0_low & 6) != 6) {
+    return false;
+  }
+  __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+  return (ebx & bit_AVX2) != 0;
+#else
+  return false;
+#endif
+}
+
+// A quick look at one buffer, long enough for the vector loops and a tail;
+// the full comparison is in tests/dsp_kernels_test.cc
+bool LooksSane(const DspKernels& kernels) {
+  constexpr size_t kCount = 37;
+  int16_t input[kCount], a[kCount], b[kCount];
+  for (size_t i = 0; i < kCount; i++) {
+    input[i] = (int16_t)((int)i * 1787 - 32768);
+  }
+  memcpy(a, input, sizeof(a));
+  memcpy(b, input, sizeof(b));
+  kScalar.mix(a, input, kCount, 0.7f);
+  kernels.mix(b, input, kCount, 0.7f);
+  kScalar.gain_ramp(a, kCount, 1.2f, 0.3f);
+  kernels.gain_ramp(b, kCount, 1.2f, 0.3f);
+  return memcmp(a, b, sizeof(a)) == 0 && kScalar.peak(input, kCount) == kernels.peak(input, kCount) &&
+      kScalar.sum_of_squares(input, kCount) == kernels.sum_of_squares(input, kCount);
+}
+
+const DspKernels& SelectKernels() {
+  const DspKernels* available[3];
+  size_t count = GetAvailableDspKernels(available, 3);
+  // Best first, the scalar one is the reference
+  for (size_t i = count; i-- > 1;) {
+    if (LooksSane(*available[i])) {
+      ESP_LOGI(TAG, "Using the %s kernels", available[i]->name);
+      return *available[i];
+    }
+    ESP_LOGE(TAG, "The %s kernels disagree with the scalar ones, not used", available[i]->name);
+  }
+  ESP_LOGI(TAG, "Using the scalar kernels");
+  return kScalar;
+}
+
+} // namespace
+
+const DspKernels* GetScalarDspKernels() {
+  return &kScalar;
+}
+
+size_t GetAvailableDspKernels(const DspKernels** kernels, size_t max) {
+  size_t count = 0;
+  auto add = [&](const DspKernels* version) {
+    if (version && count < max) {
+      kernels[count++] = version;
+    }
+  };
+  add(GetScalarDspKernels());
+  add(GetSse2DspKernels());
+  static bool has_avx2 = CpuHasAvx2();
+  if (has_avx2) {
+    add(GetAvx2DspKernels());
+  }
+  return count;
+}
+
+const DspKernels& GetDspKernels() {
+  static const DspKernels& kernels = SelectKernels();
+  return kernels;
+}
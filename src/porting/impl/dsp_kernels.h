@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// The int16 primitives of the audio path, in a scalar version and in SSE2
+// and AVX2 versions for x86. The best one the CPU and OS support is picked
+// at the first call of GetDspKernels(), after a quick comparison with the
+// scalar one; a version that disagrees is never used. tests/dsp_kernels_test
+// compares every version in full and times them.
+//
+// int16 is converted to float without scaling, so 32767 stays 32767.0f.
+// Conversions back round to nearest and saturate.
+struct DspKernels {
+  const char* name;
+
+  void (*gain)(int16_t* samples, size_t count, float gain);
+  // Gain moving linearly from start to end over the buffer, for changes
+  // that must not click
+  void (*gain_ramp)(int16_t* samples, size_t count, float start, float end);
+  // One gain per sample
+  void (*gain_curve)(int16_t* samples, const float* gains, size_t count);
+  // dest += source * gain, saturated
+  void (*mix)(int16_t* dest, const int16_t* source, size_t count, float gain);
+  void (*to_float)(const int16_t* samples, float* dest, size_t count);
+  void (*from_float)(const float* samples, int16_t* dest, size_t count);
+  // Largest absolute sample, 32768 for -32768
+  int (*peak)(const int16_t* samples, size_t count);
+  uint64_t (*sum_of_squares)(const int16_t* samples, size_t count);
+  // Interleaved stereo to mono, the rounded down mean of each pair
+  void (*downmix_stereo)(const int16_t* stereo, int16_t* mono, size_t frames);
+};
+
+const DspKernels& GetDspKernels();
+
+// Every version that can run here, the scalar one first
+size_t GetAvailableDspKernels(const DspKernels** kernels, size_t max);
+
+// Per version entry points, nullptr when not built for this target
+const DspKernels* GetScalarDspKernels();
+const DspKernels* GetSse2DspKernels();
+const DspKernels* GetAvx2DspKernels();
@@ -0,0 +1,204 @@
+#include "dsp_kernels.h"
+#include "dsp_kernels_internal.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// Only this file's functions may use AVX2, and only once the CPU check
+// has passed, so the rest of the build keeps its baseline flags. MSVC
+// allows the intrinsics anywhere.
+#if defined(__GNUC__)
+#define DSP_AVX2 __attribute__((target("avx2")))
+#else
+#define DSP_AVX2
+#endif
+
+namespace {
+
+DSP_AVX2 inline __m256 LowToFloat(__m256i x) {
+  return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(x)));
+}
+
+DSP_AVX2 inline __m256 HighToFloat(__m256i x) {
+  return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(x, 1)));
+}
+
+// The pack works within each 128 bit half, the permute puts the four
+// groups of four samples back in order
+DSP_AVX2 inline __m256i Pack(__m256i low, __m256i high) {
+  return _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8);
+}
+
+// Clamped in float first, out of range values would convert to INT_MIN
+DSP_AVX2 inline __m256i ToInt16(__m256 low, __m256 high) {
+  const __m256 min = _mm256_set1_ps(-32768.0f);
+  const __m256 max = _mm256_set1_ps(32767.0f);
+  return Pack(_mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(low, min), max)),
+              _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(high, min), max)));
+}
+
+DSP_AVX2 inline void Scale16(int16_t* samples, __m256 gain_low, __m256 gain_high) {
+  __m256i x = _mm256_loadu_si256((const __m256i*)samples);
+  _mm256_storeu_si256((__m256i*)samples,
+      ToInt16(_mm256_mul_ps(LowToFloat(x), gain_low), _mm256_mul_ps(HighToFloat(x), gain_high)));
+}
+
+DSP_AVX2 void Gain(int16_t* samples, size_t count, float gain) {
+  size_t i = 0;
+  __m256 g = _mm256_set1_ps(gain);
+  for (; i + 16 <= count; i += 16) {
+    Scale16(samples + i, g, g);
+  }
+  for (; i < count; i++) {
+    samples[i] = dsp::Saturate(samples[i] * gain);
+  }
+}
+
+DSP_AVX2 void GainRamp(int16_t* samples, size_t count, float start, float end) {
+  if (count == 0) {
+    return;
+  }
+  float step = dsp::RampStep(count, start, end);
+  size_t i = 0;
+  // start + step * i for every lane, as the scalar loop computes it
+  __m256 s = _mm256_set1_ps(start);
+  __m256 st = _mm256_set1_ps(step);
+  __m256 index = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256 eight = _mm256_set1_ps(8);
+  for (; i + 16 <= count; i += 16) {
+    __m256 next = _mm256_add_ps(index, eight);
+    Scale16(samples + i, _mm256_add_ps(s, _mm256_mul_ps(st, index)), _mm256_add_ps(s, _mm256_mul_ps(st, next)));
+    index = _mm256_add_ps(next, eight);
+  }
+  for (; i < count; i++) {
+    samples[i] = dsp::Saturate(samples[i] * (start + step * (float)i));
+  }
+}
+
+DSP_AVX2 void GainCurve(int16_t* samples, const float* gains, size_t count) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    Scale16(samples + i, _mm256_loadu_ps(gains + i), _mm256_loadu_ps(gains + i + 8));
+  }
+  for (; i < count; i++) {
+    samples[i] = dsp::Saturate(samples[i] * gains[i]);
+  }
+}
+
+DSP_AVX2 void Mix(int16_t* dest, const int16_t* source, size_t count, float gain) {
+  size_t i = 0;
+  __m256 g = _mm256_set1_ps(gain);
+  for (; i + 16 <= count; i += 16) {
+    __m256i d = _mm256_loadu_si256((const __m256i*)(dest + i));
+    __m256i s = _mm256_loadu_si256((const __m256i*)(source + i));
+    __m256 low = _mm256_add_ps(LowToFloat(d), _mm256_mul_ps(LowToFloat(s), g));
+    __m256 high = _mm256_add_ps(HighToFloat(d), _mm256_mul_ps(HighToFloat(s), g));
+    _mm256_storeu_si256((__m256i*)(dest + i), ToInt16(low, high));
+  }
+  for (; i < count; i++) {
+    dest[i] = dsp::Saturate(dest[i] + source[i] * gain);
+  }
+}
+
+DSP_AVX2 void ToFloat(const int16_t* samples, float* dest, size_t count) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(samples + i));
+    _mm256_storeu_ps(dest + i, LowToFloat(x));
+    _mm256_storeu_ps(dest + i + 8, HighToFloat(x));
+  }
+  for (; i < count; i++) {
+    dest[i] = samples[i];
+  }
+}
+
+DSP_AVX2 void FromFloat(const float* samples, int16_t* dest, size_t count) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    _mm256_storeu_si256((__m256i*)(dest + i),
+        ToInt16(_mm256_loadu_ps(samples + i), _mm256_loadu_ps(samples + i + 8)));
+  }
+  for (; i < count; i++) {
+    dest[i] = dsp::Saturate(samples[i]);
+  }
+}
+
+DSP_AVX2 int Peak(const int16_t* samples, size_t count) {
+  int high = 0;
+  int low = 0;
+  size_t i = 0;
+  if (count >= 16) {
+    __m256i max = _mm256_setzero_si256();
+    __m256i min = _mm256_setzero_si256();
+    for (; i + 16 <= count; i += 16) {
+      __m256i x = _mm256_loadu_si256((const __m256i*)(samples + i));
+      max = _mm256_max_epi16(max, x);
+      min = _mm256_min_epi16(min, x);
+    }
+    alignas(32) int16_t lanes_max[16];
+    alignas(32) int16_t lanes_min[16];
+    _mm256_store_si256((__m256i*)lanes_max, max);
+    _mm256_store_si256((__m256i*)lanes_min, min);
+    for (int j = 0; j < 16; j++) {
+      high = std::max<int>(high, lanes_max[j]);
+      low = std::min<int>(low, lanes_min[j]);
+    }
+  }
+  for (; i < count; i++) {
+    high = std::max<int>(high, samples[i]);
+    low = std::min<int>(low, samples[i]);
+  }
+  return std::max(high, -low);
+}
+
+DSP_AVX2 uint64_t SumOfSquares(const int16_t* samples, size_t count) {
+  size_t i = 0;
+  __m256i total = _mm256_setzero_si256();
+  const __m256i zero = _mm256_setzero_si256();
+  for (; i + 16 <= count; i += 16) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(samples + i));
+    // Pairs of squares fit 32 bits unsigned, widen before adding up
+    __m256i pairs = _mm256_madd_epi16(x, x);
+    total = _mm256_add_epi64(total, _mm256_unpacklo_epi32(pairs, zero));
+    total = _mm256_add_epi64(total, _mm256_unpackhi_epi32(pairs, zero));
+  }
+  alignas(32) uint64_t lanes[4];
+  _mm256_store_si256((__m256i*)lanes, total);
+  uint64_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  for (; i < count; i++) {
+    sum += (uint32_t)((int32_t)samples[i] * samples[i]);
+  }
+  return sum;
+}
+
+DSP_AVX2 void DownmixStereo(const int16_t* stereo, int16_t* mono, size_t frames) {
+  size_t i = 0;
+  const __m256i ones = _mm256_set1_epi16(1);
+  for (; i + 16 <= frames; i += 16) {
+    // Each left and right pair added up in 32 bits, then halved
+    __m256i low = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(stereo + 2 * i)), ones);
+    __m256i high = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(stereo + 2 * i + 16)), ones);
+    _mm256_storeu_si256((__m256i*)(mono + i), Pack(_mm256_srai_epi32(low, 1), _mm256_srai_epi32(high, 1)));
+  }
+  for (; i < frames; i++) {
+    mono[i] = (int16_t)((stereo[2 * i] + stereo[2 * i + 1]) >> 1);
+  }
+}
+
+const DspKernels kAvx2 = {
+  "avx2", Gain, GainRamp, GainCurve, Mix, ToFloat, FromFloat, Peak, SumOfSquares, DownmixStereo,
+};
+
+} // namespace
+
+const DspKernels* GetAvx2DspKernels() {
+  return &kAvx2;
+}
+
+#else
+
+const DspKernels* GetAvx2DspKernels() {
+  return nullptr;
+}
+
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Shared by the per instruction set files, which also use them for the
+// samples left over after the last full vector
+
+namespace dsp {
+
+inline int16_t Saturate(float value) {
+  return (int16_t)std::lrint(std::clamp(value, -32768.0f, 32767.0f));
+}
+
+inline float RampStep(size_t count, float start, float end) {
+  return (end - start) / (float)count;
+}
+
+} // namespace dsp
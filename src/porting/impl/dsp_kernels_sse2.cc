@@ -0,0 +1,190 @@
+#include "dsp_kernels.h"
+#include "dsp_kernels_internal.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+namespace {
+
+// Sign extend by placing each sample in the upper half of a lane
+inline __m128 LowToFloat(__m128i x) {
+  return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+}
+
+inline __m128 HighToFloat(__m128i x) {
+  return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+}
+
+// Clamped in float first, out of range values would convert to INT_MIN
+inline __m128i ToInt16(__m128 low, __m128 high) {
+  const __m128 min = _mm_set1_ps(-32768.0f);
+  const __m128 max = _mm_set1_ps(32767.0f);
+  __m128i lo = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(low, min), max));
+  __m128i hi = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(high, min), max));
+  return _mm_packs_epi32(lo, hi);
+}
+
+inline void Scale8(int16_t* samples, __m128 gain_low, __m128 gain_high) {
+  __m128i x = _mm_loadu_si128((const __m128i*)samples);
+  _mm_storeu_si128((__m128i*)samples,
+      ToInt16(_mm_mul_ps(LowToFloat(x), gain_low), _mm_mul_ps(HighToFloat(x), gain_high)));
+}
+
+void Gain(int16_t* samples, size_t count, float gain) {
+  size_t i = 0;
+  __m128 g = _mm_set1_ps(gain);
+  for (; i + 8 <= count; i += 8) {
+    Scale8(samples + i, g, g);
+  }
+  for (; i < count; i++) {
+    samples[i] = dsp::Saturate(samples[i] * gain);
+  }
+}
+
+void GainRamp(int16_t* samples, size_t count, float start, float end) {
+  if (count == 0) {
+    return;
+  }
+  float step = dsp::RampStep(count, start, end);
+  size_t i = 0;
+  // start + step * i for every lane, as the scalar loop computes it
+  __m128 s = _mm_set1_ps(start);
+  __m128 st = _mm_set1_ps(step);
+  __m128 index = _mm_setr_ps(0, 1, 2, 3);
+  const __m128 four = _mm_set1_ps(4);
+  for (; i + 8 <= count; i += 8) {
+    __m128 next = _mm_add_ps(index, four);
+    Scale8(samples + i, _mm_add_ps(s, _mm_mul_ps(st, index)), _mm_add_ps(s, _mm_mul_ps(st, next)));
+    index = _mm_add_ps(next, four);
+  }
+  for (; i < count; i++) {
+    samples[i] = dsp::Saturate(samples[i] * (start + step * (float)i));
+  }
+}
+
+void GainCurve(int16_t* samples, const float* gains, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    Scale8(samples + i, _mm_loadu_ps(gains + i), _mm_loadu_ps(gains + i + 4));
+  }
+  for (; i < count; i++) {
+    samples[i] = dsp::Saturate(samples[i] * gains[i]);
+  }
+}
+
+void Mix(int16_t* dest, const int16_t* source, size_t count, float gain) {
+  size_t i = 0;
+  __m128 g = _mm_set1_ps(gain);
+  for (; i + 8 <= count; i += 8) {
+    __m128i d = _mm_loadu_si128((const __m128i*)(dest + i));
+    __m128i s = _mm_loadu_si128((const __m128i*)(source + i));
+    __m128 low = _mm_add_ps(LowToFloat(d), _mm_mul_ps(LowToFloat(s), g));
+    __m128 high = _mm_add_ps(HighToFloat(d), _mm_mul_ps(HighToFloat(s), g));
+    _mm_storeu_si128((__m128i*)(dest + i), ToInt16(low, high));
+  }
+  for (; i < count; i++) {
+    dest[i] = dsp::Saturate(dest[i] + source[i] * gain);
+  }
+}
+
+void ToFloat(const int16_t* samples, float* dest, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(samples + i));
+    _mm_storeu_ps(dest + i, LowToFloat(x));
+    _mm_storeu_ps(dest + i + 4, HighToFloat(x));
+  }
+  for (; i < count; i++) {
+    dest[i] = samples[i];
+  }
+}
+
+void FromFloat(const float* samples, int16_t* dest, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    _mm_storeu_si128((__m128i*)(dest + i), ToInt16(_mm_loadu_ps(samples + i), _mm_loadu_ps(samples + i + 4)));
+  }
+  for (; i < count; i++) {
+    dest[i] = dsp::Saturate(samples[i]);
+  }
+}
+
+int Peak(const int16_t* samples, size_t count) {
+  int high = 0;
+  int low = 0;
+  size_t i = 0;
+  if (count >= 8) {
+    __m128i max = _mm_setzero_si128();
+    __m128i min = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8) {
+      __m128i x = _mm_loadu_si128((const __m128i*)(samples + i));
+      max = _mm_max_epi16(max, x);
+      min = _mm_min_epi16(min, x);
+    }
+    alignas(16) int16_t lanes_max[8];
+    alignas(16) int16_t lanes_min[8];
+    _mm_store_si128((__m128i*)lanes_max, max);
+    _mm_store_si128((__m128i*)lanes_min, min);
+    for (int j = 0; j < 8; j++) {
+      high = std::max<int>(high, lanes_max[j]);
+      low = std::min<int>(low, lanes_min[j]);
+    }
+  }
+  for (; i < count; i++) {
+    high = std::max<int>(high, samples[i]);
+    low = std::min<int>(low, samples[i]);
+  }
+  return std::max(high, -low);
+}
+
+uint64_t SumOfSquares(const int16_t* samples, size_t count) {
+  size_t i = 0;
+  __m128i total = _mm_setzero_si128();
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 8 <= count; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(samples + i));
+    // Pairs of squares fit 32 bits unsigned, widen before adding up
+    __m128i pairs = _mm_madd_epi16(x, x);
+    total = _mm_add_epi64(total, _mm_unpacklo_epi32(pairs, zero));
+    total = _mm_add_epi64(total, _mm_unpackhi_epi32(pairs, zero));
+  }
+  alignas(16) uint64_t lanes[2];
+  _mm_store_si128((__m128i*)lanes, total);
+  uint64_t sum = lanes[0] + lanes[1];
+  for (; i < count; i++) {
+    sum += (uint32_t)((int32_t)samples[i] * samples[i]);
+  }
+  return sum;
+}
+
+void DownmixStereo(const int16_t* stereo, int16_t* mono, size_t frames) {
+  size_t i = 0;
+  const __m128i ones = _mm_set1_epi16(1);
+  for (; i + 8 <= frames; i += 8) {
+    // Each left and right pair added up in 32 bits, then halved
+    __m128i low = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(stereo + 2 * i)), ones);
+    __m128i high = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(stereo + 2 * i + 8)), ones);
+    _mm_storeu_si128((__m128i*)(mono + i), _mm_packs_epi32(_mm_srai_epi32(low, 1), _mm_srai_epi32(high, 1)));
+  }
+  for (; i < frames; i++) {
+    mono[i] = (int16_t)((stereo[2 * i] + stereo[2 * i + 1]) >> 1);
+  }
+}
+
+const DspKernels kSse2 = {
+  "sse2", Gain, GainRamp, GainCurve, Mix, ToFloat, FromFloat, Peak, SumOfSquares, DownmixStereo,
+};
+
+} // namespace
+
+const DspKernels* GetSse2DspKernels() {
+  return &kSse2;
+}
+
+#else
+
+const DspKernels* GetSse2DspKernels() {
+  return nullptr;
+}
+
+#endif
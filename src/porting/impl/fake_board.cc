@@ -1,8 +1,13 @@
 #include "fake_board.h"
 #include "sdl_audio_codec.h"
+#include "ui_thread.h"
 #include "http_client.h"
 #include "paho_mqtt.h"
 #include "udp_client.h"
+#include "tcp_transport.h"
+#include "tls_transport.h"
+#include "web_socket.h"
+#include "settings.h"
 #include "display/display.h"
 
 DECLARE_BOARD(FakeBoard)
@@ -13,7 +18,13 @@ FakeBoard::FakeBoard() {
 }
 
 AudioCodec* FakeBoard::GetAudioCodec() {
-  static auto codec = new SdlAudioCodec(nullptr, 16000, 16000);
+  static auto codec = [] {
+    // Replies are decoded and mixed at 48 kHz, which keeps the whole band
+    // of any server rate; the device stream resamples from there
+    auto codec = new SdlAudioCodec(nullptr, 16000, 48000);
+    UIThread::attach_audio(codec);
+    return codec;
+  }();
   return codec;
 }
 
@@ -22,7 +33,13 @@ Http* FakeBoard::CreateHttp() {
 }
 
 WebSocket* FakeBoard::CreateWebSocket() {
-  return nullptr;
+  Settings settings("websocket", false);
+  std::string url = settings.GetString("url");
+  if (url.find("wss://") == 0) {
+    return new WebSocket(new TlsTransport());
+  } else {
+    return new WebSocket(new TcpTransport());
+  }
 }
 
 Mqtt* FakeBoard::CreateMqtt() {
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+// Unbuffered file descriptors, for code that decides itself when data
+// reaches the disk. Returns -1 on failure like the underlying calls.
+
+enum FileMode {
+  kFileTruncate,
+  kFileAppend,
+};
+
+inline int file_open(const std::filesystem::path& path, FileMode mode) {
+#ifdef _WIN32
+  int flags = _O_WRONLY | _O_CREAT | _O_BINARY | (mode == kFileAppend ? _O_APPEND : _O_TRUNC);
+  return _wopen(path.c_str(), flags, _S_IREAD | _S_IWRITE);
+#else
+  int flags = O_WRONLY | O_CREAT | (mode == kFileAppend ? O_APPEND : O_TRUNC);
+  return open(path.c_str(), flags, 0644);
+#endif
+}
+
+inline void file_close(int fd) {
+#ifdef _WIN32
+  _close(fd);
+#else
+  close(fd);
+#endif
+}
+
+// Writes everything unless an error occurs
+inline bool file_write(int fd, const void* data, size_t size) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+#ifdef _WIN32
+    int n = _write(fd, p, (unsigned int)size);
+#else
+    ssize_t n = write(fd, p, size);
+#endif
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+inline bool file_sync(int fd) {
+#ifdef _WIN32
+  return _commit(fd) == 0;
+#else
+  return fsync(fd) == 0;
+#endif
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <errno.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define MAXHOSTNAMELEN 256
+#define poll WSAPoll
+#if !defined(SSLSOCKET_H)
+#undef EAGAIN
+#define EAGAIN WSAEWOULDBLOCK
+#undef EINTR
+#define EINTR WSAEINTR
+#undef EINPROGRESS
+#define EINPROGRESS WSAEINPROGRESS
+#undef EWOULDBLOCK
+#define EWOULDBLOCK WSAEWOULDBLOCK
+#undef ENOTCONN
+#define ENOTCONN WSAENOTCONN
+#undef ECONNRESET
+#define ECONNRESET WSAECONNRESET
+#undef ETIMEDOUT
+#define ETIMEDOUT WAIT_TIMEOUT
+#endif
+#else
+#ifndef SOCKET_ERROR
+#define SOCKET_ERROR (-1)
+#endif
+#define INVALID_SOCKET SOCKET_ERROR
+#include <sys/socket.h>
+#if !defined(_WRS_KERNEL)
+#include <sys/param.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <poll.h>
+#include <sys/uio.h>
+#else
+#include <selectLib.h>
+#endif
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define SOCKET int
+#define closesocket close
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#endif
+#endif
+
+inline void net_init() {
+#if defined(_WIN32) || defined(_WIN64)
+  static bool inited = false;
+  if (!inited) {
+    inited = true;
+    WORD winsockVer = 0x0202;
+    WSADATA wsd;
+    WSAStartup(winsockVer, &wsd);
+  }
+#endif
+}
+
+inline int net_last_error() {
+#if defined(_WIN32) || defined(_WIN64)
+  return WSAGetLastError();
+#else
+  return errno;
+#endif
+}
+
+// A peer that drops the connection mid-write must fail the send, not raise
+// SIGPIPE and end the process. Linux takes a flag per send, macOS an option
+// per socket, Windows has no such signal.
+#if defined(MSG_NOSIGNAL)
+#define NET_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define NET_SEND_FLAGS 0
+#endif
+
+inline void net_set_nosigpipe(SOCKET s) {
+#if defined(SO_NOSIGPIPE)
+  int on = 1;
+  setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#else
+  (void)s;
+#endif
+}
+
+// Bytes in the socket's send buffer not yet handed to the network, sent
+// but unacknowledged data does not count where the platform tells apart
+inline size_t net_send_queue_bytes(SOCKET s) {
+#if defined(SIOCOUTQNSD)
+  int bytes = 0;
+  return ioctl(s, SIOCOUTQNSD, &bytes) == 0 && bytes > 0 ? (size_t)bytes : 0;
+#elif defined(SO_NWRITE)
+  int bytes = 0;
+  socklen_t len = sizeof(bytes);
+  return getsockopt(s, SOL_SOCKET, SO_NWRITE, &bytes, &len) == 0 && bytes > 0 ? (size_t)bytes : 0;
+#else
+  (void)s;
+  return 0;
+#endif
+}
+
+inline bool net_set_nonblocking(SOCKET s) {
+#if defined(_WIN32) || defined(_WIN64)
+  u_long mode = 1;
+  return ioctlsocket(s, FIONBIO, &mode) == 0;
+#else
+  int flags = fcntl(s, F_GETFL, 0);
+  return flags >= 0 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
@@ -1,10 +1,41 @@
 #include "opus_wrapper.h"
+#include "metrics.h"
+#include "trace.h"
 #include <stdio.h>
+#include <chrono>
 
-#define BITRATE 64000
 #define MAX_FRAME_SIZE 6*960
 #define MAX_PACKET_SIZE (3*1276)
 
+namespace {
+
+struct OpusMetrics {
+  // 50 us to 25 ms
+  Histogram& encode_time = Metrics::GetInstance().GetHistogram("xiaozhi_opus_encode_seconds",
+      "Time to encode one frame.", Histogram::ExponentialBounds(0.00005, 2, 10));
+  Histogram& decode_time = Metrics::GetInstance().GetHistogram("xiaozhi_opus_decode_seconds",
+      "Time to decode one frame.", Histogram::ExponentialBounds(0.00005, 2, 10));
+  Counter& encoded_bytes = Metrics::GetInstance().GetCounter("xiaozhi_opus_encoded_bytes_total",
+      "Bytes produced by the encoder.");
+  Counter& concealed = Metrics::GetInstance().GetCounter("xiaozhi_opus_concealed_frames_total",
+      "Frames synthesized by the decoder for missing packets.");
+  Counter& encode_errors = Metrics::GetInstance().GetCounter("xiaozhi_opus_errors_total",
+      "Failed encoder or decoder calls.", "op=\"encode\"");
+  Counter& decode_errors = Metrics::GetInstance().GetCounter("xiaozhi_opus_errors_total",
+      "Failed encoder or decoder calls.", "op=\"decode\"");
+};
+
+OpusMetrics& opus_metrics() {
+  static OpusMetrics metrics;
+  return metrics;
+}
+
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
 OpusEncoderWrapper::~OpusEncoderWrapper() {
   if (encoder) {
     opus_encoder_destroy(encoder);
@@ -12,30 +43,77 @@ OpusEncoderWrapper::~OpusEncoderWrapper() {
 }
 
 OpusEncoderWrapper::OpusEncoderWrapper(int sample_rate, int channels, int duration_ms)
-: channels_(channels) {
+: channels_(channels)
+, duration_ms_(duration_ms) {
   int err;
-  encoder = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_AUDIO, &err);
+  // VOIP mode tunes the encoder for intelligibility of speech
+  encoder = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &err);
   if (err<0) {
     fprintf(stderr, "failed to create an encoder: %s\n", opus_strerror(err));
     return;
   }
 
-  err = opus_encoder_ctl(encoder, OPUS_SET_BITRATE(BITRATE));
-  if (err<0) {
+  opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+  opus_encoder_ctl(encoder, OPUS_SET_VBR(1));
+  if (!SetBitrate(DEFAULT_BITRATE)) {
     opus_encoder_destroy(encoder);
     encoder = nullptr;
-    fprintf(stderr, "failed to set bitrate: %s\n", opus_strerror(err));
     return;
   }
 }
 
+bool OpusEncoderWrapper::SetBitrate(int bitrate) {
+  if (!encoder) {
+    return false;
+  }
+  int err = opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate));
+  if (err<0) {
+    fprintf(stderr, "failed to set bitrate: %s\n", opus_strerror(err));
+    return false;
+  }
+  bitrate_ = bitrate;
+  return true;
+}
+
+bool OpusEncoderWrapper::SetComplexity(int complexity) {
+  if (!encoder) {
+    return false;
+  }
+  int err = opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(complexity));
+  if (err<0) {
+    fprintf(stderr, "failed to set complexity: %s\n", opus_strerror(err));
+    return false;
+  }
+  complexity_ = complexity;
+  return true;
+}
+
+bool OpusEncoderWrapper::SetDtx(bool enable) {
+  if (!encoder) {
+    return false;
+  }
+  int err = opus_encoder_ctl(encoder, OPUS_SET_DTX(enable ? 1 : 0));
+  if (err<0) {
+    fprintf(stderr, "failed to set dtx: %s\n", opus_strerror(err));
+    return false;
+  }
+  dtx_ = enable;
+  return true;
+}
+
 void OpusEncoderWrapper::Encode(std::vector<int16_t> &&data, std::function <void(std::vector<uint8_t> &&)> callback) {
+  TRACE_SCOPE("Opus Encode");
+  auto& metrics = opus_metrics();
+  auto start = std::chrono::steady_clock::now();
   std::vector<uint8_t> data_bytes(MAX_PACKET_SIZE);
   int nbBytes = opus_encode(encoder, reinterpret_cast<const opus_int16*>(&data[0]), data.size() / channels_, reinterpret_cast<unsigned char*>(&data_bytes[0]), MAX_PACKET_SIZE);
   if (nbBytes <= 0) {
     fprintf(stderr, "encode failed: %s\n", opus_strerror(nbBytes));
+    metrics.encode_errors.Increment();
     return;
   }
+  metrics.encode_time.Observe(SecondsSince(start));
+  metrics.encoded_bytes.Increment(nbBytes);
 
   data_bytes.resize(nbBytes);
   callback(std::move(data_bytes));
@@ -59,14 +137,50 @@ OpusDecoderWrapper::OpusDecoderWrapper(int sample_rate, int channels, int durati
   }
 }
 
+bool OpusDecoderWrapper::Configure(int sample_rate, int duration_ms) {
+  if (!decoder) {
+    return false;
+  }
+  if (sample_rate != sample_rate_) {
+    // The state size does not depend on the rate, so it is reused
+    int err = opus_decoder_init(decoder, sample_rate, channels_);
+    if (err<0) {
+      fprintf(stderr, "failed to init decoder: %s\n", opus_strerror(err));
+      return false;
+    }
+    sample_rate_ = sample_rate;
+  }
+  duration_ms_ = duration_ms;
+  return true;
+}
+
+void OpusDecoderWrapper::ResetState() {
+  if (decoder) {
+    opus_decoder_ctl(decoder, OPUS_RESET_STATE);
+  }
+}
+
 bool OpusDecoderWrapper::Decode(std::vector<uint8_t> &&data, std::vector<int16_t> &pcm) {
+  TRACE_SCOPE("Opus Decode");
+  auto& metrics = opus_metrics();
+  auto start = std::chrono::steady_clock::now();
   pcm.resize(MAX_FRAME_SIZE * channels_);
 
-  int frame_size = opus_decode(decoder, reinterpret_cast<const unsigned char *>(&data[0]), data.size(), reinterpret_cast<opus_int16*>(&pcm[0]), MAX_FRAME_SIZE, 0);
+  int frame_size;
+  if (data.empty()) {
+    metrics.concealed.Increment();
+    // PLC after a loss, comfort noise after a DTX frame
+    int missing = sample_rate_ / 1000 * duration_ms_;
+    frame_size = opus_decode(decoder, nullptr, 0, reinterpret_cast<opus_int16*>(&pcm[0]), missing < MAX_FRAME_SIZE ? missing : MAX_FRAME_SIZE, 0);
+  } else {
+    frame_size = opus_decode(decoder, reinterpret_cast<const unsigned char *>(&data[0]), data.size(), reinterpret_cast<opus_int16*>(&pcm[0]), MAX_FRAME_SIZE, 0);
+  }
   if (frame_size<0) {
     fprintf(stderr, "decoder failed: %s\n", opus_strerror(frame_size));
+    metrics.decode_errors.Increment();
     return false;
   }
+  metrics.decode_time.Observe(SecondsSince(start));
   pcm.resize(frame_size * channels_);
   return true;
 }
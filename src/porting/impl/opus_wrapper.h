@@ -6,14 +6,37 @@
 
 class OpusEncoderWrapper {
 public:
+  // Wideband speech is transparent well below the music oriented 64 kbps
+  static constexpr int DEFAULT_BITRATE = 24000;
+
   OpusEncoderWrapper(int sample_rate, int channels, int duration_ms);
   ~OpusEncoderWrapper();
 
+  int duration_ms() const { return duration_ms_; }
+
   void Encode(std::vector<int16_t> &&data, std::function <void(std::vector<uint8_t> &&)> callback);
 
+  // Can be changed between frames, must be called on the encoding thread
+  bool SetBitrate(int bitrate);
+  bool SetComplexity(int complexity);
+  // Silent frames are coded as 1-2 byte packets, with a comfort noise
+  // update every 400 ms
+  bool SetDtx(bool enable);
+
+  int bitrate() const { return bitrate_; }
+  int complexity() const { return complexity_; }
+  bool dtx() const { return dtx_; }
+
+  // A DTX frame carries no audio, only that the input is silent
+  static bool IsDtxPacket(const std::vector<uint8_t>& packet) { return packet.size() <= 2; }
+
 private:
   OpusEncoder *encoder = nullptr;
   const int channels_;
+  int duration_ms_;
+  int bitrate_ = DEFAULT_BITRATE;
+  int complexity_ = 10;
+  bool dtx_ = false;
 };
 
 class OpusDecoderWrapper {
@@ -21,16 +44,20 @@ public:
   OpusDecoderWrapper(int sample_rate, int channels, int duration_ms);
   ~OpusDecoderWrapper();
 
+  // An empty packet stands for a lost or untransmitted frame, the decoder
+  // fills it with concealment or comfort noise of one frame duration
   bool Decode(std::vector<uint8_t> &&data, std::vector<int16_t> &pcm);
 
-  void ResetState() {}
+  // Switch rate and frame duration without reallocating the decoder
+  bool Configure(int sample_rate, int duration_ms);
+  void ResetState();
 
   int duration_ms() const { return duration_ms_; }
   int sample_rate() const { return sample_rate_; }
 
 private:
   OpusDecoder *decoder = nullptr;
-  const int sample_rate_;
+  int sample_rate_;
   const int channels_;
-  const int duration_ms_;
+  int duration_ms_;
 };
@@ -1,4 +1,7 @@
 #include "paho_mqtt.h"
+#include <esp_log.h>
+
+#define TAG "PahoMqtt"
 
 PahoMqtt::PahoMqtt() {
 
@@ -14,11 +17,7 @@ void PahoMqtt::connlost(void *context, char *cause)
 {
   auto self = reinterpret_cast<PahoMqtt*>(context);
 
-	printf("\nConnection lost\n");
-	if (cause)
-		printf("     cause: %s\n", cause);
-
-	printf("Reconnecting\n");
+	ESP_LOGW(TAG, "Connection lost: %s, reconnecting", cause ? cause : "unknown");
   self->Connect();
 }
 
@@ -49,7 +48,7 @@ void PahoMqtt::onConnect(void* context, MQTTAsync_successData* response)
 
 void PahoMqtt::onConnectFailure(void* context, MQTTAsync_failureData* response)
 {
-	printf("Connect failed, rc %d\n", response ? response->code : 0);
+	ESP_LOGE(TAG, "Connect failed, rc %d", response ? response->code : 0);
 }
 
 bool PahoMqtt::Connect() {
@@ -71,7 +70,7 @@ bool PahoMqtt::Connect() {
 
   int rc;
   if ((rc = MQTTAsync_connect(cli_, &conn_opts)) != MQTTASYNC_SUCCESS) {
-    printf("Failed to start connect, return code %d\n", rc);
+    ESP_LOGE(TAG, "Failed to start connect, return code %d", rc);
 		return false;
   }
   return true;
@@ -90,13 +89,13 @@ bool PahoMqtt::Connect(const std::string broker_address, int broker_port, const
 
   if ((rc = MQTTAsync_create(&cli_, uri.c_str(), client_id.c_str(), MQTTCLIENT_PERSISTENCE_NONE, NULL)) != MQTTASYNC_SUCCESS)
 	{
-		printf("Failed to create client object, return code %d\n", rc);
+		ESP_LOGE(TAG, "Failed to create client object, return code %d", rc);
 		return false;
 	}
 
   if ((rc = MQTTAsync_setCallbacks(cli_, this, connlost, messageArrived, NULL)) != MQTTASYNC_SUCCESS)
 	{
-		printf("Failed to set callback, return code %d\n", rc);
+		ESP_LOGE(TAG, "Failed to set callback, return code %d", rc);
 		return false;
 	}
 
@@ -116,7 +115,7 @@ void PahoMqtt::onSend(void* context, MQTTAsync_successData* response)
 {
   auto ctx = reinterpret_cast<SendContext*>(context);
 
-  printf("Message with token value %d delivery confirmed\n", response->token);
+  ESP_LOGD(TAG, "Message with token value %d delivery confirmed", response->token);
 
   delete ctx;
 }
@@ -125,7 +124,7 @@ void PahoMqtt::onSendFailure(void* context, MQTTAsync_failureData* response)
 {
   auto ctx = reinterpret_cast<SendContext*>(context);
 
-  printf("Message send failed token %d error code %d\n", response->token, response->code);
+  ESP_LOGW(TAG, "Message send failed token %d error code %d", response->token, response->code);
 
   delete ctx;
 }
@@ -147,7 +146,7 @@ bool PahoMqtt::Publish(const std::string topic, const std::string payload, int q
 	pubmsg.retained = 0;
 	if ((rc = MQTTAsync_sendMessage(cli_, topic.c_str(), &pubmsg, &opts)) != MQTTASYNC_SUCCESS)
 	{
-		printf("Failed to start sendMessage, return code %d\n", rc);
+		ESP_LOGE(TAG, "Failed to start sendMessage, return code %d", rc);
 		return false;
 	}
   return true;
@@ -161,12 +160,12 @@ void PahoMqtt::onDisconnect(void* context, MQTTAsync_successData* response)
   if (self->on_disconnected_callback_) {
     self->on_disconnected_callback_();
   }
-	printf("Successful disconnection\n");
+	ESP_LOGI(TAG, "Successful disconnection");
 }
 
 void PahoMqtt::onDisconnectFailure(void* context, MQTTAsync_failureData* response)
 {
-	printf("Disconnect failed\n");
+	ESP_LOGW(TAG, "Disconnect failed");
 }
 
 void PahoMqtt::Disconnect() {
@@ -177,19 +176,19 @@ void PahoMqtt::Disconnect() {
 	opts.onFailure = onDisconnectFailure;
 	opts.context = this;
 	if ((rc = MQTTAsync_disconnect(cli_, &opts)) != MQTTASYNC_SUCCESS) {
-		printf("Failed to start disconnect, return code %d\n", rc);
+		ESP_LOGE(TAG, "Failed to start disconnect, return code %d", rc);
 	}
 }
 
 void PahoMqtt::onSubscribe(void* context, MQTTAsync_successData* response)
 {
 	auto self = reinterpret_cast<PahoMqtt*>(context);
-	printf("Successful subscription\n");
+	ESP_LOGD(TAG, "Successful subscription");
 }
 
 void PahoMqtt::onUnSubscribe(void* context, MQTTAsync_successData* response) {
   auto self = reinterpret_cast<PahoMqtt*>(context);
-	printf("Successful unsubscription\n");
+	ESP_LOGD(TAG, "Successful unsubscription");
 }
 
 bool PahoMqtt::Subscribe(const std::string topic, int qos) {
@@ -200,7 +199,7 @@ bool PahoMqtt::Subscribe(const std::string topic, int qos) {
 	opts.context = this;
 
 	if ((rc = MQTTAsync_subscribe(cli_, topic.c_str(), qos, &opts)) != MQTTASYNC_SUCCESS) {
-    printf("Failed to subscribe %s, return code %d\n", topic.c_str(), rc);
+    ESP_LOGE(TAG, "Failed to subscribe %s, return code %d", topic.c_str(), rc);
     return false;
   }
 
@@ -215,7 +214,7 @@ bool PahoMqtt::Unsubscribe(const std::string topic) {
 	opts.context = this;
 
 	if ((rc = MQTTAsync_unsubscribe(cli_, topic.c_str(), &opts)) != MQTTASYNC_SUCCESS) {
-    printf("Failed to subscribe %s, return code %d\n", topic.c_str(), rc);
+    ESP_LOGE(TAG, "Failed to unsubscribe %s, return code %d", topic.c_str(), rc);
     return false;
   }
 
@@ -0,0 +1,175 @@
+#include "process_stats.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <tlhelp32.h>
+#else
+#include <unistd.h>
+#endif
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace {
+
+#ifdef _WIN32
+
+uint64_t FileTimeToUs(const FILETIME& time) {
+  ULARGE_INTEGER value;
+  value.LowPart = time.dwLowDateTime;
+  value.HighPart = time.dwHighDateTime;
+  return value.QuadPart / 10;
+}
+
+#else
+
+// Fields of /proc/<pid>/stat after the parenthesised command name,
+// which may itself contain spaces
+bool ReadStatFields(const std::string& path, std::string& name, std::vector<std::string>& fields) {
+  std::ifstream file(path);
+  std::string line;
+  if (!std::getline(file, line)) {
+    return false;
+  }
+  size_t open = line.find('(');
+  size_t close = line.rfind(')');
+  if (open == std::string::npos || close == std::string::npos || close < open) {
+    return false;
+  }
+  name = line.substr(open + 1, close - open - 1);
+  std::istringstream rest(line.substr(close + 1));
+  fields.clear();
+  std::string field;
+  while (rest >> field) {
+    fields.push_back(field);
+  }
+  // fields[0] is field 3 of the line (the state), rss is field 24
+  return fields.size() > 21;
+}
+
+#endif
+
+} // namespace
+
+bool ReadProcessStats(ProcessStats& stats) {
+  stats = ProcessStats();
+#ifdef _WIN32
+  HANDLE process = GetCurrentProcess();
+  PROCESS_MEMORY_COUNTERS_EX memory;
+  if (GetProcessMemoryInfo(process, (PROCESS_MEMORY_COUNTERS*)&memory, sizeof(memory))) {
+    stats.resident_bytes = memory.WorkingSetSize;
+    stats.virtual_bytes = memory.PrivateUsage;
+  }
+  FILETIME creation, exit, kernel, user;
+  if (GetProcessTimes(process, &creation, &exit, &kernel, &user)) {
+    stats.cpu_seconds = (FileTimeToUs(kernel) + FileTimeToUs(user)) / 1e6;
+  }
+  DWORD handles = 0;
+  if (GetProcessHandleCount(process, &handles)) {
+    stats.open_fds = (int)handles;
+  }
+  std::vector<ThreadCpuTime> threads;
+  if (ReadThreadCpuTimes(threads)) {
+    stats.threads = (int)threads.size();
+  }
+  return true;
+#else
+  std::string name;
+  std::vector<std::string> fields;
+  if (!ReadStatFields("/proc/self/stat", name, fields)) {
+    return false;
+  }
+  static const long ticks_per_second = sysconf(_SC_CLK_TCK);
+  static const long page_size = sysconf(_SC_PAGESIZE);
+  stats.cpu_seconds = (std::stoull(fields[11]) + std::stoull(fields[12])) / (double)ticks_per_second;
+  stats.threads = std::stoi(fields[17]);
+  stats.virtual_bytes = std::stoull(fields[20]);
+  stats.resident_bytes = std::stoull(fields[21]) * page_size;
+
+  std::error_code ec;
+  for (auto it = std::filesystem::directory_iterator("/proc/self/fd", ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    stats.open_fds++;
+  }
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 info = mallinfo2();
+  stats.heap_used_bytes = info.uordblks + info.hblkhd;
+  stats.heap_free_bytes = info.fordblks;
+#elif defined(__GLIBC__)
+  struct mallinfo info = mallinfo();
+  stats.heap_used_bytes = (unsigned)info.uordblks + (unsigned)info.hblkhd;
+  stats.heap_free_bytes = (unsigned)info.fordblks;
+#endif
+  return true;
+#endif
+}
+
+size_t ReadAvailableMemory() {
+#ifdef _WIN32
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (!GlobalMemoryStatusEx(&status)) {
+    return 0;
+  }
+  return (size_t)status.ullAvailPhys;
+#else
+  std::ifstream file("/proc/meminfo");
+  std::string key;
+  size_t kilobytes;
+  std::string unit;
+  while (file >> key >> kilobytes) {
+    std::getline(file, unit);
+    if (key == "MemAvailable:") {
+      return kilobytes * 1024;
+    }
+  }
+  return 0;
+#endif
+}
+
+bool ReadThreadCpuTimes(std::vector<ThreadCpuTime>& threads) {
+  threads.clear();
+#ifdef _WIN32
+  HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+  if (snapshot == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  DWORD pid = GetCurrentProcessId();
+  THREADENTRY32 entry;
+  entry.dwSize = sizeof(entry);
+  for (BOOL ok = Thread32First(snapshot, &entry); ok; ok = Thread32Next(snapshot, &entry)) {
+    if (entry.th32OwnerProcessID != pid) {
+      continue;
+    }
+    ThreadCpuTime thread{(int)entry.th32ThreadID, "", 0};
+    HANDLE handle = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, entry.th32ThreadID);
+    if (handle != nullptr) {
+      FILETIME creation, exit, kernel, user;
+      if (GetThreadTimes(handle, &creation, &exit, &kernel, &user)) {
+        thread.cpu_us = FileTimeToUs(kernel) + FileTimeToUs(user);
+      }
+      CloseHandle(handle);
+    }
+    thread.name = std::to_string(thread.id);
+    threads.push_back(std::move(thread));
+  }
+  CloseHandle(snapshot);
+  return true;
+#else
+  static const long ticks_per_second = sysconf(_SC_CLK_TCK);
+  std::error_code ec;
+  for (auto it = std::filesystem::directory_iterator("/proc/self/task", ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    std::string name;
+    std::vector<std::string> fields;
+    if (!ReadStatFields(it->path().string() + "/stat", name, fields)) {
+      continue;
+    }
+    uint64_t ticks = std::stoull(fields[11]) + std::stoull(fields[12]);
+    threads.push_back({std::stoi(it->path().filename().string()), name, ticks * 1000000 / ticks_per_second});
+  }
+  return !ec;
+#endif
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What the OS and the allocator know about this process, fields stay 0
+// where the platform has no cheap way to tell
+struct ProcessStats {
+  size_t resident_bytes = 0;
+  size_t virtual_bytes = 0;
+  double cpu_seconds = 0;
+  int threads = 0;
+  int open_fds = 0;
+  // malloc arenas: handed out, and held but free
+  size_t heap_used_bytes = 0;
+  size_t heap_free_bytes = 0;
+};
+
+bool ReadProcessStats(ProcessStats& stats);
+
+// Memory the system could still give to the process, 0 when unknown
+size_t ReadAvailableMemory();
+
+struct ThreadCpuTime {
+  int id;
+  std::string name;
+  uint64_t cpu_us;
+};
+
+// CPU time used so far by every thread of the process
+bool ReadThreadCpuTimes(std::vector<ThreadCpuTime>& threads);
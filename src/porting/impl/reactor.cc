@@ -0,0 +1,264 @@
+#include "reactor.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <chrono>
+#include <vector>
+
+#define TAG "Reactor"
+
+namespace {
+
+// Upper bound of a single poll, so a lost wakeup only costs latency
+constexpr int kMaxPollMs = 1000;
+
+} // namespace
+
+Reactor& Reactor::GetInstance() {
+  static Reactor* instance = new Reactor();
+  return *instance;
+}
+
+Reactor::Reactor() {
+  net_init();
+
+  // A loopback UDP socket connected to itself works as the wakeup channel
+  // on every platform; pipes are not pollable with WSAPoll.
+  wakeup_socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+  if (wakeup_socket_ != INVALID_SOCKET) {
+    sockaddr_in addr{};
+    socklen_t len = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(wakeup_socket_, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(wakeup_socket_, (struct sockaddr *)&addr, &len) != 0 ||
+        connect(wakeup_socket_, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      ESP_LOGE(TAG, "Failed to setup wakeup socket: %d", net_last_error());
+      closesocket(wakeup_socket_);
+      wakeup_socket_ = INVALID_SOCKET;
+    } else {
+      net_set_nonblocking(wakeup_socket_);
+    }
+  }
+
+  xTaskCreate([](void* arg) {
+    Reactor* reactor = (Reactor*)arg;
+    reactor->Loop();
+    vTaskDelete(NULL);
+  }, "reactor", 4096 * 2, this, 9, nullptr);
+}
+
+Reactor::~Reactor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+  Wakeup();
+}
+
+int64_t Reactor::Now() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool Reactor::InReactorThread() const {
+  return std::this_thread::get_id() == thread_id_;
+}
+
+bool Reactor::Add(SOCKET fd, short events, IoCallback callback) {
+  if (fd == INVALID_SOCKET) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto handler = std::make_shared<Handler>();
+    handler->events = events;
+    handler->callback = std::move(callback);
+    handlers_[fd] = std::move(handler);
+  }
+  Wakeup();
+  return true;
+}
+
+void Reactor::Modify(SOCKET fd, short events) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = handlers_.find(fd);
+    if (it == handlers_.end() || it->second->events == events) {
+      return;
+    }
+    it->second->events = events;
+  }
+  Wakeup();
+}
+
+void Reactor::Remove(SOCKET fd) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = handlers_.find(fd);
+  if (it == handlers_.end()) {
+    return;
+  }
+  auto handler = std::move(it->second);
+  handlers_.erase(it);
+  WaitIdle(handler.get(), lock);
+}
+
+void Reactor::StartTimer(Timer* timer, int64_t timeout_us, int64_t period_us) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (timer->armed) {
+      timers_.erase({timer->due_us, timer});
+    }
+    timer->due_us = Now() + timeout_us;
+    timer->period_us = period_us;
+    timer->armed = true;
+    timers_.emplace(timer->due_us, timer);
+  }
+  Wakeup();
+}
+
+void Reactor::StopTimer(Timer* timer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (timer->armed) {
+    timers_.erase({timer->due_us, timer});
+    timer->armed = false;
+  }
+}
+
+void Reactor::DeleteTimer(Timer* timer) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (timer->armed) {
+    timers_.erase({timer->due_us, timer});
+    timer->armed = false;
+  }
+  WaitIdle(timer, lock);
+}
+
+bool Reactor::IsTimerArmed(Timer* timer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return timer->armed;
+}
+
+void Reactor::WaitIdle(const void* target, std::unique_lock<std::mutex>& lock) {
+  // A callback removing itself would wait forever
+  if (InReactorThread()) {
+    return;
+  }
+  idle_cv_.wait(lock, [this, target] { return dispatching_ != target; });
+}
+
+void Reactor::Wakeup() {
+  if (wakeup_socket_ != INVALID_SOCKET && !InReactorThread()) {
+    char c = 0;
+    send(wakeup_socket_, &c, 1, 0);
+  }
+}
+
+void Reactor::DrainWakeup() {
+  char buffer[64];
+  while (recv(wakeup_socket_, buffer, sizeof(buffer), 0) > 0) {
+  }
+}
+
+// Run expired timers, return the poll timeout until the next one
+int Reactor::RunTimers() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!timers_.empty()) {
+    auto now = Now();
+    auto [due, timer] = *timers_.begin();
+    if (due > now) {
+      int64_t wait_ms = (due - now + 999) / 1000;
+      return wait_ms < kMaxPollMs ? (int)wait_ms : kMaxPollMs;
+    }
+
+    timers_.erase(timers_.begin());
+    if (timer->period_us > 0) {
+      // Skip missed periods instead of firing a burst
+      int64_t next = due + timer->period_us;
+      if (next <= now) {
+        next = now + timer->period_us;
+      }
+      timer->due_us = next;
+      timers_.emplace(next, timer);
+    } else {
+      timer->armed = false;
+    }
+
+    dispatching_ = timer;
+    auto callback = timer->callback;
+    lock.unlock();
+    if (callback) {
+      callback();
+    }
+    lock.lock();
+    dispatching_ = nullptr;
+    idle_cv_.notify_all();
+  }
+  return kMaxPollMs;
+}
+
+void Reactor::Loop() {
+  thread_id_ = std::this_thread::get_id();
+  ESP_LOGI(TAG, "reactor started");
+
+  std::vector<pollfd> fds;
+  while (true) {
+    int timeout_ms = RunTimers();
+
+    fds.clear();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!running_) {
+        break;
+      }
+      if (wakeup_socket_ != INVALID_SOCKET) {
+        fds.push_back({wakeup_socket_, POLLIN, 0});
+      }
+      for (auto& [fd, handler] : handlers_) {
+        if (handler->events != 0) {
+          fds.push_back({fd, handler->events, 0});
+        }
+      }
+    }
+
+    int rc = poll(fds.data(), (unsigned long)fds.size(), timeout_ms);
+    if (rc < 0) {
+      if (net_last_error() != EINTR) {
+        ESP_LOGE(TAG, "poll failed: %d", net_last_error());
+        vTaskDelay(pdMS_TO_TICKS(10));
+      }
+      continue;
+    }
+    if (rc == 0) {
+      continue;
+    }
+
+    for (auto& pfd : fds) {
+      if (pfd.revents == 0) {
+        continue;
+      }
+      if (pfd.fd == wakeup_socket_) {
+        DrainWakeup();
+        continue;
+      }
+
+      std::shared_ptr<Handler> handler;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = handlers_.find(pfd.fd);
+        if (it == handlers_.end()) {
+          continue;
+        }
+        handler = it->second;
+        dispatching_ = handler.get();
+      }
+      handler->callback(pfd.revents);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dispatching_ = nullptr;
+      }
+      idle_cv_.notify_all();
+    }
+  }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "net_socket.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <set>
+#include <map>
+#include <thread>
+#include <atomic>
+
+// One network/timer thread shared by every socket and esp_timer in the
+// process. Callbacks run on the reactor thread and must not block.
+class Reactor {
+public:
+  using IoCallback = std::function<void(short revents)>;
+
+  struct Timer {
+    std::function<void()> callback;
+    int64_t due_us = 0;
+    int64_t period_us = 0;
+    bool armed = false;
+  };
+
+  static Reactor& GetInstance();
+
+  Reactor(const Reactor&) = delete;
+  Reactor& operator=(const Reactor&) = delete;
+
+  // Register a socket, callback is invoked with the poll revents
+  bool Add(SOCKET fd, short events, IoCallback callback);
+  void Modify(SOCKET fd, short events);
+  // After Remove returns, the callback of fd is not running and never will
+  void Remove(SOCKET fd);
+
+  void StartTimer(Timer* timer, int64_t timeout_us, int64_t period_us);
+  void StopTimer(Timer* timer);
+  // Stop the timer and wait for a running callback of it to return
+  void DeleteTimer(Timer* timer);
+  bool IsTimerArmed(Timer* timer);
+
+  bool InReactorThread() const;
+  static int64_t Now();
+
+private:
+  Reactor();
+  ~Reactor();
+
+  struct Handler {
+    short events = 0;
+    IoCallback callback;
+  };
+
+  void Loop();
+  void Wakeup();
+  void DrainWakeup();
+  int RunTimers();
+  void WaitIdle(const void* target, std::unique_lock<std::mutex>& lock);
+
+  std::mutex mutex_;
+  std::condition_variable idle_cv_;
+  std::map<SOCKET, std::shared_ptr<Handler>> handlers_;
+  std::set<std::pair<int64_t, Timer*>> timers_;
+  const void* dispatching_ = nullptr;
+  SOCKET wakeup_socket_ = INVALID_SOCKET;
+  std::atomic<std::thread::id> thread_id_;
+  bool running_ = true;
+};
@@ -1,5 +1,7 @@
 #include "sdl_audio_codec.h"
 #include "ui_thread.h"
+#include "dsp_kernels.h"
+#include <algorithm>
 
 SdlAudioCodec::~SdlAudioCodec() {
   if (stream_in) {
@@ -42,6 +44,9 @@ SdlAudioCodec::SdlAudioCodec(const char *devname, int input_sample_rate, int out
   spec.format = SDL_AUDIO_S16;
   spec.freq = input_sample_rate;
   spec.channels = 1;
+  // Playback is written at its own rate, the stream converts to the device's
+  SDL_AudioSpec playspec = spec;
+  playspec.freq = output_sample_rate;
 
   SDL_Log("Opening default playback device...");
   SDL_AudioDeviceID device = SDL_OpenAudioDevice(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, NULL);
@@ -53,7 +58,7 @@ SdlAudioCodec::SdlAudioCodec(const char *devname, int input_sample_rate, int out
 
   SDL_PauseAudioDevice(device);
   SDL_GetAudioDeviceFormat(device, &outspec, NULL);
-  stream_out = SDL_CreateAudioStream(&spec, &outspec);
+  stream_out = SDL_CreateAudioStream(&playspec, &outspec);
   if (!stream_out) {
     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create an audio stream for playback: %s!", SDL_GetError());
     SDL_free(devices);
@@ -97,13 +102,10 @@ void SdlAudioCodec::EnableInput(bool enable) {
     return;
   }
 
-  if (stream_in) {
-    if (enable) {
-      SDL_ResumeAudioStreamDevice(stream_in);
-    } else {
-      SDL_PauseAudioStreamDevice(stream_in);
-      SDL_FlushAudioStream(stream_in);  /* so no samples are held back for resampling purposes. */
-    }
+  /* The recording device keeps running once started: restarting it costs the first syllable, and the
+     processor keeps what is captured while the input is disabled as its pre-roll. */
+  if (stream_in && enable && SDL_AudioStreamDevicePaused(stream_in)) {
+    SDL_ResumeAudioStreamDevice(stream_in);
   }
 
   AudioCodec::EnableInput(enable);
@@ -129,14 +131,13 @@ void SdlAudioCodec::EnableOutput(bool enable) {
 }
 
 int SdlAudioCodec::Read(int16_t* dest, int samples) {
-  if (input_enabled_ && stream_in) {
+  if (stream_in) {
     int br = SDL_GetAudioStreamData(stream_in, dest, samples * 2);
     if (br < 0) {
       SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to read from input audio stream: %s", SDL_GetError());
       return 0;
     }
 
-    UIThread::update_sample_display(true, dest, br / 2);
     return br / 2;
   }
   return 0;
@@ -144,29 +145,70 @@ int SdlAudioCodec::Read(int16_t* dest, int samples) {
 
 int SdlAudioCodec::Write(const int16_t* data, int samples) {
   if (output_enabled_ && stream_out) {
-    UIThread::update_sample_display(false, data, samples);
-
+    std::lock_guard<std::mutex> lock(output_mutex_);
     if (!SDL_PutAudioStreamData(stream_out, data, samples * 2)) {
       return 0;
     }
+    if (output_history_.empty()) {
+      output_history_.resize(output_sample_rate_);
+    }
+    for (int i = 0; i < samples; i++) {
+      output_history_[(output_written_ + i) % output_history_.size()] = data[i];
+    }
+    output_written_ += samples;
     return samples;
   }
   return 0;
 }
 
-void SdlAudioCodec::SetOutputFormat(int sample_rate, int channels) {
-  if (output_enabled_) {
-    SDL_PauseAudioStreamDevice(stream_out);
-    SDL_FlushAudioStream(stream_out);
+size_t SdlAudioCodec::FlushOutput(int fade_ms) {
+  if (!stream_out) {
+    return 0;
+  }
+
+  std::lock_guard<std::mutex> lock(output_mutex_);
+  // The next reply starts at full gain
+  limiter_.Reset();
+  int queued_bytes = SDL_GetAudioStreamQueued(stream_out);
+  size_t queued = queued_bytes > 0 ? queued_bytes / 2 : 0;
+  SDL_ClearAudioStream(stream_out);
+  if (queued == 0 || queued > output_history_.size()) {
+    return queued;
   }
 
+  // Whatever the device has pulled already still plays, the ramp starts
+  // right after it
   SDL_AudioSpec spec;
-  spec.format = SDL_AUDIO_S16;
-  spec.freq = sample_rate;
-  spec.channels = channels;
-  SDL_SetAudioStreamFormat(stream_in, &spec, NULL);
+  if (!SDL_GetAudioStreamFormat(stream_out, &spec, NULL)) {
+    return queued;
+  }
+  size_t fade = std::min<size_t>(queued, (size_t)spec.freq * fade_ms / 1000);
+  if (fade == 0) {
+    return queued;
+  }
+  uint64_t start = output_written_ - queued;
+  std::vector<int16_t> ramp(fade);
+  for (size_t i = 0; i < fade; i++) {
+    ramp[i] = output_history_[(start + i) % output_history_.size()];
+  }
+  GetDspKernels().gain_ramp(ramp.data(), fade, 1.0f, 0.0f);
+  SDL_PutAudioStreamData(stream_out, ramp.data(), (int)fade * 2);
+  output_written_ = start + fade;
+  return queued - fade;
+}
 
-  if (output_enabled_) {
-    SDL_ResumeAudioStreamDevice(stream_out);
+size_t SdlAudioCodec::GetOutputQueuedSamples() {
+  if (!stream_out) {
+    return 0;
+  }
+  int queued_bytes = SDL_GetAudioStreamQueued(stream_out);
+  return queued_bytes > 0 ? queued_bytes / 2 : 0;
+}
+
+size_t SdlAudioCodec::GetInputAvailableSamples() {
+  if (!stream_in) {
+    return 0;
   }
+  int available_bytes = SDL_GetAudioStreamAvailable(stream_in);
+  return available_bytes > 0 ? available_bytes / 2 : 0;
 }
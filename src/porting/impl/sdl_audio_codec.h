@@ -2,6 +2,8 @@
 
 #include "audio_codec.h"
 #include <SDL3/SDL.h>
+#include <mutex>
+#include <vector>
 
 class SdlAudioCodec : public AudioCodec {
 public:
@@ -14,11 +16,17 @@ public:
   int Read(int16_t* dest, int samples) override;
   int Write(const int16_t* data, int samples) override;
 
-  void SetOutputFormat(int sample_rate, int channels);
+  size_t FlushOutput(int fade_ms) override;
+  size_t GetOutputQueuedSamples() override;
+  size_t GetInputAvailableSamples() override;
 
 private:
   SDL_AudioStream *stream_in = nullptr;
   SDL_AudioStream *stream_out = nullptr;
 
-  friend class SdlAudioProcessor;
+  // The last second written to stream_out, to fade out from the sample
+  // that plays next when the queue is flushed
+  std::mutex output_mutex_;
+  std::vector<int16_t> output_history_;
+  uint64_t output_written_ = 0;
 };
@@ -0,0 +1,97 @@
+#include "tcp_transport.h"
+#include <esp_log.h>
+#include <string>
+
+#define TAG "TcpTransport"
+
+namespace {
+
+constexpr int kReceivePollMs = 100;
+
+} // namespace
+
+TcpTransport::~TcpTransport() {
+  Disconnect();
+  CloseSocket();
+}
+
+void TcpTransport::CloseSocket() {
+  if (socket_ != INVALID_SOCKET) {
+    closesocket(socket_);
+    socket_ = INVALID_SOCKET;
+  }
+}
+
+bool TcpTransport::Connect(const char* host, int port) {
+  net_init();
+  CloseSocket();
+
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* result = nullptr;
+  std::string service = std::to_string(port);
+  if (getaddrinfo(host, service.c_str(), &hints, &result) != 0) {
+    ESP_LOGE(TAG, "Failed to resolve %s", host);
+    return false;
+  }
+
+  for (auto ai = result; ai != nullptr; ai = ai->ai_next) {
+    socket_ = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (socket_ == INVALID_SOCKET) {
+      continue;
+    }
+    if (connect(socket_, ai->ai_addr, (int)ai->ai_addrlen) == 0) {
+      break;
+    }
+    closesocket(socket_);
+    socket_ = INVALID_SOCKET;
+  }
+  freeaddrinfo(result);
+
+  if (socket_ == INVALID_SOCKET) {
+    ESP_LOGE(TAG, "Failed to connect to %s:%d", host, port);
+    return false;
+  }
+
+  int nodelay = 1;
+  setsockopt(socket_, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+  net_set_nosigpipe(socket_);
+  connected_ = true;
+  return true;
+}
+
+void TcpTransport::Disconnect() {
+  if (connected_.exchange(false) && socket_ != INVALID_SOCKET) {
+    shutdown(socket_, 2);
+  }
+}
+
+int TcpTransport::Send(const char* data, size_t length) {
+  if (!connected_) {
+    return -1;
+  }
+  return send(socket_, data, (int)length, NET_SEND_FLAGS);
+}
+
+size_t TcpTransport::GetSendQueueBytes() {
+  return connected_ ? net_send_queue_bytes(socket_) : 0;
+}
+
+int TcpTransport::Receive(char* buffer, size_t bufferSize) {
+  if (!connected_) {
+    return -1;
+  }
+
+  pollfd pfd{socket_, POLLIN, 0};
+  int rc = poll(&pfd, 1, kReceivePollMs);
+  if (rc == 0 || (rc < 0 && net_last_error() == EINTR)) {
+    return 0;
+  }
+  if (rc < 0 || !connected_) {
+    return -1;
+  }
+
+  int bytes = recv(socket_, buffer, (int)bufferSize, 0);
+  return bytes > 0 ? bytes : -1;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "transport.h"
+#include "net_socket.h"
+
+class TcpTransport : public Transport {
+public:
+  ~TcpTransport() override;
+
+  bool Connect(const char* host, int port) override;
+  void Disconnect() override;
+  int Send(const char* data, size_t length) override;
+  // Returns 0 when nothing arrived within the poll interval, -1 once closed
+  int Receive(char* buffer, size_t bufferSize) override;
+  size_t GetSendQueueBytes() override;
+
+private:
+  // Only replaced by Connect and the destructor, when no thread is in
+  // Receive. Disconnect shuts the socket down, which wakes a pending
+  // poll or recv, and leaves closing it to them, so the fd number cannot
+  // be reused under a receive that is still running.
+  SOCKET socket_ = INVALID_SOCKET;
+
+  void CloseSocket();
+};
@@ -0,0 +1,208 @@
+#include "tls_transport.h"
+#include "net_socket.h"
+#include <esp_log.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#if defined(MBEDTLS_PSA_CRYPTO_C)
+#include <psa/crypto.h>
+#endif
+
+#define TAG "TlsTransport"
+
+namespace {
+
+constexpr int kReceivePollMs = 100;
+// A peer that takes no data for this long is treated as gone
+constexpr int kSendTimeoutMs = 5000;
+
+bool WaitSocket(int fd, short events, int timeout_ms) {
+  pollfd pfd{(SOCKET)fd, events, 0};
+  return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+// mbedtls_net_send without SIGPIPE when the server has gone away
+int NetSend(void* context, const unsigned char* data, size_t length) {
+  int fd = ((mbedtls_net_context*)context)->fd;
+  if (fd < 0) {
+    return MBEDTLS_ERR_NET_INVALID_CONTEXT;
+  }
+  int ret = (int)send((SOCKET)fd, (const char*)data, (int)length, NET_SEND_FLAGS);
+  if (ret >= 0) {
+    return ret;
+  }
+  int error = net_last_error();
+  if (error == EAGAIN || error == EWOULDBLOCK || error == EINTR) {
+    return MBEDTLS_ERR_SSL_WANT_WRITE;
+  }
+  if (error == EPIPE || error == ECONNRESET) {
+    return MBEDTLS_ERR_NET_CONN_RESET;
+  }
+  return MBEDTLS_ERR_NET_SEND_FAILED;
+}
+
+} // namespace
+
+TlsTransport::TlsTransport() {
+  mbedtls_net_init(&net_);
+  mbedtls_ssl_init(&ssl_);
+  mbedtls_ssl_config_init(&conf_);
+  mbedtls_entropy_init(&entropy_);
+  mbedtls_ctr_drbg_init(&ctr_drbg_);
+}
+
+TlsTransport::~TlsTransport() {
+  Disconnect();
+  mbedtls_net_free(&net_);
+  mbedtls_ssl_free(&ssl_);
+  mbedtls_ssl_config_free(&conf_);
+  mbedtls_ctr_drbg_free(&ctr_drbg_);
+  mbedtls_entropy_free(&entropy_);
+}
+
+bool TlsTransport::Connect(const char* host, int port) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  net_init();
+
+#if defined(MBEDTLS_PSA_CRYPTO_C)
+  psa_crypto_init();
+#endif
+  mbedtls_net_free(&net_);
+  // A clean context, a previous session may have ended in the middle of
+  // a record
+  mbedtls_ssl_free(&ssl_);
+  mbedtls_ssl_init(&ssl_);
+
+  int ret = mbedtls_ctr_drbg_seed(&ctr_drbg_, mbedtls_entropy_func, &entropy_, nullptr, 0);
+  if (ret != 0) {
+    ESP_LOGE(TAG, "Failed to seed rng: -0x%x", -ret);
+    return false;
+  }
+
+  std::string service = std::to_string(port);
+  ret = mbedtls_net_connect(&net_, host, service.c_str(), MBEDTLS_NET_PROTO_TCP);
+  if (ret != 0) {
+    ESP_LOGE(TAG, "Failed to connect to %s:%d: -0x%x", host, port, -ret);
+    return false;
+  }
+
+  mbedtls_ssl_config_defaults(&conf_, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+  // Same policy as the HTTP and MQTT clients, no server certificate check
+  mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_NONE);
+  mbedtls_ssl_conf_rng(&conf_, mbedtls_ctr_drbg_random, &ctr_drbg_);
+
+  ret = mbedtls_ssl_setup(&ssl_, &conf_);
+  if (ret != 0) {
+    ESP_LOGE(TAG, "Failed to setup ssl: -0x%x", -ret);
+    mbedtls_net_free(&net_);
+    return false;
+  }
+  mbedtls_ssl_set_hostname(&ssl_, host);
+  mbedtls_ssl_set_bio(&ssl_, &net_, NetSend, mbedtls_net_recv, nullptr);
+
+  while ((ret = mbedtls_ssl_handshake(&ssl_)) != 0) {
+    if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      ESP_LOGE(TAG, "TLS handshake failed: -0x%x", -ret);
+      mbedtls_ssl_session_reset(&ssl_);
+      mbedtls_net_free(&net_);
+      return false;
+    }
+  }
+
+  int nodelay = 1;
+  setsockopt((SOCKET)net_.fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+  net_set_nosigpipe((SOCKET)net_.fd);
+  mbedtls_net_set_nonblock(&net_);
+  connected_ = true;
+  return true;
+}
+
+// Like TcpTransport, without the lock: a Send stuck on a stalled peer
+// holds it, and the shutdown is what wakes it up. The close_notify is only
+// sent when no one is using the context.
+void TlsTransport::Disconnect() {
+  if (!connected_.exchange(false)) {
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+    if (lock.owns_lock()) {
+      mbedtls_ssl_close_notify(&ssl_);
+    }
+  }
+  shutdown((SOCKET)net_.fd, 2);
+}
+
+int TlsTransport::Send(const char* data, size_t length) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(kSendTimeoutMs);
+  size_t sent = 0;
+  while (sent < length) {
+    if (!connected_) {
+      return -1;
+    }
+    int ret = mbedtls_ssl_write(&ssl_, (const unsigned char*)data + sent, length - sent);
+    if (ret > 0) {
+      sent += ret;
+    } else if (ret == MBEDTLS_ERR_SSL_WANT_WRITE || ret == MBEDTLS_ERR_SSL_WANT_READ) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+      if (left.count() <= 0) {
+        // Half a record is out, the stream cannot be continued
+        ESP_LOGE(TAG, "ssl write timed out after %d ms", kSendTimeoutMs);
+        if (connected_.exchange(false)) {
+          shutdown((SOCKET)net_.fd, 2);
+        }
+        return -1;
+      }
+      WaitSocket(net_.fd, ret == MBEDTLS_ERR_SSL_WANT_WRITE ? POLLOUT : POLLIN,
+          std::min<int>(kReceivePollMs, (int)left.count()));
+    } else {
+      ESP_LOGE(TAG, "ssl write failed: -0x%x", -ret);
+      return -1;
+    }
+  }
+  return (int)sent;
+}
+
+// Without the lock, a blocked write must not stall the caller. The fd
+// only changes in Connect and the destructor.
+size_t TlsTransport::GetSendQueueBytes() {
+  return connected_ ? net_send_queue_bytes((SOCKET)net_.fd) : 0;
+}
+
+int TlsTransport::Receive(char* buffer, size_t bufferSize) {
+  int fd;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!connected_) {
+      return -1;
+    }
+    fd = net_.fd;
+    if (mbedtls_ssl_get_bytes_avail(&ssl_) > 0) {
+      fd = -1;
+    }
+  }
+
+  // Wait for data without holding the lock, senders must not be stalled
+  if (fd >= 0 && !WaitSocket(fd, POLLIN, kReceivePollMs)) {
+    return 0;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!connected_) {
+    return -1;
+  }
+  int ret = mbedtls_ssl_read(&ssl_, (unsigned char*)buffer, bufferSize);
+  if (ret > 0) {
+    return ret;
+  }
+  if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    return 0;
+  }
+#if defined(MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET)
+  if (ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) {
+    return 0;
+  }
+#endif
+  return -1;
+}
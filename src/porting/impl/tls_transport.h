@@ -0,0 +1,34 @@
+#pragma once
+#include "transport.h"
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mutex>
+
+class TlsTransport : public Transport {
+public:
+  TlsTransport();
+  ~TlsTransport() override;
+
+  bool Connect(const char* host, int port) override;
+  void Disconnect() override;
+  int Send(const char* data, size_t length) override;
+  // Returns 0 when nothing arrived within the poll interval, -1 once closed
+  int Receive(char* buffer, size_t bufferSize) override;
+  size_t GetSendQueueBytes() override;
+
+private:
+  // Disconnect only shuts the socket down, without the lock, it is freed
+  // by Connect and the destructor, when no thread can still be waiting on
+  // it in Receive or Send
+  //
+  // The ssl context is not thread safe, the socket is non-blocking after the
+  // handshake so neither direction holds the lock while waiting for data
+  std::mutex mutex_;
+  mbedtls_net_context net_;
+  mbedtls_ssl_context ssl_;
+  mbedtls_ssl_config conf_;
+  mbedtls_entropy_context entropy_;
+  mbedtls_ctr_drbg_context ctr_drbg_;
+};
@@ -1,15 +1,26 @@
 #include "udp_client.h"
+#include "reactor.h"
+#include "metrics.h"
 
 namespace {
 
-void init() {
-  static bool inited = false;
-  if (!inited) {
-    inited = true;
-    WORD winsockVer = 0x0202;
-    WSADATA wsd;
-    WSAStartup(winsockVer, &wsd);
-  }
+// Stale audio is worthless, the oldest datagrams are dropped beyond this
+constexpr size_t kMaxSendQueue = 32;
+
+struct UdpMetrics {
+  Counter& deferred = Metrics::GetInstance().GetCounter("xiaozhi_udp_send_deferred_total",
+      "Datagrams queued because the socket buffer was full.");
+  Counter& dropped = Metrics::GetInstance().GetCounter("xiaozhi_udp_send_dropped_total",
+      "Queued datagrams dropped for newer ones.");
+  Counter& errors = Metrics::GetInstance().GetCounter("xiaozhi_udp_send_errors_total",
+      "Datagrams the socket refused.");
+  Gauge& queued = Metrics::GetInstance().GetGauge("xiaozhi_udp_send_queue_datagrams",
+      "Datagrams waiting for the socket to become writable.");
+};
+
+UdpMetrics& udp_metrics() {
+  static UdpMetrics metrics;
+  return metrics;
 }
 
 }
@@ -28,7 +39,7 @@ message arrival: {
 "port":8846,"encryption":"aes-128-ctr","key":"0585a874cc7cde39af478c7c634c3bcb","nonce":"010000005cfd85170000000000000000"},"audio_params":{"format":"opus","sample_rate":24000,"channels":1,"frame_duration":60}}
 */
 bool UdpClient::Connect(const std::string& host, int port) {
-  init();
+  net_init();
 
   std::lock_guard<std::mutex> lock(mutex_);
   if (connected_) return true;
@@ -39,61 +50,111 @@ bool UdpClient::Connect(const std::string& host, int port) {
     return false;
   }
 
-        // Configure server address
+  // Configure server address
   server_addr_.sin_family = AF_INET;
   server_addr_.sin_port = htons(port);
   if (inet_pton(AF_INET, host.c_str(), &server_addr_.sin_addr) <= 0) {
     closesocket(socket_);
+    socket_ = INVALID_SOCKET;
     return false;
   }
 
-  int rc = connect(socket_, (struct sockaddr *)&server_addr_, sizeof(server_addr_));
+  connect(socket_, (struct sockaddr *)&server_addr_, sizeof(server_addr_));
+  net_set_nonblocking(socket_);
 
-  // Start receiver thread
+  // Receive on the shared reactor thread instead of a thread per session
   connected_ = true;
-  receiver_thread_ = std::thread(&UdpClient::ReceiveLoop, this);
+  Reactor::GetInstance().Add(socket_, POLLIN, [this](short revents) {
+    if (revents & POLLOUT) {
+      OnWritable();
+    }
+    if (revents & ~POLLOUT) {
+      OnReadable();
+    }
+  });
   return true;
 }
 
 void UdpClient::Disconnect() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (!connected_) return;
-
-  connected_ = false;
-        
-        // Close socket to interrupt blocking recvfrom
-  if (socket_ != INVALID_SOCKET) {
-    closesocket(socket_);
+  SOCKET s;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!connected_) return;
+    connected_ = false;
+    s = socket_;
     socket_ = INVALID_SOCKET;
+    udp_metrics().queued.Add(-(double)send_queue_.size());
+    send_queue_.clear();
   }
 
-  if (receiver_thread_.joinable()) {
-    receiver_thread_.join();
-  }
+  // Must not hold mutex_ here, the receive callback may be waiting on it
+  Reactor::GetInstance().Remove(s);
+  closesocket(s);
 }
 
 int UdpClient::Send(const std::string& data) {
   std::lock_guard<std::mutex> lock(mutex_);
-  if (!connected_ || socket_ == -1) return -1;
-
-  int sent = sendto(socket_, 
-                            data.data(), 
-                            static_cast<int>(data.size()), 
-                            0,
-                            reinterpret_cast<sockaddr*>(&server_addr_),
-                            sizeof(server_addr_));
-        
-  return sent;
+  if (!connected_ || socket_ == INVALID_SOCKET) return -1;
+
+  if (send_queue_.empty()) {
+    int sent = send(socket_,
+                    data.data(),
+                    static_cast<int>(data.size()),
+                    0);
+    if (sent >= 0) {
+      return sent;
+    }
+    int err = net_last_error();
+    if (err != EWOULDBLOCK && err != EAGAIN) {
+      udp_metrics().errors.Increment();
+      return -1;
+    }
+  }
+
+  // The socket buffer is full, keep the datagram until it becomes writable
+  auto& metrics = udp_metrics();
+  metrics.deferred.Increment();
+  if (send_queue_.size() >= kMaxSendQueue) {
+    send_queue_.pop_front();
+    metrics.dropped.Increment();
+  } else {
+    metrics.queued.Add(1);
+  }
+  send_queue_.push_back(data);
+  Reactor::GetInstance().Modify(socket_, POLLIN | POLLOUT);
+  return static_cast<int>(data.size());
+}
+
+size_t UdpClient::GetSendQueueSize() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return send_queue_.size();
 }
 
-void UdpClient::ReceiveLoop() {
+void UdpClient::OnWritable() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!connected_) return;
+
+  while (!send_queue_.empty()) {
+    const auto& data = send_queue_.front();
+    int sent = send(socket_, data.data(), static_cast<int>(data.size()), 0);
+    if (sent < 0) {
+      int err = net_last_error();
+      if (err == EWOULDBLOCK || err == EAGAIN) {
+        return;
+      }
+      udp_metrics().errors.Increment();
+    }
+    send_queue_.pop_front();
+    udp_metrics().queued.Add(-1);
+  }
+  Reactor::GetInstance().Modify(socket_, POLLIN);
+}
+
+void UdpClient::OnReadable() {
   char buffer[4096]; // Max UDP payload size
-        
+
+  // Drain everything that is queued, the socket is non-blocking
   while (true) {
-    sockaddr_in from_addr{};
-    socklen_t from_len = sizeof(from_addr);
-            
-    // Use mutex-protected socket descriptor
     SOCKET current_socket;
     {
       std::lock_guard<std::mutex> lock(mutex_);
@@ -101,28 +162,15 @@ void UdpClient::ReceiveLoop() {
       current_socket = socket_;
     }
 
-    int bytes = recv(current_socket,
-                                   buffer,
-                                   sizeof(buffer),
-                                   0);
-
-    {
-      std::lock_guard<std::mutex> lock(mutex_);
-      if (!connected_) break;
-    }
-
+    int bytes = recv(current_socket, buffer, sizeof(buffer), 0);
     if (bytes > 0) {
       if (message_callback_) {
         message_callback_(std::string(buffer, bytes));
       }
-    } else if (bytes == -1) {
-        if (errno == EBADF) break; // Socket closed
-        if (errno == EINTR) continue; // Interrupted
-        break; // Other errors
+    } else if (bytes < 0 && net_last_error() == EINTR) {
+      continue;
+    } else {
+      break;
     }
   }
-
-  // Ensure clean shutdown
-  std::lock_guard<std::mutex> lock(mutex_);
-  connected_ = false;
 }
@@ -5,7 +5,12 @@
 #include <mutex>
 #include <vector>
 #include <atomic>
+#include <algorithm>
+#include <climits>
+#include <cstring>
 #include "application.h"
+#include "trace.h"
+#include "audio_codec.h"
 
 namespace {
 
@@ -31,62 +36,83 @@ constexpr int wheight_ = HEIGHT;
 std::atomic<bool> output_enabled = false;
 std::atomic<bool> input_enabled = false;
 
+constexpr int UI_FPS = 30;
+
 /* NOTE: the size must be big enough to compensate the hardware audio buffersize size */
   /* TODO: We assume that a decoded and resampled frame fits into this buffer */
 #define SAMPLE_ARRAY_SIZE (4 * 65536)
-std::vector<int16_t> sample_array_in_(SAMPLE_ARRAY_SIZE);
-std::vector<int16_t> sample_array_out_(SAMPLE_ARRAY_SIZE);
-
-int sample_array_index_ = 0;
 
-std::mutex sample_mtx;
-
-int compute_mod(int a, int b) {
-  return a < 0 ? a%b + b : a%b;
+// History shown by the renderer, one per direction. Only the UI thread
+// touches them, the audio threads hand their samples over through taps.
+struct SampleRing {
+  std::vector<int16_t> samples = std::vector<int16_t>(SAMPLE_ARRAY_SIZE);
+  int write_index = 0;
+};
+
+SampleRing ring_out_;
+SampleRing ring_in_;
+
+// About half a second of audio, the UI drains them every frame
+constexpr size_t TAP_CAPACITY = 16384;
+
+std::shared_ptr<AudioTap> tap_in_;
+std::shared_ptr<AudioTap> tap_out_;
+std::atomic<bool> taps_attached = false;
+
+void DrainTap(AudioTap& tap, SampleRing& ring) {
+  const int ring_size = (int)ring.samples.size();
+  while (true) {
+    size_t n = tap.Pop(&ring.samples[ring.write_index], ring_size - ring.write_index);
+    if (n == 0)
+      break;
+    ring.write_index += (int)n;
+    if (ring.write_index >= ring_size)
+      ring.write_index = 0;
+  }
 }
 
-void fill_rectangle(SDL_Renderer *renderer, int x, int y, int w, int h) {
-  SDL_FRect rect;
-  rect.x = x;
-  rect.y = y;
-  rect.w = w;
-  rect.h = h;
-  if (w && h)
-    SDL_RenderFillRect(renderer, &rect);
+// Samples between the write position and the displayed window
+constexpr int DISPLAY_DELAY = AUDIO_OUT_BUF_SIZE / (2 * CHANNELS) + 2 * WIDTH;
+// How far back a rising zero crossing is searched to keep the wave steady
+constexpr int TRIGGER_SEARCH = 1000;
+constexpr int SNAPSHOT_SIZE = DISPLAY_DELAY + TRIGGER_SEARCH;
+
+// Copy the SNAPSHOT_SIZE samples that end at the write index
+void TakeSnapshot(const SampleRing& ring, int16_t* snapshot) {
+  const int size = (int)ring.samples.size();
+  int start = ring.write_index - SNAPSHOT_SIZE;
+  if (start < 0)
+    start += size;
+
+  int len = std::min(SNAPSHOT_SIZE, size - start);
+  memcpy(snapshot, &ring.samples[start], len * sizeof(int16_t));
+  memcpy(snapshot + len, &ring.samples[0], (SNAPSHOT_SIZE - len) * sizeof(int16_t));
 }
 
 void AudioDisplay(bool input) {
-  std::lock_guard lk(sample_mtx);
+  static int16_t snapshot[SNAPSHOT_SIZE];
+  static std::vector<SDL_FRect> rects;
 
-  int i, i_start =0, x, y, y1, ys, delay, n, nb_display_channels;
-  int ch, channels, h, h2;
+  int i, i_start, x, y, y1, ys;
+  int ch, h, h2;
 
   const int ytop = input ? (ytop_ + wheight_ / 2) : ytop_;
   const int wheight = wheight_ / 2;
-  const std::vector<int16_t> *sample_array = input ? &sample_array_in_ : &sample_array_out_;
+  const int nb_display_channels = CHANNELS;
 
-  /* compute display index : center on currently output samples */
-  channels = CHANNELS;
-  nb_display_channels = channels;
+  TakeSnapshot(input ? ring_in_ : ring_out_, snapshot);
 
+  /* compute display index : center on currently output samples */
+  i_start = SNAPSHOT_SIZE - WIDTH * CHANNELS;
   if (output_enabled) {
-    int data_used = WIDTH;
-    n = 2 * channels;
-    delay = AUDIO_OUT_BUF_SIZE;
-    delay /= n;
-
-    delay += 2 * data_used;
-    if (delay < data_used)
-      delay = data_used;
-
-    i_start = x = compute_mod(sample_array_index_ - delay * channels, sample_array->size());
+    i_start = x = TRIGGER_SEARCH;
     h = INT_MIN;
-    for (i = 0; i < 1000; i += channels) {
-      int idx = (sample_array->size() + x - i) % sample_array->size();
-      int a = (*sample_array)[idx];
-      int b = (*sample_array)[(idx + 4 * channels) % sample_array->size()];
-      int c = (*sample_array)[(idx + 5 * channels) % sample_array->size()];
-      int d = (*sample_array)[(idx + 9 * channels) % sample_array->size()];
+    for (i = 0; i < TRIGGER_SEARCH; i += CHANNELS) {
+      int idx = x - i;
+      int a = snapshot[idx];
+      int b = snapshot[idx + 4 * CHANNELS];
+      int c = snapshot[idx + 5 * CHANNELS];
+      int d = snapshot[idx + 9 * CHANNELS];
       int score = a - d;
       if (h < score && (b ^ c) < 0) {
         h = score;
@@ -95,43 +121,45 @@ void AudioDisplay(bool input) {
     }
   }
 
-  if (input)
-    SDL_SetRenderDrawColor(renderer, 0, 0, 255, 255);
-  else
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-
   /* total height for one channel */
   h = wheight / nb_display_channels;
 
   /* graph height / 2 */
   h2 = (h * 9) / 20;
+
+  // All columns go out in a single draw call
+  rects.clear();
   for (ch = 0; ch < nb_display_channels; ch++) {
     i = i_start + ch;
     y1 = ytop + ch * h + (h / 2); /* position of center line */
     for (x = 0; x < WIDTH; x++) {
-      y = ((*sample_array)[i] * h2) >> 15;
+      y = (snapshot[i] * h2) >> 15;
       if (y < 0) {
         y = -y;
         ys = y1 - y;
       } else {
         ys = y1;
       }
-      fill_rectangle(renderer, xleft_ + x, ys, 1, y);
-      i += channels;
-      if (i >= sample_array->size())
-        i -= sample_array->size();
+      if (y) {
+        rects.push_back({(float)(xleft_ + x), (float)ys, 1.0f, (float)y});
+      }
+      i += CHANNELS;
     }
   }
-
-  SDL_SetRenderDrawColor(renderer, 0, 0, 255, 255);
-
   for (ch = 1; ch < nb_display_channels; ch++) {
-    y = ytop + ch * h;
-    fill_rectangle(renderer, xleft_, y, WIDTH, 1);
+    rects.push_back({(float)xleft_, (float)(ytop + ch * h), (float)WIDTH, 1.0f});
   }
+
+  if (input)
+    SDL_SetRenderDrawColor(renderer, 0, 0, 255, 255);
+  else
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+  if (!rects.empty())
+    SDL_RenderFillRects(renderer, rects.data(), (int)rects.size());
 }
 
 void ui_routine() {
+  Tracer::SetThreadName("ui");
   if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO)) {
     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't initialize SDL: %s", SDL_GetError());
     
@@ -164,12 +192,29 @@ void ui_routine() {
   SDL_RenderClear(renderer);
   SDL_RenderPresent(renderer);
 
+  // Present at most UI_FPS frames, in step with the display when vsync works
+  if (!SDL_SetRenderVSync(renderer, 1)) {
+    SDL_Log("VSync not available, limiting the UI to %d fps", UI_FPS);
+  }
+
+  const Uint64 frame_ns = SDL_NS_PER_SECOND / UI_FPS;
+  Uint64 next_frame = SDL_GetTicksNS();
+  int last_in_index = -1;
+  int last_out_index = -1;
+  bool last_input_enabled = false;
+  bool dirty = true;
   bool running = true;
   while (running) {
+    // Sleep in the event queue until the next frame is due
+    Uint64 now = SDL_GetTicksNS();
+    int timeout_ms = next_frame > now ? (int)((next_frame - now + SDL_NS_PER_MS - 1) / SDL_NS_PER_MS) : 0;
     SDL_Event event;
-    while(SDL_PollEvent(&event) != 0) {
+    bool has_event = SDL_WaitEventTimeout(&event, timeout_ms);
+    while (has_event) {
       if(event.type == SDL_EVENT_QUIT)
         running = false;
+      else if(event.type == SDL_EVENT_WINDOW_EXPOSED || event.type == SDL_EVENT_WINDOW_RESIZED)
+        dirty = true;
       else if(event.type == SDL_EVENT_KEY_DOWN) {
         if (event.key.key == SDLK_ESCAPE) {
           running = false;
@@ -181,9 +226,36 @@ void ui_routine() {
           Application::GetInstance().AbortSpeaking();
         }
       }
+      has_event = SDL_PollEvent(&event);
     }
 
-    if (input_enabled) {
+    now = SDL_GetTicksNS();
+    if (now < next_frame) {
+      continue;
+    }
+    next_frame += frame_ns;
+    if (next_frame <= now) {
+      next_frame = now + frame_ns;
+    }
+
+    if (taps_attached.load(std::memory_order_acquire)) {
+      DrainTap(*tap_in_, ring_in_);
+      DrainTap(*tap_out_, ring_out_);
+    }
+
+    // Nothing is drawn while no audio flows and the state is unchanged
+    int in_index = ring_in_.write_index;
+    int out_index = ring_out_.write_index;
+    if (!dirty && in_index == last_in_index && out_index == last_out_index &&
+        input_enabled == last_input_enabled) {
+      continue;
+    }
+    last_in_index = in_index;
+    last_out_index = out_index;
+    last_input_enabled = input_enabled;
+    dirty = false;
+
+    if (last_input_enabled) {
       SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
     } else {
       SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
@@ -215,22 +287,10 @@ void UIThread::update_output_enable(bool b) {
   output_enabled = b;
 }
 
-void UIThread::update_sample_display(bool input, const int16_t *samples, int size) {
-  std::lock_guard lk(sample_mtx);
-
-  std::vector<int16_t> *sample_array = input ? &sample_array_in_ : &sample_array_out_;
-
-  while (size > 0) {
-    int len = sample_array->size() - sample_array_index_;
-    if (len > size)
-      len = size;
-    memcpy(&((*sample_array)[0]) + sample_array_index_, samples, len * sizeof(int16_t));
-    samples += len;
-    sample_array_index_ += len;
-    if (sample_array_index_ >= sample_array->size())
-      sample_array_index_ = 0;
-    size -= len;
-  }
+void UIThread::attach_audio(AudioCodec* codec) {
+  tap_in_ = codec->AddTap(AudioTap::kInput, TAP_CAPACITY);
+  tap_out_ = codec->AddTap(AudioTap::kOutput, TAP_CAPACITY);
+  taps_attached.store(true, std::memory_order_release);
 }
 
 bool UIThread::start() {
@@ -1,10 +1,13 @@
 #pragma once
 #include <cstdint>
 
+class AudioCodec;
+
 class UIThread {
 public:
   static bool start();
   static void update_input_enable(bool);
   static void update_output_enable(bool);
-  static void update_sample_display(bool input, const int16_t *samples, int size);
+  // Show the waveforms of the codec, fed through its audio taps
+  static void attach_audio(AudioCodec* codec);
 };
@@ -0,0 +1,444 @@
+#include "web_socket.h"
+#include "trace.h"
+#include <esp_log.h>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <string_view>
+
+#define TAG "WebSocket"
+
+namespace {
+
+constexpr int kHandshakeTimeoutMs = 10000;
+// Frames larger than this are treated as a protocol error
+constexpr size_t kMaxFrameSize = 1024 * 1024;
+
+enum Opcode : uint8_t {
+  kOpContinuation = 0x0,
+  kOpText = 0x1,
+  kOpBinary = 0x2,
+  kOpClose = 0x8,
+  kOpPing = 0x9,
+  kOpPong = 0xA,
+};
+
+std::string Base64Encode(const uint8_t* data, size_t len) {
+  static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  out.reserve((len + 2) / 3 * 4);
+  for (size_t i = 0; i < len; i += 3) {
+    uint32_t n = data[i] << 16;
+    if (i + 1 < len) n |= data[i + 1] << 8;
+    if (i + 2 < len) n |= data[i + 2];
+    out.push_back(table[(n >> 18) & 0x3F]);
+    out.push_back(table[(n >> 12) & 0x3F]);
+    out.push_back(i + 1 < len ? table[(n >> 6) & 0x3F] : '=');
+    out.push_back(i + 2 < len ? table[n & 0x3F] : '=');
+  }
+  return out;
+}
+
+} // namespace
+
+WebSocket::WebSocket(Transport *transport) : transport_(transport) {
+  std::random_device rd;
+  mask_seed_ = rd() | 1;
+}
+
+WebSocket::~WebSocket() {
+  Close();
+  delete transport_;
+}
+
+void WebSocket::SetHeader(const char* key, const char* value) {
+  headers_[key] = value;
+}
+
+void WebSocket::SetReceiveBufferSize(size_t size) {
+  receive_buffer_size_ = size;
+}
+
+bool WebSocket::IsConnected() const {
+  return transport_->connected() && !closing_;
+}
+
+bool WebSocket::Connect(const char* uri) {
+  std::string url(uri);
+  std::string host;
+  std::string path = "/";
+  int port = 80;
+
+  size_t host_start = 0;
+  if (url.compare(0, 6, "wss://") == 0) {
+    host_start = 6;
+    port = 443;
+  } else if (url.compare(0, 5, "ws://") == 0) {
+    host_start = 5;
+  } else {
+    ESP_LOGE(TAG, "Invalid websocket url: %s", uri);
+    return false;
+  }
+
+  size_t path_start = url.find('/', host_start);
+  host = url.substr(host_start, path_start == std::string::npos ? std::string::npos : path_start - host_start);
+  if (path_start != std::string::npos) {
+    path = url.substr(path_start);
+  }
+  std::string host_header = host;
+  size_t colon = host.find(':');
+  if (colon != std::string::npos) {
+    port = std::stoi(host.substr(colon + 1));
+    host = host.substr(0, colon);
+  }
+
+  // A previous connection must be fully torn down before reusing the buffers
+  if (receive_thread_.joinable()) {
+    receive_thread_.join();
+  }
+
+  closing_ = false;
+  if (!transport_->Connect(host.c_str(), port)) {
+    ESP_LOGE(TAG, "Failed to connect to %s:%d", host.c_str(), port);
+    return false;
+  }
+
+  uint8_t key[16];
+  std::random_device rd;
+  for (auto& b : key) {
+    b = static_cast<uint8_t>(rd());
+  }
+
+  std::string request = "GET " + path + " HTTP/1.1\r\n";
+  request += "Host: " + host_header + "\r\n";
+  request += "Upgrade: websocket\r\n";
+  request += "Connection: Upgrade\r\n";
+  request += "Sec-WebSocket-Key: " + Base64Encode(key, sizeof(key)) + "\r\n";
+  request += "Sec-WebSocket-Version: 13\r\n";
+  for (const auto& header : headers_) {
+    request += header.first + ": " + header.second + "\r\n";
+  }
+  request += "\r\n";
+  if (!SendAllRaw(request.data(), request.size())) {
+    transport_->Disconnect();
+    return false;
+  }
+
+  // One extra byte so a payload can always be NUL terminated in place
+  receive_buffer_.resize(receive_buffer_size_ + 1);
+  received_ = 0;
+  fragments_.clear();
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(kHandshakeTimeoutMs);
+  size_t header_end = std::string::npos;
+  while (header_end == std::string::npos) {
+    if (std::chrono::steady_clock::now() > deadline || received_ + 1 >= receive_buffer_.size()) {
+      ESP_LOGE(TAG, "Failed to receive handshake response");
+      transport_->Disconnect();
+      return false;
+    }
+    int n = transport_->Receive(&receive_buffer_[received_], receive_buffer_.size() - 1 - received_);
+    if (n < 0) {
+      ESP_LOGE(TAG, "Connection closed during handshake");
+      transport_->Disconnect();
+      return false;
+    }
+    received_ += n;
+    std::string_view response(receive_buffer_.data(), received_);
+    header_end = response.find("\r\n\r\n");
+  }
+
+  std::string_view response(receive_buffer_.data(), header_end);
+  if (response.compare(0, 12, "HTTP/1.1 101") != 0) {
+    ESP_LOGE(TAG, "Handshake rejected: %.*s", (int)response.find("\r\n"), response.data());
+    transport_->Disconnect();
+    return false;
+  }
+
+  // Keep the bytes after the response header, they belong to the first frames
+  header_end += 4;
+  received_ -= header_end;
+  memmove(receive_buffer_.data(), receive_buffer_.data() + header_end, received_);
+
+  receive_thread_ = std::thread(&WebSocket::ReceiveTask, this);
+
+  if (on_connected_) {
+    on_connected_();
+  }
+  return true;
+}
+
+bool WebSocket::Send(const std::string& data) {
+  return Send(data.data(), data.size(), false, true);
+}
+
+bool WebSocket::Send(const void* data, size_t len, bool binary, bool fin) {
+  uint8_t opcode = continuation_ ? kOpContinuation : (binary ? kOpBinary : kOpText);
+  continuation_ = !fin;
+  return SendFrame(opcode, fin, nullptr, 0, data, len);
+}
+
+bool WebSocket::Send(const void* prefix, size_t prefix_len, const void* data, size_t len, bool binary) {
+  uint8_t opcode = continuation_ ? kOpContinuation : (binary ? kOpBinary : kOpText);
+  continuation_ = false;
+  return SendFrame(opcode, true, prefix, prefix_len, data, len);
+}
+
+size_t WebSocket::GetSendQueueBytes() {
+  return transport_->GetSendQueueBytes();
+}
+
+void WebSocket::Ping() {
+  SendControlFrame(kOpPing, nullptr, 0);
+}
+
+void WebSocket::Close() {
+  if (!closing_.exchange(true) && transport_->connected()) {
+    SendControlFrame(kOpClose, nullptr, 0);
+  }
+  transport_->Disconnect();
+
+  if (receive_thread_.joinable()) {
+    if (receive_thread_.get_id() == std::this_thread::get_id()) {
+      receive_thread_.detach();
+    } else {
+      receive_thread_.join();
+    }
+  }
+}
+
+void WebSocket::OnConnected(std::function<void()> callback) {
+  on_connected_ = callback;
+}
+
+void WebSocket::OnDisconnected(std::function<void()> callback) {
+  on_disconnected_ = callback;
+}
+
+void WebSocket::OnData(std::function<void(const char*, size_t, bool binary)> callback) {
+  on_data_ = callback;
+}
+
+void WebSocket::OnError(std::function<void(int)> callback) {
+  on_error_ = callback;
+}
+
+void WebSocket::OnPong(std::function<void()> callback) {
+  on_pong_ = callback;
+}
+
+bool WebSocket::SendAllRaw(const void* data, size_t len) {
+  auto ptr = static_cast<const char*>(data);
+  while (len > 0) {
+    int sent = transport_->Send(ptr, len);
+    if (sent <= 0) {
+      return false;
+    }
+    ptr += sent;
+    len -= sent;
+  }
+  return true;
+}
+
+bool WebSocket::SendControlFrame(uint8_t opcode, const void* data, size_t len) {
+  if (len > 125) {
+    len = 125;
+  }
+  return SendFrame(opcode, true, nullptr, 0, data, len);
+}
+
+void WebSocket::MaskCopy(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t* mask, size_t offset) {
+  // The mask continues from where the previous part left off
+  uint8_t rotated[4];
+  for (int i = 0; i < 4; i++) {
+    rotated[i] = mask[(offset + i) & 3];
+  }
+  uint64_t mask64;
+  memcpy(&mask64, rotated, 4);
+  memcpy(reinterpret_cast<uint8_t*>(&mask64) + 4, rotated, 4);
+  // Eight bytes at a time
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t v;
+    memcpy(&v, src + i, 8);
+    v ^= mask64;
+    memcpy(dst + i, &v, 8);
+  }
+  for (; i < len; i++) {
+    dst[i] = src[i] ^ rotated[i & 3];
+  }
+}
+
+bool WebSocket::SendFrame(uint8_t opcode, bool fin, const void* prefix, size_t prefix_len, const void* data, size_t len) {
+  std::lock_guard<std::mutex> lock(send_mutex_);
+  if (!transport_->connected()) {
+    return false;
+  }
+
+  // Header, mask and payload are assembled into one reused buffer so each
+  // frame is a single transport write (a single TLS record) without any
+  // allocation once the buffer has grown to the usual frame size. The
+  // payload may come in two parts, e.g. a protocol header and the audio,
+  // and each byte is only touched once, by the masking copy.
+  size_t total = prefix_len + len;
+  size_t header = 2 + 4;
+  if (total > 0xFFFF) {
+    header += 8;
+  } else if (total >= 126) {
+    header += 2;
+  }
+  send_buffer_.resize(header + total);
+  uint8_t* p = send_buffer_.data();
+
+  p[0] = (fin ? 0x80 : 0x00) | opcode;
+  size_t pos = 2;
+  if (total > 0xFFFF) {
+    p[1] = 0x80 | 127;
+    for (int i = 0; i < 8; i++) {
+      p[pos++] = static_cast<uint8_t>((uint64_t)total >> (56 - 8 * i));
+    }
+  } else if (total >= 126) {
+    p[1] = 0x80 | 126;
+    p[pos++] = static_cast<uint8_t>(total >> 8);
+    p[pos++] = static_cast<uint8_t>(total);
+  } else {
+    p[1] = 0x80 | static_cast<uint8_t>(total);
+  }
+
+  // xorshift is plenty for masking, it only has to be unpredictable to proxies
+  mask_seed_ ^= mask_seed_ << 13;
+  mask_seed_ ^= mask_seed_ >> 17;
+  mask_seed_ ^= mask_seed_ << 5;
+  uint8_t* mask = p + pos;
+  memcpy(mask, &mask_seed_, 4);
+  pos += 4;
+
+  MaskCopy(p + pos, static_cast<const uint8_t*>(prefix), prefix_len, mask, 0);
+  MaskCopy(p + pos + prefix_len, static_cast<const uint8_t*>(data), len, mask, prefix_len);
+
+  return SendAllRaw(p, send_buffer_.size());
+}
+
+bool WebSocket::HandleFrame(uint8_t opcode, bool fin, char* payload, size_t len) {
+  switch (opcode) {
+    case kOpText:
+    case kOpBinary:
+      if (fin) {
+        if (on_data_) {
+          on_data_(payload, len, opcode == kOpBinary);
+        }
+      } else {
+        fragments_.assign(payload, len);
+        fragments_binary_ = opcode == kOpBinary;
+      }
+      return true;
+    case kOpContinuation:
+      fragments_.append(payload, len);
+      if (fin) {
+        if (on_data_) {
+          on_data_(fragments_.data(), fragments_.size(), fragments_binary_);
+        }
+        fragments_.clear();
+      }
+      return true;
+    case kOpPing:
+      SendControlFrame(kOpPong, payload, len);
+      return true;
+    case kOpPong:
+      if (on_pong_) {
+        on_pong_();
+      }
+      return true;
+    case kOpClose:
+      ESP_LOGI(TAG, "Received close frame");
+      if (!closing_.exchange(true)) {
+        SendControlFrame(kOpClose, payload, len < 2 ? len : 2);
+      }
+      return false;
+    default:
+      ESP_LOGW(TAG, "Unknown opcode: %d", opcode);
+      return true;
+  }
+}
+
+void WebSocket::ReceiveTask() {
+  Tracer::SetThreadName("websocket_rx");
+  bool running = true;
+  while (running && !closing_) {
+    size_t capacity = receive_buffer_.size() - 1;
+    int n = transport_->Receive(&receive_buffer_[received_], capacity - received_);
+    if (n < 0) {
+      if (!closing_ && on_error_) {
+        on_error_(n);
+      }
+      break;
+    }
+    received_ += n;
+
+    // Parse every complete frame in place
+    size_t pos = 0;
+    size_t need = 0;
+    while (running && received_ - pos >= 2) {
+      auto p = reinterpret_cast<uint8_t*>(&receive_buffer_[pos]);
+      size_t avail = received_ - pos;
+      bool fin = (p[0] & 0x80) != 0;
+      uint8_t opcode = p[0] & 0x0F;
+      bool masked = (p[1] & 0x80) != 0;
+      uint64_t len = p[1] & 0x7F;
+      size_t header = 2;
+      if (len == 126) {
+        header = 4;
+        if (avail < header) break;
+        len = (p[2] << 8) | p[3];
+      } else if (len == 127) {
+        header = 10;
+        if (avail < header) break;
+        len = 0;
+        for (int i = 0; i < 8; i++) {
+          len = (len << 8) | p[2 + i];
+        }
+      }
+      if (masked) {
+        header += 4;
+      }
+      if (len > kMaxFrameSize) {
+        ESP_LOGE(TAG, "Frame too large: %llu", (unsigned long long)len);
+        running = false;
+        break;
+      }
+      if (avail < header + len) {
+        need = header + len;
+        break;
+      }
+
+      char* payload = reinterpret_cast<char*>(p + header);
+      if (masked) {
+        const uint8_t* mask = p + header - 4;
+        for (size_t i = 0; i < len; i++) {
+          payload[i] ^= mask[i & 3];
+        }
+      }
+
+      char saved = payload[len];
+      payload[len] = '\0';
+      running = HandleFrame(opcode, fin, payload, len);
+      payload[len] = saved;
+      pos += header + len;
+    }
+
+    if (pos > 0) {
+      received_ -= pos;
+      memmove(receive_buffer_.data(), receive_buffer_.data() + pos, received_);
+    }
+    // Grow for frames that do not fit the configured buffer size
+    if (need > receive_buffer_.size() - 1) {
+      receive_buffer_.resize(need + 1);
+    }
+  }
+
+  transport_->Disconnect();
+  ESP_LOGI(TAG, "Websocket disconnected");
+  if (on_disconnected_) {
+    on_disconnected_();
+  }
+}
@@ -1,186 +1,416 @@
 #include "nvs_flash.h"
+#include "impl/file_io.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
 #include <unordered_map>
+#include <string_view>
 #include <fstream>
-#include <iostream>
 #include <sstream>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <cstring>
+
+#define TAG "NVS"
+
+/*
+ * The store is kept in two files:
+ *   .xiaozhi_config      snapshot, one "namespace.key=value" per line
+ *   .xiaozhi_config.log  journal appended by every commit:
+ *                          "namespace.key=value"  set
+ *                          "-namespace.key"       erase a key
+ *                          "!namespace"           erase a namespace
+ * A commit only appends its own changes to the journal. The sync task
+ * fsyncs the journal once for all commits of a period, and folds it into
+ * a new snapshot (written aside, then renamed over) when it grows too
+ * long. Edits of the snapshot by hand are picked up while running.
+ */
 
 namespace {
 
 using KVMap = std::unordered_map<std::string, std::string>;
 
-std::unordered_map<std::string, KVMap> nv_caches;
-
-KVMap* 
-getSection(const std::string& ns) noexcept {
-  auto it = nv_caches.find(ns);
-  if (it == nv_caches.end()) {
-    auto [it1, ret] = nv_caches.emplace(ns, std::unordered_map<std::string, std::string>());
-    return &it1->second;
-  } else {
-    return &it->second;
+constexpr const char* kSnapshotFile = ".xiaozhi_config";
+constexpr const char* kSnapshotTempFile = ".xiaozhi_config.tmp";
+constexpr const char* kJournalFile = ".xiaozhi_config.log";
+
+// Journal records beyond which the store is compacted
+constexpr int kMaxJournalRecords = 128;
+constexpr auto kSyncInterval = std::chrono::milliseconds(500);
+// How often the snapshot is checked for edits from outside
+constexpr auto kReloadInterval = std::chrono::seconds(1);
+
+struct Handle {
+  std::string ns;
+  bool writable;
+  std::string journal;
+};
+
+struct Store {
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::unordered_map<std::string, KVMap> sections;
+  int journal_fd = -1;
+  int journal_records = 0;
+  bool needs_sync = false;
+  std::filesystem::file_time_type snapshot_time;
+};
+
+std::atomic<nvs_port_change_cb_t> change_callback = nullptr;
+void* change_arg = nullptr;
+
+void notifyChange(const char* ns) {
+  auto callback = change_callback.load();
+  if (callback) {
+    callback(ns, change_arg);
   }
 }
 
-bool parseLine(const std::string& line, 
-               std::string& x, 
-               std::string& y, 
-               std::string& z) 
-{
-  std::istringstream iss(line);
-  std::string token;
-  std::vector<std::string> parts;
+Store& store() {
+  static Store* instance = new Store();
+  return *instance;
+}
 
-  auto trim = [](std::string& s) {
-        s.erase(0, s.find_first_not_of(" \t"));
-        s.erase(s.find_last_not_of(" \t") + 1);
-  };
+std::string_view trim(std::string_view s) {
+  size_t begin = s.find_first_not_of(" \t\r");
+  if (begin == std::string_view::npos) {
+    return {};
+  }
+  size_t end = s.find_last_not_of(" \t\r");
+  return s.substr(begin, end - begin + 1);
+}
 
-  if (std::getline(iss, token, '.')) {
-    x = std::move(token);
-    trim(x);
-  } else {
+// Split "namespace.key" at the first dot
+bool splitName(std::string_view name, std::string_view& ns, std::string_view& key) {
+  size_t dot = name.find('.');
+  if (dot == std::string_view::npos) {
     return false;
   }
+  ns = trim(name.substr(0, dot));
+  key = trim(name.substr(dot + 1));
+  return !ns.empty() && !key.empty();
+}
 
-  if (std::getline(iss, token, '=')) {
-    y = std::move(token);
-    trim(y);
+// Apply one snapshot or journal line, the caller holds the lock
+void applyLine(Store& s, std::string_view line) {
+  line = trim(line);
+  if (line.empty() || line[0] == '#') {
+    return;
+  }
+
+  std::string_view ns, key;
+  if (line[0] == '!') {
+    s.sections.erase(std::string(trim(line.substr(1))));
+  } else if (line[0] == '-') {
+    if (splitName(line.substr(1), ns, key)) {
+      s.sections[std::string(ns)].erase(std::string(key));
+    }
   } else {
+    size_t eq = line.find('=');
+    if (eq != std::string_view::npos && splitName(line.substr(0, eq), ns, key)) {
+      s.sections[std::string(ns)][std::string(key)] = std::string(trim(line.substr(eq + 1)));
+    }
+  }
+}
+
+// Returns the number of lines applied. A journal line without its newline
+// is a torn append and skipped, the snapshot may be edited by hand.
+int applyFile(Store& s, const char* path, bool journal) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return 0;
+  }
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  std::string content = buffer.str();
+
+  int lines = 0;
+  size_t pos = 0;
+  while (pos < content.size()) {
+    size_t end = content.find('\n', pos);
+    if (end == std::string::npos) {
+      if (journal) {
+        break;
+      }
+      end = content.size();
+    }
+    applyLine(s, std::string_view(content).substr(pos, end - pos));
+    pos = end + 1;
+    lines++;
+  }
+  return lines;
+}
+
+std::filesystem::file_time_type snapshotTime() {
+  std::error_code ec;
+  auto time = std::filesystem::last_write_time(kSnapshotFile, ec);
+  return ec ? std::filesystem::file_time_type() : time;
+}
+
+// The caller holds the lock
+void loadStore(Store& s) {
+  s.sections.clear();
+  s.snapshot_time = snapshotTime();
+  if (s.snapshot_time == std::filesystem::file_time_type()) {
+    ESP_LOGW(TAG, "cannot open %s", kSnapshotFile);
+  }
+  applyFile(s, kSnapshotFile, false);
+  s.journal_records = applyFile(s, kJournalFile, true);
+}
+
+// Write the whole store aside and rename it over the snapshot, then start
+// an empty journal. The caller holds the lock.
+bool compactStore(Store& s) {
+  std::string content;
+  for (auto& [ns, section] : s.sections) {
+    for (auto& [key, value] : section) {
+      content += ns + "." + key + "=" + value + "\n";
+    }
+  }
+
+  int fd = file_open(kSnapshotTempFile, kFileTruncate);
+  if (fd < 0) {
+    ESP_LOGE(TAG, "cannot create %s", kSnapshotTempFile);
     return false;
   }
+  bool ok = file_write(fd, content.data(), content.size()) && file_sync(fd);
+  file_close(fd);
 
-  std::getline(iss, token, '\n');
-  z = std::move(token);
-  trim(z);
+  std::error_code ec;
+  if (ok) {
+    std::filesystem::rename(kSnapshotTempFile, kSnapshotFile, ec);
+  }
+  if (!ok || ec) {
+    ESP_LOGE(TAG, "failed to replace %s", kSnapshotFile);
+    std::filesystem::remove(kSnapshotTempFile, ec);
+    return false;
+  }
+  s.snapshot_time = snapshotTime();
 
+  // Only now is the journal redundant
+  if (s.journal_fd >= 0) {
+    file_close(s.journal_fd);
+  }
+  s.journal_fd = file_open(kJournalFile, kFileTruncate);
+  s.journal_records = 0;
+  s.needs_sync = false;
   return true;
 }
 
-void initNvRam() {
-  static bool inited = false;
-  if (!inited) {
-    inited = true;
-
-    std::ifstream file(".xiaozhi_config");
-    if (!file.is_open()) {
-      std::cerr << "cannnot open .xiaozhi_config" << std::endl;
-      return;
+void syncTask(void*) {
+  auto& s = store();
+  auto next_reload = std::chrono::steady_clock::now() + kReloadInterval;
+  std::unique_lock<std::mutex> lock(s.mutex);
+  while (true) {
+    s.condition.wait_for(lock, kSyncInterval);
+
+    if (s.journal_records > kMaxJournalRecords) {
+      compactStore(s);
+    } else if (s.needs_sync && s.journal_fd >= 0) {
+      // One fsync covers every commit since the last one
+      s.needs_sync = false;
+      file_sync(s.journal_fd);
     }
 
-    std::string line;
-    while (std::getline(file, line)) {
-      if (line.empty() || line[0] == '#') continue;
-      std::string x, y, z;
-      if (parseLine(line, x, y, z)) {
-        auto sec = getSection(x);
-        (*sec)[y] = z;
+    auto now = std::chrono::steady_clock::now();
+    if (now >= next_reload) {
+      next_reload = now + kReloadInterval;
+      if (snapshotTime() != s.snapshot_time) {
+        ESP_LOGI(TAG, "%s changed, reloading", kSnapshotFile);
+        loadStore(s);
+        lock.unlock();
+        notifyChange(nullptr);
+        lock.lock();
       }
     }
   }
 }
 
-void commitNvRam() {
-  std::ofstream file(".xiaozhi_config");
-  if (!file.is_open()) {
-    std::cerr << "cannnot open .xiaozhi_config" << std::endl;
+Store& initStore() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    auto& s = store();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    loadStore(s);
+    // Start from a clean journal, a torn last record must not be
+    // continued by the next append
+    std::error_code ec;
+    if (std::filesystem::file_size(kJournalFile, ec) == 0 || ec || !compactStore(s)) {
+      s.journal_fd = file_open(kJournalFile, kFileAppend);
+    }
+    if (s.journal_fd < 0) {
+      ESP_LOGE(TAG, "cannot open %s", kJournalFile);
+    }
+    xTaskCreate(syncTask, "nvs_sync", 4096, nullptr, 1, nullptr);
+  });
+  return store();
+}
+
+// Append the records of a handle to the journal, the caller holds the lock
+void flushJournal(Store& s, Handle* handle) {
+  if (handle->journal.empty()) {
     return;
   }
+  if (s.journal_fd < 0 || !file_write(s.journal_fd, handle->journal.data(), handle->journal.size())) {
+    ESP_LOGE(TAG, "failed to append to %s", kJournalFile);
+  }
+  for (char c : handle->journal) {
+    if (c == '\n') {
+      s.journal_records++;
+    }
+  }
+  handle->journal.clear();
+  s.needs_sync = true;
+  if (s.journal_records > kMaxJournalRecords) {
+    s.condition.notify_one();
+  }
+}
 
-  for (auto &[sec, submap] : nv_caches) {
-    for (auto &[key, value] : submap) {
-      file << sec << "." << key << "=" << value << std::endl;
+int setValue(nvs_handle_t h, const char *key, std::string value) {
+  auto handle = reinterpret_cast<Handle*>(h);
+  if (!handle || !handle->writable) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  // Records are line based
+  for (auto& c : value) {
+    if (c == '\n' || c == '\r') {
+      c = ' ';
     }
   }
+
+  auto& s = store();
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto& stored = s.sections[handle->ns][key];
+    if (stored == value) {
+      return ESP_OK;
+    }
+    handle->journal += handle->ns + "." + key + "=" + value + "\n";
+    stored = std::move(value);
+  }
+  notifyChange(handle->ns.c_str());
+  return ESP_OK;
+}
+
+bool getValue(nvs_handle_t h, const char *key, std::string& value) {
+  auto handle = reinterpret_cast<Handle*>(h);
+  if (!handle) {
+    return false;
+  }
+
+  auto& s = store();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto section = s.sections.find(handle->ns);
+  if (section == s.sections.end()) {
+    return false;
+  }
+  auto it = section->second.find(key);
+  if (it == section->second.end()) {
+    return false;
+  }
+  value = it->second;
+  return true;
 }
 
 } // namespace
 
 
 extern "C" void nvs_open(const char *ns, int flags, nvs_handle_t *h) {
-  initNvRam();
-  auto sec = getSection(ns);
-  *h = reinterpret_cast<nvs_handle_t>(sec);
+  initStore();
+  *h = reinterpret_cast<nvs_handle_t>(new Handle{ns, flags == NVS_READWRITE, {}});
 }
 
-extern "C" int nvs_commit(nvs_handle_t) {
-  commitNvRam();
+extern "C" int nvs_commit(nvs_handle_t h) {
+  auto handle = reinterpret_cast<Handle*>(h);
+  if (!handle) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  auto& s = store();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  flushJournal(s, handle);
   return ESP_OK;
 }
 
-extern "C" void nvs_close(nvs_handle_t) {
-
+extern "C" void nvs_close(nvs_handle_t h) {
+  auto handle = reinterpret_cast<Handle*>(h);
+  if (!handle) {
+    return;
+  }
+  // The values are already visible to everyone, keep the disk in step
+  nvs_commit(h);
+  delete handle;
 }
 
 extern "C" int nvs_get_str(nvs_handle_t h, const char *key, char *buffer, size_t *length) {
-  auto sec = reinterpret_cast<KVMap*>(h);
-  if (sec) {
-    auto it = sec->find(key);
-    if (it != sec->end()) {
-      if (buffer) {
-        if (*length < it->second.size()) {
-          return ESP_ERR_INVALID_ARG;
-        }
-        *length = it->second.size();
-        memcpy(buffer, it->second.c_str(), it->second.size());
-      } else {
-        *length = it->second.size();
-      }
-      return ESP_OK;
+  std::string value;
+  if (!getValue(h, key, value)) {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  if (buffer) {
+    if (*length < value.size()) {
+      return ESP_ERR_INVALID_ARG;
     }
+    memcpy(buffer, value.c_str(), value.size());
   }
-
-  return ESP_ERR_NVS_NOT_FOUND;
+  *length = value.size();
+  return ESP_OK;
 }
 
 extern "C" int nvs_set_str(nvs_handle_t h, const char *key, const char *value) {
-  auto sec = reinterpret_cast<KVMap*>(h);
-  if (sec) {
-    sec->emplace(key, value);
-    return ESP_OK;
-  }
-
-  return ESP_ERR_INVALID_ARG;
+  return setValue(h, key, value);
 }
 
 extern "C" int nvs_get_i32(nvs_handle_t h, const char *key, int32_t *value) {
-  auto sec = reinterpret_cast<KVMap*>(h);
-  if (sec) {
-    auto it = sec->find(key);
-    if (it != sec->end()) {
-      *value = std::atoi(it->second.c_str());
-      return ESP_OK;
-    }
+  std::string str;
+  if (!getValue(h, key, str)) {
+    return ESP_ERR_NVS_NOT_FOUND;
   }
-
-  return ESP_ERR_NVS_NOT_FOUND;
+  *value = std::atoi(str.c_str());
+  return ESP_OK;
 }
 
 extern "C" int nvs_set_i32(nvs_handle_t h, const char *key, int32_t value) {
-  auto sec = reinterpret_cast<KVMap*>(h);
-  if (sec) {
-    sec->emplace(key, std::to_string(value));
-    return ESP_OK;
-  }
-
-  return ESP_ERR_INVALID_ARG;
+  return setValue(h, key, std::to_string(value));
 }
 
 extern "C" int nvs_erase_key(nvs_handle_t h, const char *key) {
-  auto sec = reinterpret_cast<KVMap*>(h);
-  if (sec) {
-    sec->erase(key);
-    return ESP_OK;
+  auto handle = reinterpret_cast<Handle*>(h);
+  if (!handle || !handle->writable) {
+    return ESP_ERR_INVALID_ARG;
   }
 
-  return ESP_ERR_INVALID_ARG;
+  auto& s = store();
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto section = s.sections.find(handle->ns);
+    if (section == s.sections.end() || section->second.erase(key) == 0) {
+      return ESP_ERR_NVS_NOT_FOUND;
+    }
+    handle->journal += "-" + handle->ns + "." + key + "\n";
+  }
+  notifyChange(handle->ns.c_str());
+  return ESP_OK;
 }
 
 extern "C" int nvs_erase_all(nvs_handle_t h) {
-  auto sec = reinterpret_cast<KVMap*>(h);
-  if (sec) {
-    sec->clear();
-    return ESP_OK;
+  auto handle = reinterpret_cast<Handle*>(h);
+  if (!handle || !handle->writable) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  auto& s = store();
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.sections.erase(handle->ns);
+    handle->journal += "!" + handle->ns + "\n";
   }
+  notifyChange(handle->ns.c_str());
+  return ESP_OK;
+}
 
-  return ESP_ERR_INVALID_ARG;
+extern "C" void nvs_port_set_change_callback(nvs_port_change_cb_t callback, void *arg) {
+  change_arg = arg;
+  change_callback = callback;
 }
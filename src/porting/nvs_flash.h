@@ -29,6 +29,12 @@ int nvs_set_i32(nvs_handle_t h, const char *key, int32_t value);
 int nvs_erase_key(nvs_handle_t h, const char *key);
 int nvs_erase_all(nvs_handle_t h);
 
+// Emulator extension: called after a namespace changed, with ns NULL when
+// the whole store was reloaded from disk. Runs on the thread that made the
+// change, without any NVS lock held.
+typedef void (*nvs_port_change_cb_t)(const char *ns, void *arg);
+void nvs_port_set_change_callback(nvs_port_change_cb_t callback, void *arg);
+
 #ifdef __cplusplus
 }
 #endif
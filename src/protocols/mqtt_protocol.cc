@@ -1,12 +1,53 @@
 #include "mqtt_protocol.h"
 #include "impl/paho_mqtt.h"
-#include "impl/udp_client.h"
+#include "impl/net_socket.h"
+#include "board.h"
+#include "impl/opus_wrapper.h"
 #include "settings.h"
+#include "metrics.h"
+#include "trace.h"
 #include <esp_log.h>
 #include "application.h"
 
 #define TAG "MQTT"
 
+// Datagrams waiting for the socket before the channel reports busy
+#define UDP_BUSY_QUEUE_SIZE 4
+// Short downlink gaps are concealed by the decoder, longer ones are skipped
+#define MAX_CONCEALED_PACKETS 3
+
+namespace {
+
+struct MqttMetrics {
+    Counter& packets_sent = Metrics::GetInstance().GetCounter("xiaozhi_mqtt_udp_packets_total",
+        "Audio datagrams of the MQTT UDP channel.", "direction=\"tx\"");
+    Counter& packets_received = Metrics::GetInstance().GetCounter("xiaozhi_mqtt_udp_packets_total",
+        "Audio datagrams of the MQTT UDP channel.", "direction=\"rx\"");
+    Counter& bytes_sent = Metrics::GetInstance().GetCounter("xiaozhi_mqtt_udp_bytes_total",
+        "Audio datagram bytes of the MQTT UDP channel.", "direction=\"tx\"");
+    Counter& bytes_received = Metrics::GetInstance().GetCounter("xiaozhi_mqtt_udp_bytes_total",
+        "Audio datagram bytes of the MQTT UDP channel.", "direction=\"rx\"");
+    Counter& sequence_gaps = Metrics::GetInstance().GetCounter("xiaozhi_mqtt_udp_sequence_gaps_total",
+        "Downlink packets missing from the sequence.");
+    Counter& late_packets = Metrics::GetInstance().GetCounter("xiaozhi_mqtt_udp_late_packets_total",
+        "Downlink packets dropped for an old sequence number.");
+    Counter& invalid_packets = Metrics::GetInstance().GetCounter("xiaozhi_mqtt_udp_invalid_packets_total",
+        "Downlink datagrams with a bad size or type.");
+    Counter& crypto_failures = Metrics::GetInstance().GetCounter("xiaozhi_mqtt_udp_crypto_failures_total",
+        "Audio packets that failed to encrypt or decrypt.");
+    Counter& messages_sent = Metrics::GetInstance().GetCounter("xiaozhi_mqtt_messages_total",
+        "JSON messages over MQTT.", "direction=\"tx\"");
+    Counter& messages_received = Metrics::GetInstance().GetCounter("xiaozhi_mqtt_messages_total",
+        "JSON messages over MQTT.", "direction=\"rx\"");
+};
+
+MqttMetrics& mqtt_metrics() {
+    static MqttMetrics metrics;
+    return metrics;
+}
+
+}
+
 MqttProtocol::MqttProtocol() {
     //event_group_handle_ = xEventGroupCreate();
 }
@@ -33,12 +74,11 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
         delete mqtt_;
   }
 
-  Settings settings("mqtt", false);
-  endpoint_ = settings.GetString("endpoint");
-  client_id_ = settings.GetString("client_id");
-  username_ = settings.GetString("username");
-  password_ = settings.GetString("password");
-  publish_topic_ = settings.GetString("publish_topic");
+  endpoint_ = endpoint_setting_.Get();
+  client_id_ = client_id_setting_.Get();
+  username_ = username_setting_.Get();
+  password_ = password_setting_.Get();
+  publish_topic_ = publish_topic_setting_.Get();
 
   if (endpoint_.empty()) {
         ESP_LOGW(TAG, "MQTT endpoint is not specified");
@@ -56,6 +96,7 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
   });
 
   mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
+    mqtt_metrics().messages_received.Increment();
     cJSON* root = cJSON_Parse(payload.c_str());
         if (root == nullptr) {
             ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
@@ -127,7 +168,7 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
             server_sample_rate_ = sample_rate->valueint;
         }
         auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
-        if (frame_duration != NULL) {
+        if (frame_duration != NULL && frame_duration->valueint > 0) {
             server_frame_duration_ = frame_duration->valueint;
         }
     }
@@ -166,7 +207,6 @@ bool MqttProtocol::OpenAudioChannel() {
         }
     }
 
-    busy_sending_audio_ = false;
     error_occurred_ = false;
     session_id_ = "";
     {
@@ -183,9 +223,8 @@ bool MqttProtocol::OpenAudioChannel() {
 #if CONFIG_USE_SERVER_AEC
     message += "\"features\":{\"aec\":true},";
 #endif
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
+    message += GetAudioParamsJson();
+    message += "}";
     if (!SendText(message)) {
         return false;
     }
@@ -206,8 +245,12 @@ bool MqttProtocol::OpenAudioChannel() {
     if (udp_ != nullptr) {
         delete udp_;
     }
-    udp_ = new UdpClient();
+    udp_ = Board::GetInstance().CreateUdp();
     udp_->OnMessage([this](const std::string& data) {
+        TRACE_SCOPE("MqttProtocol OnMessage");
+        auto& metrics = mqtt_metrics();
+        metrics.packets_received.Increment();
+        metrics.bytes_received.Increment(data.size());
         /*
          * UDP Encrypted OPUS Packet Format:
          * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
@@ -215,21 +258,36 @@ bool MqttProtocol::OpenAudioChannel() {
          */
         if (data.size() < sizeof(aes_nonce_)) {
             ESP_LOGE(TAG, "Invalid audio packet size: %zu", data.size());
+            metrics.invalid_packets.Increment();
             return;
         }
         if (data[0] != 0x01) {
             ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
+            metrics.invalid_packets.Increment();
             return;
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
+        // A duplicate is late too, and must not reach the gap count below
+        if (remote_sequence_ != 0 && sequence <= remote_sequence_) {
+            ESP_LOGW(TAG, "Received audio packet with old sequence: %u, expected: %u", sequence, remote_sequence_ + 1);
+            metrics.late_packets.Increment();
             return;
         }
         if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
+            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %u, expected: %u", sequence, remote_sequence_ + 1);
+            if (remote_sequence_ != 0) {
+                uint32_t missing = sequence - remote_sequence_ - 1;
+                lost_packets_ += missing;
+                metrics.sequence_gaps.Increment(missing);
+                if (missing <= MAX_CONCEALED_PACKETS && on_incoming_audio_ != nullptr) {
+                    for (uint32_t i = 0; i < missing; i++) {
+                        on_incoming_audio_(AudioStreamPacket());
+                    }
+                }
+            }
         }
+        received_packets_++;
 
         size_t decrypted_size = data.size() - aes_nonce_.size();
         size_t nc_off = 0;
@@ -242,6 +300,7 @@ bool MqttProtocol::OpenAudioChannel() {
         int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet.payload.data());
         if (ret != 0) {
             ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
+            metrics.crypto_failures.Increment();
             return;
         }
         if (on_incoming_audio_ != nullptr) {
@@ -269,15 +328,25 @@ bool MqttProtocol::SendText(const std::string& text) {
         SetError("SERVER_ERROR");
         return false;
     }
+    mqtt_metrics().messages_sent.Increment();
     return true;
 }
 
 void MqttProtocol::SendAudio(const AudioStreamPacket& packet) {
+    TRACE_SCOPE("MqttProtocol SendAudio");
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ == nullptr) {
         return;
     }
 
+    // Silent frames are not sent, the encoder keeps sending a comfort noise
+    // update every 400 ms. The sequence only counts sent packets and the
+    // timestamp is the playback timestamp for the server AEC, not the
+    // capture time, so the server cannot tell that frames were skipped.
+    if (OpusEncoderWrapper::IsDtxPacket(packet.payload)) {
+        return;
+    }
+
     std::string nonce(aes_nonce_);
     *(uint16_t*)&nonce[2] = htons(packet.payload.size());
     *(uint32_t*)&nonce[8] = htonl(packet.timestamp);
@@ -292,12 +361,20 @@ void MqttProtocol::SendAudio(const AudioStreamPacket& packet) {
     if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet.payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
         (uint8_t*)packet.payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
+        mqtt_metrics().crypto_failures.Increment();
         return;
     }
 
-    busy_sending_audio_ = true;
     udp_->Send(encrypted);
-    busy_sending_audio_ = false;
+    mqtt_metrics().packets_sent.Increment();
+    mqtt_metrics().bytes_sent.Increment(encrypted.size());
+}
+
+// Read from the socket every time: the encoder skips frames while the
+// channel is busy, so nothing would be sent to clear a stored flag
+bool MqttProtocol::IsAudioChannelBusy() const {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    return udp_ != nullptr && udp_->GetSendQueueSize() >= UDP_BUSY_QUEUE_SIZE;
 }
 
 void MqttProtocol::CloseAudioChannel() {
@@ -320,6 +397,15 @@ void MqttProtocol::CloseAudioChannel() {
     }
 }
 
+NetworkStats MqttProtocol::GetNetworkStats() const {
+    auto stats = Protocol::GetNetworkStats();
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (udp_ != nullptr) {
+        stats.send_queue = udp_->GetSendQueueSize();
+    }
+    return stats;
+}
+
 bool MqttProtocol::IsAudioChannelOpened() const {
     return udp_ != nullptr && !error_occurred_ && !IsTimeout();
 }
@@ -2,6 +2,7 @@
 #include "protocol.h"
 #include "mqtt.h"
 #include "udp.h"
+#include "settings.h"
 #include <cjson/cJSON.h>
 #include <mbedtls/aes.h>
 #include <mutex>
@@ -18,6 +19,8 @@ public:
   void SendAudio(const AudioStreamPacket& packet) override;
   void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+  bool IsAudioChannelBusy() const override;
+  NetworkStats GetNetworkStats() const override;
 
 private:
   bool StartMqttClient(bool report_error=false);
@@ -25,6 +28,13 @@ private:
   std::string DecodeHexString(const std::string& hex_string);
 
 
+  // Resolved once, read again on every (re)connect
+  Setting<std::string> endpoint_setting_{"mqtt", "endpoint"};
+  Setting<std::string> client_id_setting_{"mqtt", "client_id"};
+  Setting<std::string> username_setting_{"mqtt", "username"};
+  Setting<std::string> password_setting_{"mqtt", "password"};
+  Setting<std::string> publish_topic_setting_{"mqtt", "publish_topic"};
+
   std::string endpoint_;
   std::string client_id_;
   std::string username_;
@@ -33,7 +43,7 @@ private:
   Mqtt* mqtt_ = nullptr;
   Udp* udp_ = nullptr;
 
-  std::mutex channel_mutex_;
+  mutable std::mutex channel_mutex_;
     mbedtls_aes_context aes_ctx_;
     std::string aes_nonce_;
     std::string udp_server_;
@@ -24,6 +24,19 @@ void Protocol::OnNetworkError(std::function<void(const std::string& message)> ca
     on_network_error_ = callback;
 }
 
+void Protocol::SetClientAudioParams(int sample_rate, int frame_duration) {
+    client_sample_rate_ = sample_rate;
+    client_frame_duration_ = frame_duration;
+}
+
+std::string Protocol::GetAudioParamsJson() const {
+    std::string json = "\"audio_params\":{";
+    json += "\"format\":\"opus\", \"sample_rate\":" + std::to_string(client_sample_rate_);
+    json += ", \"channels\":1, \"frame_duration\":" + std::to_string(client_frame_duration_);
+    json += "}";
+    return json;
+}
+
 void Protocol::SetError(const std::string& message) {
     error_occurred_ = true;
     if (on_network_error_ != nullptr) {
@@ -121,7 +134,7 @@ bool Protocol::IsTimeout() const {
     auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_incoming_time_);
     bool timeout = duration.count() > kTimeoutSeconds;
     if (timeout) {
-        ESP_LOGE(TAG, "Channel timeout %lld seconds", duration.count());
+        ESP_LOGE(TAG, "Channel timeout %lld seconds", (long long)duration.count());
     }
     return timeout;
 }
@@ -130,3 +143,9 @@ bool Protocol::IsAudioChannelBusy() const {
     return busy_sending_audio_;
 }
 
+NetworkStats Protocol::GetNetworkStats() const {
+    NetworkStats stats;
+    stats.received_packets = received_packets_;
+    stats.lost_packets = lost_packets_;
+    return stats;
+}
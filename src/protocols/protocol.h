@@ -6,12 +6,20 @@
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <atomic>
 
 struct AudioStreamPacket {
     uint32_t timestamp = 0;
     std::vector<uint8_t> payload;
 };
 
+// Cumulative counters of the audio channel
+struct NetworkStats {
+    uint32_t received_packets = 0;
+    uint32_t lost_packets = 0;
+    size_t send_queue = 0;
+};
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -42,12 +50,15 @@ public:
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
+    // Uplink audio format announced in the hello message
+    void SetClientAudioParams(int sample_rate, int frame_duration);
 
     virtual bool Start() = 0;
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
     virtual bool IsAudioChannelBusy() const;
+    virtual NetworkStats GetNetworkStats() const;
     virtual void SendAudio(const AudioStreamPacket& packet) = 0;
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
@@ -65,11 +76,17 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    int client_sample_rate_ = 16000;
+    int client_frame_duration_ = 60;
     bool error_occurred_ = false;
-    bool busy_sending_audio_ = false;
+    std::atomic<bool> busy_sending_audio_ = false;
+    std::atomic<uint32_t> received_packets_ = 0;
+    std::atomic<uint32_t> lost_packets_ = 0;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
 
+    std::string GetAudioParamsJson() const;
+
     virtual bool SendText(const std::string& text) = 0;
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
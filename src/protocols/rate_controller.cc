@@ -0,0 +1,97 @@
+#include "rate_controller.h"
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "RateController"
+
+namespace {
+
+// Decisions are taken over windows of about one second
+constexpr int kWindowFrames = 16;
+constexpr int kMaxComplexity = 10;
+constexpr int kMinComplexity = 2;
+constexpr int kIncreaseStep = 2000;
+constexpr float kDecreaseFactor = 0.75f;
+// Downlink loss above this rate is taken as a congested path
+constexpr float kHighLossRate = 0.10f;
+constexpr float kLowLossRate = 0.02f;
+// More than this many frames waiting means the uplink can't keep up
+constexpr size_t kCongestedQueueDepth = 2;
+// Share of the frame duration the encoder may use before complexity drops
+constexpr float kEncodeBudget = 0.15f;
+
+} // namespace
+
+AudioRateController::AudioRateController(int min_bitrate, int max_bitrate, int start_bitrate)
+    : min_bitrate_(min_bitrate),
+      max_bitrate_(max_bitrate),
+      start_bitrate_(std::clamp(start_bitrate, min_bitrate, max_bitrate)),
+      bitrate_(start_bitrate_),
+      complexity_(kMaxComplexity) {
+}
+
+void AudioRateController::Reset() {
+    bitrate_ = start_bitrate_;
+    complexity_ = kMaxComplexity;
+    frames_ = 0;
+    max_queue_depth_ = 0;
+    encode_us_ = 0;
+    frame_us_ = 0;
+    first_update_ = true;
+}
+
+bool AudioRateController::Update(size_t queue_depth, uint32_t received, uint32_t lost, int encode_us, int frame_us) {
+    if (first_update_) {
+        // Counters are cumulative per protocol, only deltas matter
+        last_received_ = received;
+        last_lost_ = lost;
+        first_update_ = false;
+    }
+
+    frames_++;
+    max_queue_depth_ = std::max(max_queue_depth_, queue_depth);
+    encode_us_ += encode_us;
+    frame_us_ += frame_us;
+    if (frames_ < kWindowFrames) {
+        return false;
+    }
+
+    uint32_t window_received = received - last_received_;
+    uint32_t window_lost = lost - last_lost_;
+    last_received_ = received;
+    last_lost_ = lost;
+    float loss_rate = 0.0f;
+    if (window_received + window_lost > 0) {
+        loss_rate = (float)window_lost / (window_received + window_lost);
+    }
+
+    int bitrate = bitrate_;
+    if (max_queue_depth_ > kCongestedQueueDepth || loss_rate > kHighLossRate) {
+        bitrate = (int)(bitrate * kDecreaseFactor);
+    } else if (max_queue_depth_ == 0 && loss_rate < kLowLossRate) {
+        bitrate += kIncreaseStep;
+    }
+    bitrate = std::clamp(bitrate, min_bitrate_, max_bitrate_);
+
+    int complexity = complexity_;
+    if (encode_us_ > frame_us_ * kEncodeBudget) {
+        complexity--;
+    } else if (encode_us_ < frame_us_ * kEncodeBudget / 2) {
+        complexity++;
+    }
+    complexity = std::clamp(complexity, kMinComplexity, kMaxComplexity);
+
+    frames_ = 0;
+    max_queue_depth_ = 0;
+    encode_us_ = 0;
+    frame_us_ = 0;
+
+    if (bitrate == bitrate_ && complexity == complexity_) {
+        return false;
+    }
+    ESP_LOGI(TAG, "bitrate %d -> %d, complexity %d -> %d, loss %.1f%%",
+        bitrate_, bitrate, complexity_, complexity, loss_rate * 100);
+    bitrate_ = bitrate;
+    complexity_ = complexity;
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef RATE_CONTROLLER_H
+#define RATE_CONTROLLER_H
+
+#include <cstdint>
+#include <cstddef>
+
+// AIMD controller for the uplink opus bitrate and encoder complexity.
+// Fed once per encoded frame with the uplink queue depth, the cumulative
+// packet counters of the protocol and the encoder cost of the frame.
+class AudioRateController {
+public:
+    AudioRateController(int min_bitrate, int max_bitrate, int start_bitrate);
+
+    void Reset();
+    // Returns true when bitrate() or complexity() changed
+    bool Update(size_t queue_depth, uint32_t received, uint32_t lost, int encode_us, int frame_us);
+
+    int bitrate() const { return bitrate_; }
+    int complexity() const { return complexity_; }
+
+private:
+    const int min_bitrate_;
+    const int max_bitrate_;
+    const int start_bitrate_;
+    int bitrate_;
+    int complexity_;
+
+    int frames_ = 0;
+    size_t max_queue_depth_ = 0;
+    int64_t encode_us_ = 0;
+    int64_t frame_us_ = 0;
+    uint32_t last_received_ = 0;
+    uint32_t last_lost_ = 0;
+    bool first_update_ = true;
+};
+
+#endif // RATE_CONTROLLER_H
@@ -0,0 +1,356 @@
+#include "websocket_protocol.h"
+#include "board.h"
+#include "system_info.h"
+#include "settings.h"
+#include "application.h"
+#include "trace.h"
+#include <esp_log.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "WS"
+
+namespace {
+
+// Large enough for a 60ms opus frame at 48kHz plus the binary header, so
+// audio frames never hit the slow path of growing the receive buffer
+constexpr size_t kReceiveBufferSize = 4096;
+constexpr int kPingIntervalSeconds = 10;
+constexpr int kAliveTimeoutSeconds = 30;
+
+/*
+ * Binary protocol version 2:
+ * |version 2u|type 2u|reserved 4u|timestamp 4u|payload_size 4u|payload|
+ * Binary protocol version 3:
+ * |type 1u|reserved 1u|payload_size 2u|payload|
+ * All fields are big endian, version 1 carries the raw opus payload.
+ */
+constexpr size_t kHeaderSizeV2 = 16;
+constexpr size_t kHeaderSizeV3 = 4;
+
+inline void PutBE16(uint8_t* p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v & 0xFF;
+}
+
+inline void PutBE32(uint8_t* p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = (v >> 16) & 0xFF;
+  p[2] = (v >> 8) & 0xFF;
+  p[3] = v & 0xFF;
+}
+
+inline uint16_t GetBE16(const uint8_t* p) {
+  return (p[0] << 8) | p[1];
+}
+
+inline uint32_t GetBE32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+} // namespace
+
+WebsocketProtocol::WebsocketProtocol() {
+  esp_timer_create_args_t ping_timer_args = {};
+  ping_timer_args.callback = [](void* arg) {
+    static_cast<WebsocketProtocol*>(arg)->CheckAlive();
+  };
+  ping_timer_args.arg = this;
+  ping_timer_args.dispatch_method = ESP_TIMER_TASK;
+  ping_timer_args.name = "ws_ping";
+  ping_timer_args.skip_unhandled_events = true;
+  esp_timer_create(&ping_timer_args, &ping_timer_);
+}
+
+WebsocketProtocol::~WebsocketProtocol() {
+  ESP_LOGI(TAG, "WebsocketProtocol deinit");
+  esp_timer_delete(ping_timer_);
+  if (websocket_ != nullptr) {
+    delete websocket_;
+  }
+}
+
+bool WebsocketProtocol::Start() {
+  // The connection is only made when the audio channel is opened
+  return true;
+}
+
+bool WebsocketProtocol::SendText(const std::string& text) {
+  if (websocket_ == nullptr) {
+    return false;
+  }
+
+  if (!websocket_->Send(text)) {
+    ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
+    SetError("SERVER_ERROR");
+    return false;
+  }
+  return true;
+}
+
+void WebsocketProtocol::SendAudio(const AudioStreamPacket& packet) {
+  TRACE_SCOPE("WebsocketProtocol SendAudio");
+  std::lock_guard<std::mutex> lock(channel_mutex_);
+  if (websocket_ == nullptr || !websocket_->IsConnected()) {
+    return;
+  }
+  // Silent frames are not worth a frame header, see MqttProtocol::SendAudio
+  if (OpusEncoderWrapper::IsDtxPacket(packet.payload)) {
+    return;
+  }
+
+  if (version_ == 1) {
+    websocket_->Send(packet.payload.data(), packet.payload.size(), true);
+    audio_frame_bytes_ = packet.payload.size();
+    return;
+  }
+
+  // Header and payload go out as one binary frame, assembled by the
+  // websocket's masking copy
+  size_t header_size = version_ == 2 ? kHeaderSizeV2 : kHeaderSizeV3;
+  uint8_t p[kHeaderSizeV2];
+  if (version_ == 2) {
+    PutBE16(p, version_);
+    PutBE16(p + 2, 0);
+    PutBE32(p + 4, 0);
+    PutBE32(p + 8, packet.timestamp);
+    PutBE32(p + 12, packet.payload.size());
+  } else {
+    p[0] = 0;
+    p[1] = 0;
+    PutBE16(p + 2, packet.payload.size());
+  }
+  websocket_->Send(p, header_size, packet.payload.data(), packet.payload.size(), true);
+  audio_frame_bytes_ = header_size + packet.payload.size();
+}
+
+// TCP does not lose packets, what congestion there is shows as audio
+// piling up in the socket, counted in frames like the UDP send queue
+NetworkStats WebsocketProtocol::GetNetworkStats() const {
+  auto stats = Protocol::GetNetworkStats();
+  std::lock_guard<std::mutex> lock(channel_mutex_);
+  if (websocket_ != nullptr) {
+    stats.send_queue = websocket_->GetSendQueueBytes() / std::max<size_t>(1, audio_frame_bytes_);
+  }
+  return stats;
+}
+
+void WebsocketProtocol::OnIncomingBinary(const uint8_t* data, size_t len) {
+  if (on_incoming_audio_ == nullptr) {
+    return;
+  }
+
+  AudioStreamPacket packet;
+  if (version_ == 2) {
+    if (len < kHeaderSizeV2) {
+      return;
+    }
+    uint32_t payload_size = GetBE32(data + 12);
+    if (payload_size > len - kHeaderSizeV2) {
+      return;
+    }
+    packet.timestamp = GetBE32(data + 8);
+    packet.payload.assign(data + kHeaderSizeV2, data + kHeaderSizeV2 + payload_size);
+  } else if (version_ == 3) {
+    if (len < kHeaderSizeV3) {
+      return;
+    }
+    uint16_t payload_size = GetBE16(data + 2);
+    if (payload_size > len - kHeaderSizeV3) {
+      return;
+    }
+    packet.payload.assign(data + kHeaderSizeV3, data + kHeaderSizeV3 + payload_size);
+  } else {
+    packet.payload.assign(data, data + len);
+  }
+  received_packets_++;
+  on_incoming_audio_(std::move(packet));
+}
+
+void WebsocketProtocol::CloseAudioChannel() {
+  esp_timer_stop(ping_timer_);
+
+  std::lock_guard<std::mutex> lock(channel_mutex_);
+  if (websocket_ != nullptr) {
+    // The disconnected callback reports the channel as closed
+    delete websocket_;
+    websocket_ = nullptr;
+  }
+}
+
+bool WebsocketProtocol::IsAudioChannelOpened() const {
+  return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+}
+
+bool WebsocketProtocol::OpenAudioChannel() {
+  Settings settings("websocket", false);
+  std::string url = settings.GetString("url");
+  std::string token = settings.GetString("token");
+  int version = settings.GetInt("version");
+  if (version != 0) {
+    version_ = version;
+  }
+
+  error_occurred_ = false;
+  session_id_ = "";
+  {
+    std::lock_guard<std::mutex> lk(server_hello_mtx_);
+    hello_responsed_ = false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (websocket_ != nullptr) {
+      delete websocket_;
+    }
+    websocket_ = Board::GetInstance().CreateWebSocket();
+  }
+  if (websocket_ == nullptr) {
+    ESP_LOGE(TAG, "Websocket is not supported by the board");
+    SetError("SERVER_NOT_CONNECTED");
+    return false;
+  }
+
+  if (!token.empty()) {
+    // If token not has a space, add "Bearer " prefix
+    if (token.find(" ") == std::string::npos) {
+      token = "Bearer " + token;
+    }
+    websocket_->SetHeader("Authorization", token.c_str());
+  }
+  websocket_->SetHeader("Protocol-Version", std::to_string(version_).c_str());
+  websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+  websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
+  websocket_->SetReceiveBufferSize(kReceiveBufferSize);
+
+  websocket_->OnData([this](const char* data, size_t len, bool binary) {
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    if (binary) {
+      OnIncomingBinary(reinterpret_cast<const uint8_t*>(data), len);
+      return;
+    }
+
+    // Text frames are NUL terminated in the receive buffer
+    cJSON* root = cJSON_Parse(data);
+    if (root == nullptr) {
+      ESP_LOGE(TAG, "Failed to parse json message %s", data);
+      return;
+    }
+    cJSON* type = cJSON_GetObjectItem(root, "type");
+    if (type == nullptr || type->valuestring == nullptr) {
+      ESP_LOGE(TAG, "Message type is not specified");
+    } else if (strcmp(type->valuestring, "hello") == 0) {
+      ParseServerHello(root);
+    } else if (on_incoming_json_ != nullptr) {
+      on_incoming_json_(root);
+    }
+    cJSON_Delete(root);
+  });
+
+  websocket_->OnPong([this]() {
+    last_incoming_time_ = std::chrono::steady_clock::now();
+  });
+
+  websocket_->OnDisconnected([this]() {
+    if (on_audio_channel_closed_ != nullptr) {
+      on_audio_channel_closed_();
+    }
+  });
+
+  ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version_);
+  if (!websocket_->Connect(url.c_str())) {
+    ESP_LOGE(TAG, "Failed to connect to websocket server");
+    SetError("SERVER_NOT_CONNECTED");
+    return false;
+  }
+  last_incoming_time_ = std::chrono::steady_clock::now();
+
+  std::string message = "{";
+  message += "\"type\":\"hello\",";
+  message += "\"version\": " + std::to_string(version_) + ",";
+  message += "\"transport\":\"websocket\",";
+#if CONFIG_USE_SERVER_AEC
+  message += "\"features\":{\"aec\":true},";
+#endif
+  message += GetAudioParamsJson();
+  message += "}";
+  if (!SendText(message)) {
+    return false;
+  }
+
+  // 等待服务器响应
+  {
+    std::unique_lock lk(server_hello_mtx_);
+    if (!cnd_server_hello_.wait_for(lk, std::chrono::milliseconds(10000), [this] {
+      return hello_responsed_;
+    })) {
+      ESP_LOGE(TAG, "Failed to receive server hello");
+      SetError("SERVER_TIMEOUT");
+      return false;
+    }
+  }
+
+  esp_timer_start_periodic(ping_timer_, kPingIntervalSeconds * 1000000ULL);
+
+  if (on_audio_channel_opened_ != nullptr) {
+    on_audio_channel_opened_();
+  }
+  return true;
+}
+
+void WebsocketProtocol::ParseServerHello(const cJSON* root) {
+  auto transport = cJSON_GetObjectItem(root, "transport");
+  if (transport == nullptr || strcmp(transport->valuestring, "websocket") != 0) {
+    ESP_LOGE(TAG, "Unsupported transport: %s", transport ? transport->valuestring : "null");
+    return;
+  }
+
+  auto session_id = cJSON_GetObjectItem(root, "session_id");
+  if (session_id != nullptr) {
+    session_id_ = session_id->valuestring;
+    ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
+  }
+
+  auto audio_params = cJSON_GetObjectItem(root, "audio_params");
+  if (audio_params != NULL) {
+    auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
+    if (sample_rate != NULL) {
+      server_sample_rate_ = sample_rate->valueint;
+    }
+    auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
+    if (frame_duration != NULL && frame_duration->valueint > 0) {
+      server_frame_duration_ = frame_duration->valueint;
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lk(server_hello_mtx_);
+    hello_responsed_ = true;
+  }
+  cnd_server_hello_.notify_one();
+}
+
+// Runs on the reactor thread, a ping keeps NAT and proxies alive and the
+// pong proves the server is still there while no audio is flowing. Both
+// the close and the ping are left to the main loop, sending can block and
+// reactor callbacks must not.
+void WebsocketProtocol::CheckAlive() {
+  auto silence = std::chrono::duration_cast<std::chrono::seconds>(
+      std::chrono::steady_clock::now() - last_incoming_time_).count();
+  if (silence > kAliveTimeoutSeconds) {
+    ESP_LOGW(TAG, "No response from server for %lld seconds", (long long)silence);
+    esp_timer_stop(ping_timer_);
+    Application::GetInstance().Schedule([this]() {
+      SetError("SERVER_TIMEOUT");
+      CloseAudioChannel();
+    });
+    return;
+  }
+
+  Application::GetInstance().Schedule([this]() {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (websocket_ != nullptr && websocket_->IsConnected()) {
+      websocket_->Ping();
+    }
+  });
+}
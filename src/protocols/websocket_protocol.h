@@ -0,0 +1,39 @@
+#pragma once
+#include "protocol.h"
+#include "web_socket.h"
+#include <esp_timer.h>
+#include <cjson/cJSON.h>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+class WebsocketProtocol : public Protocol {
+public:
+  WebsocketProtocol();
+  ~WebsocketProtocol();
+
+  bool Start() override;
+  bool OpenAudioChannel() override;
+  void SendAudio(const AudioStreamPacket& packet) override;
+  void CloseAudioChannel() override;
+  bool IsAudioChannelOpened() const override;
+  NetworkStats GetNetworkStats() const override;
+
+private:
+  bool SendText(const std::string& text) override;
+  void ParseServerHello(const cJSON* root);
+  void OnIncomingBinary(const uint8_t* data, size_t len);
+  void CheckAlive();
+
+  WebSocket* websocket_ = nullptr;
+  int version_ = 1;
+  esp_timer_handle_t ping_timer_ = nullptr;
+
+  mutable std::mutex channel_mutex_;
+  // Size of the last audio frame sent, to count the socket backlog in frames
+  std::atomic<size_t> audio_frame_bytes_ = 0;
+
+  std::mutex server_hello_mtx_;
+  std::condition_variable cnd_server_hello_;
+  bool hello_responsed_ = false;
+};
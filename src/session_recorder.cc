@@ -0,0 +1,324 @@
+#include "session_recorder.h"
+#include "impl/file_io.h"
+#include "trace.h"
+#include <esp_log.h>
+#include <opus.h>
+#include <filesystem>
+#include <random>
+#include <chrono>
+#include <ctime>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+#define TAG "SessionRecorder"
+
+namespace {
+
+// The writer wakes up when this much is queued, or after kFlushInterval
+constexpr size_t kBatchBytes = 16 * 1024;
+constexpr auto kFlushInterval = std::chrono::milliseconds(500);
+// Beyond this the writer is considered stuck and packets are dropped
+constexpr size_t kMaxPendingBytes = 256 * 1024;
+// About a second of audio per page at 60 ms frames
+constexpr int kPacketsPerPage = 16;
+
+constexpr uint8_t kPageBos = 0x02;
+constexpr uint8_t kPageEos = 0x04;
+
+// Ogg uses the unreflected CRC-32 with polynomial 0x04c11db7
+uint32_t OggCrc(uint32_t crc, const uint8_t* data, size_t size) {
+    static const auto table = [] {
+        std::vector<uint32_t> table(256);
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t r = i << 24;
+            for (int j = 0; j < 8; j++) {
+                r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : (r << 1);
+            }
+            table[i] = r;
+        }
+        return table;
+    }();
+    for (size_t i = 0; i < size; i++) {
+        crc = (crc << 8) ^ table[((crc >> 24) ^ data[i]) & 0xff];
+    }
+    return crc;
+}
+
+void PutLE16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(value & 0xff);
+    out.push_back(value >> 8);
+}
+
+void PutLE32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back((value >> (8 * i)) & 0xff);
+    }
+}
+
+void PutLE64(std::vector<uint8_t>& out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out.push_back((value >> (8 * i)) & 0xff);
+    }
+}
+
+} // namespace
+
+SessionRecorder::SessionRecorder() {
+}
+
+SessionRecorder::~SessionRecorder() {
+    Stop();
+}
+
+bool SessionRecorder::Start(const std::string& directory, const std::string& session_id,
+                            int uplink_sample_rate, int downlink_sample_rate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (recording_) {
+        return true;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+
+    char time_str[32];
+    auto now = std::time(nullptr);
+    std::strftime(time_str, sizeof(time_str), "%Y%m%d-%H%M%S", std::localtime(&now));
+    std::string base = time_str;
+    if (!session_id.empty()) {
+        base += "_" + session_id;
+    }
+
+    const char* suffixes[2] = {"_up.opus", "_down.opus"};
+    const int sample_rates[2] = {uplink_sample_rate, downlink_sample_rate};
+    std::random_device random;
+    for (int i = 0; i < 2; i++) {
+        auto path = std::filesystem::path(directory) / (base + suffixes[i]);
+        streams_[i] = OggStream();
+        streams_[i].fd = file_open(path, kFileTruncate);
+        if (streams_[i].fd < 0) {
+            ESP_LOGE(TAG, "Failed to create %s", path.string().c_str());
+            for (int j = 0; j < i; j++) {
+                file_close(streams_[j].fd);
+                streams_[j].fd = -1;
+            }
+            return false;
+        }
+        streams_[i].serial = random();
+        pages_[i].clear();
+        WriteHeaders(streams_[i], pages_[i], sample_rates[i]);
+        WritePages(streams_[i].fd, pages_[i]);
+    }
+
+    pending_.clear();
+    pending_bytes_ = 0;
+    dropped_packets_ = 0;
+    stopping_ = false;
+    writer_ = std::thread(&SessionRecorder::WriterLoop, this);
+    recording_ = true;
+    ESP_LOGI(TAG, "Recording session to %s/%s", directory.c_str(), base.c_str());
+    return true;
+}
+
+void SessionRecorder::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!recording_) {
+            return;
+        }
+        recording_ = false;
+        stopping_ = true;
+    }
+    condition_.notify_one();
+    writer_.join();
+
+    if (dropped_packets_ > 0) {
+        ESP_LOGW(TAG, "Recording stopped, %zu packets dropped", dropped_packets_);
+    }
+}
+
+void SessionRecorder::Record(Stream stream, const std::vector<uint8_t>& packet) {
+    if (!recording_ || packet.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+        return;
+    }
+    if (pending_bytes_ + packet.size() > kMaxPendingBytes) {
+        dropped_packets_++;
+        return;
+    }
+    pending_.push_back({stream, packet});
+    pending_bytes_ += packet.size();
+    if (pending_bytes_ >= kBatchBytes) {
+        condition_.notify_one();
+    }
+}
+
+void SessionRecorder::WriterLoop() {
+    Tracer::SetThreadName("recorder");
+    std::vector<Entry> batch;
+    while (true) {
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait_for(lock, kFlushInterval, [this] {
+                return stopping_ || pending_bytes_ >= kBatchBytes;
+            });
+            batch.swap(pending_);
+            pending_bytes_ = 0;
+            stop = stopping_;
+        }
+
+        for (auto& entry : batch) {
+            // 48 kHz granules whatever the coded rate, as Ogg Opus requires
+            int samples = opus_packet_get_nb_samples(entry.packet.data(), (opus_int32)entry.packet.size(), 48000);
+            if (samples <= 0) {
+                continue;
+            }
+            AddPacket(streams_[entry.stream], pages_[entry.stream], entry.packet.data(), entry.packet.size(), samples);
+        }
+        batch.clear();
+
+        for (int i = 0; i < 2; i++) {
+            if (stop) {
+                FlushPage(streams_[i], pages_[i], kPageEos);
+            }
+            WritePages(streams_[i].fd, pages_[i]);
+            if (stop) {
+                file_close(streams_[i].fd);
+                streams_[i].fd = -1;
+            }
+        }
+        if (stop) {
+            break;
+        }
+    }
+}
+
+void SessionRecorder::WriteHeaders(OggStream& ogg, std::vector<Page>& pages, int sample_rate) {
+    std::vector<uint8_t> head;
+    head.insert(head.end(), {'O', 'p', 'u', 's', 'H', 'e', 'a', 'd'});
+    head.push_back(1);  // version
+    head.push_back(1);  // channels
+    PutLE16(head, 0);   // pre-skip, unknown for the server encoder
+    PutLE32(head, sample_rate);
+    PutLE16(head, 0);   // output gain
+    head.push_back(0);  // mapping family
+    AddPacket(ogg, pages, head.data(), head.size(), 0);
+    FlushPage(ogg, pages, kPageBos);
+
+    static const char vendor[] = "xiaozhi-pc";
+    std::vector<uint8_t> tags;
+    tags.insert(tags.end(), {'O', 'p', 'u', 's', 'T', 'a', 'g', 's'});
+    PutLE32(tags, sizeof(vendor) - 1);
+    tags.insert(tags.end(), vendor, vendor + sizeof(vendor) - 1);
+    PutLE32(tags, 0);   // user comments
+    AddPacket(ogg, pages, tags.data(), tags.size(), 0);
+    FlushPage(ogg, pages, 0);
+}
+
+void SessionRecorder::AddPacket(OggStream& ogg, std::vector<Page>& pages, const uint8_t* data, size_t size, uint64_t samples) {
+    size_t segments = size / 255 + 1;
+    if (ogg.lacing.size() + segments > 255) {
+        FlushPage(ogg, pages, 0);
+    }
+
+    for (size_t i = 0; i < segments - 1; i++) {
+        ogg.lacing.push_back(255);
+    }
+    ogg.lacing.push_back(size % 255);
+    ogg.body.insert(ogg.body.end(), data, data + size);
+    ogg.granule += samples;
+    ogg.packets++;
+
+    if (ogg.packets >= kPacketsPerPage) {
+        FlushPage(ogg, pages, 0);
+    }
+}
+
+void SessionRecorder::FlushPage(OggStream& ogg, std::vector<Page>& pages, uint8_t flags) {
+    // Packets never span pages here, no page is ever a continuation
+    if (ogg.lacing.empty() && !(flags & kPageEos)) {
+        return;
+    }
+
+    Page page;
+    auto& header = page.header;
+    header.insert(header.end(), {'O', 'g', 'g', 'S'});
+    header.push_back(0);
+    header.push_back(flags);
+    PutLE64(header, ogg.granule);
+    PutLE32(header, ogg.serial);
+    PutLE32(header, ogg.page_sequence++);
+    PutLE32(header, 0);
+    header.push_back((uint8_t)ogg.lacing.size());
+    header.insert(header.end(), ogg.lacing.begin(), ogg.lacing.end());
+    page.body.swap(ogg.body);
+
+    uint32_t crc = OggCrc(0, header.data(), header.size());
+    crc = OggCrc(crc, page.body.data(), page.body.size());
+    for (int i = 0; i < 4; i++) {
+        header[22 + i] = (crc >> (8 * i)) & 0xff;
+    }
+
+    pages.push_back(std::move(page));
+    ogg.lacing.clear();
+    ogg.body.clear();
+    ogg.packets = 0;
+}
+
+void SessionRecorder::WritePages(int fd, std::vector<Page>& pages) {
+    if (pages.empty() || fd < 0) {
+        pages.clear();
+        return;
+    }
+
+#ifdef _WIN32
+    // No gather write for plain files, coalesce into one write instead
+    std::vector<uint8_t> buffer;
+    for (auto& page : pages) {
+        buffer.insert(buffer.end(), page.header.begin(), page.header.end());
+        buffer.insert(buffer.end(), page.body.begin(), page.body.end());
+    }
+    if (!file_write(fd, buffer.data(), buffer.size())) {
+        ESP_LOGE(TAG, "Failed to write %zu bytes", buffer.size());
+    }
+#else
+    std::vector<iovec> iov;
+    for (auto& page : pages) {
+        iov.push_back({page.header.data(), page.header.size()});
+        if (!page.body.empty()) {
+            iov.push_back({page.body.data(), page.body.size()});
+        }
+    }
+
+    // One system call per batch, unless the kernel takes less than all
+    size_t index = 0;
+    while (index < iov.size()) {
+        int count = (int)std::min<size_t>(iov.size() - index, 1024);
+        ssize_t written = writev(fd, &iov[index], count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ESP_LOGE(TAG, "Failed to write pages: %d", errno);
+            break;
+        }
+        while (index < iov.size() && (size_t)written >= iov[index].iov_len) {
+            written -= iov[index].iov_len;
+            index++;
+        }
+        if (index < iov.size()) {
+            iov[index].iov_base = (uint8_t*)iov[index].iov_base + written;
+            iov[index].iov_len -= written;
+        }
+    }
+#endif
+    pages.clear();
+}
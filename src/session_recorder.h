@@ -0,0 +1,75 @@
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+// Records the opus packets of an audio session as they go over the wire,
+// the uplink and the downlink each into an Ogg Opus file. Packets are
+// only copied into a bounded queue on the caller's thread, a writer thread
+// builds the pages and writes them in batches. When the writer falls
+// behind, packets are dropped instead of holding up the audio path.
+class SessionRecorder {
+public:
+    enum Stream {
+        kUplink = 0,
+        kDownlink = 1,
+    };
+
+    SessionRecorder();
+    ~SessionRecorder();
+
+    bool Start(const std::string& directory, const std::string& session_id,
+               int uplink_sample_rate, int downlink_sample_rate);
+    void Stop();
+    bool IsRecording() const { return recording_; }
+
+    void Record(Stream stream, const std::vector<uint8_t>& packet);
+
+private:
+    struct OggStream {
+        int fd = -1;
+        uint32_t serial = 0;
+        uint32_t page_sequence = 0;
+        uint64_t granule = 0;
+        int packets = 0;
+        std::vector<uint8_t> lacing;
+        std::vector<uint8_t> body;
+    };
+
+    struct Page {
+        std::vector<uint8_t> header;
+        std::vector<uint8_t> body;
+    };
+
+    struct Entry {
+        Stream stream;
+        std::vector<uint8_t> packet;
+    };
+
+    std::atomic<bool> recording_ = false;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::vector<Entry> pending_;
+    size_t pending_bytes_ = 0;
+    size_t dropped_packets_ = 0;
+    bool stopping_ = false;
+    std::thread writer_;
+
+    // Owned by the writer thread while recording
+    OggStream streams_[2];
+    std::vector<Page> pages_[2];
+
+    void WriterLoop();
+    void AddPacket(OggStream& ogg, std::vector<Page>& pages, const uint8_t* data, size_t size, uint64_t samples);
+    void FlushPage(OggStream& ogg, std::vector<Page>& pages, uint8_t flags);
+    void WritePages(int fd, std::vector<Page>& pages);
+    void WriteHeaders(OggStream& ogg, std::vector<Page>& pages, int sample_rate);
+};
+
+#endif // SESSION_RECORDER_H
@@ -5,6 +5,62 @@
 
 #define TAG "Settings"
 
+// Keeps every live Setting in step with the store
+class SettingsRegistry {
+public:
+    static SettingsRegistry& GetInstance() {
+        static SettingsRegistry* instance = new SettingsRegistry();
+        return *instance;
+    }
+
+    void Add(SettingBase* setting) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        settings_.push_back(setting);
+    }
+
+    void Remove(SettingBase* setting) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        for (auto it = settings_.begin(); it != settings_.end(); ++it) {
+            if (*it == setting) {
+                settings_.erase(it);
+                return;
+            }
+        }
+    }
+
+private:
+    // Recursive, a subscriber may change another setting from its callback
+    std::recursive_mutex mutex_;
+    std::vector<SettingBase*> settings_;
+
+    SettingsRegistry() {
+        nvs_port_set_change_callback([](const char* ns, void* arg) {
+            static_cast<SettingsRegistry*>(arg)->OnChanged(ns);
+        }, this);
+    }
+
+    void OnChanged(const char* ns) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        std::vector<SettingBase*> changed;
+        for (auto setting : settings_) {
+            if ((ns == nullptr || setting->ns() == ns) && setting->Refresh()) {
+                changed.push_back(setting);
+            }
+        }
+        for (auto setting : changed) {
+            setting->Notify();
+        }
+    }
+};
+
+void SettingBase::Register() {
+    SettingsRegistry::GetInstance().Add(this);
+}
+
+void SettingBase::Unregister() {
+    SettingsRegistry::GetInstance().Remove(this);
+}
+
 Settings::Settings(const std::string& ns, bool read_write) : ns_(ns), read_write_(read_write) {
     nvs_open(ns.c_str(), read_write_ ? NVS_READWRITE : NVS_READONLY, &nvs_handle_);
 }
@@ -23,14 +79,24 @@ std::string Settings::GetString(const std::string& key, const std::string& defau
         return default_value;
     }
 
-    size_t length = 0;
-    if (nvs_get_str(nvs_handle_, key.c_str(), nullptr, &length) != ESP_OK) {
+    // Most values fit on the stack, which saves the length query
+    char buffer[256];
+    size_t length = sizeof(buffer);
+    int ret = nvs_get_str(nvs_handle_, key.c_str(), buffer, &length);
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
         return default_value;
     }
 
     std::string value;
-    value.resize(length);
-    ESP_ERROR_CHECK(nvs_get_str(nvs_handle_, key.c_str(), value.data(), &length));
+    if (ret == ESP_OK) {
+        value.assign(buffer, length);
+    } else {
+        if (nvs_get_str(nvs_handle_, key.c_str(), nullptr, &length) != ESP_OK) {
+            return default_value;
+        }
+        value.resize(length);
+        ESP_ERROR_CHECK(nvs_get_str(nvs_handle_, key.c_str(), value.data(), &length));
+    }
     while (!value.empty() && value.back() == '\0') {
         value.pop_back();
     }
@@ -72,6 +138,7 @@ void Settings::EraseKey(const std::string& key) {
         auto ret = nvs_erase_key(nvs_handle_, key.c_str());
         if (ret != ESP_ERR_NVS_NOT_FOUND) {
             ESP_ERROR_CHECK(ret);
+            dirty_ = true;
         }
     } else {
         ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
@@ -81,6 +148,7 @@ void Settings::EraseKey(const std::string& key) {
 void Settings::EraseAll() {
     if (read_write_) {
         ESP_ERROR_CHECK(nvs_erase_all(nvs_handle_));
+        dirty_ = true;
     } else {
         ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
     }
@@ -2,6 +2,12 @@
 #define SETTINGS_H
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <type_traits>
 #include <nvs_flash.h>
 
 class Settings {
@@ -23,4 +29,126 @@ private:
     bool dirty_ = false;
 };
 
+// A single key of a namespace, resolved once. The value is kept in memory
+// and refreshed when the store changes (through Settings, another handle
+// or an edit of the config file), so reading an integer is one atomic
+// load. Supported types are int32_t, bool and std::string.
+class SettingBase {
+public:
+    SettingBase(const SettingBase&) = delete;
+    SettingBase& operator=(const SettingBase&) = delete;
+
+    inline const std::string& ns() const { return ns_; }
+    inline const std::string& key() const { return key_; }
+    // Increases with every change of the value
+    inline uint32_t generation() const { return generation_.load(std::memory_order_acquire); }
+
+protected:
+    SettingBase(const std::string& ns, const std::string& key) : ns_(ns), key_(key) {}
+    virtual ~SettingBase() = default;
+
+    // Only a fully constructed setting may be refreshed
+    void Register();
+    void Unregister();
+
+    // Re-read the store, returns true when the value changed
+    virtual bool Refresh() = 0;
+    virtual void Notify() = 0;
+
+    const std::string ns_;
+    const std::string key_;
+    std::atomic<uint32_t> generation_ = 0;
+
+    friend class SettingsRegistry;
+};
+
+template <typename T>
+class Setting : public SettingBase {
+    static_assert(std::is_same_v<T, int32_t> || std::is_same_v<T, bool> || std::is_same_v<T, std::string>,
+                  "unsupported setting type");
+
+public:
+    Setting(const std::string& ns, const std::string& key, T default_value = T())
+        : SettingBase(ns, key), default_value_(std::move(default_value)) {
+        Store(Read());
+        Register();
+    }
+
+    ~Setting() override {
+        Unregister();
+    }
+
+    T Get() const {
+        if constexpr (std::is_same_v<T, std::string>) {
+            return *std::atomic_load(&value_);
+        } else {
+            return value_.load(std::memory_order_acquire);
+        }
+    }
+
+    void Set(const T& value) {
+        Settings settings(ns_, true);
+        if constexpr (std::is_same_v<T, std::string>) {
+            settings.SetString(key_, value);
+        } else {
+            settings.SetInt(key_, value);
+        }
+    }
+
+    // Called on the thread that changed the value, with the new value
+    void Subscribe(std::function<void(const T&)> callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        subscribers_.push_back(std::move(callback));
+    }
+
+private:
+    using Storage = std::conditional_t<std::is_same_v<T, std::string>, std::shared_ptr<const std::string>, std::atomic<T>>;
+
+    const T default_value_;
+    Storage value_;
+    std::mutex mutex_;
+    std::vector<std::function<void(const T&)>> subscribers_;
+
+    T Read() {
+        Settings settings(ns_, false);
+        if constexpr (std::is_same_v<T, std::string>) {
+            return settings.GetString(key_, default_value_);
+        } else if constexpr (std::is_same_v<T, bool>) {
+            return settings.GetInt(key_, default_value_ ? 1 : 0) != 0;
+        } else {
+            return settings.GetInt(key_, default_value_);
+        }
+    }
+
+    void Store(const T& value) {
+        if constexpr (std::is_same_v<T, std::string>) {
+            std::atomic_store(&value_, std::make_shared<const std::string>(value));
+        } else {
+            value_.store(value, std::memory_order_release);
+        }
+    }
+
+    bool Refresh() override {
+        T value = Read();
+        if (value == Get()) {
+            return false;
+        }
+        Store(value);
+        generation_.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+
+    void Notify() override {
+        T value = Get();
+        std::vector<std::function<void(const T&)>> subscribers;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            subscribers = subscribers_;
+        }
+        for (auto& callback : subscribers) {
+            callback(value);
+        }
+    }
+};
+
 #endif
@@ -0,0 +1,151 @@
+#include "sound_cache.h"
+#include "impl/opus_wrapper.h"
+#include "metrics.h"
+#include <esp_log.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#define TAG "SoundCache"
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+constexpr size_t kP3HeaderSize = 4;
+// Edges of each tone, so they start and stop without a click
+constexpr int kToneFadeMs = 5;
+
+struct Tone {
+    // 0 for a pause
+    float hz;
+    int ms;
+};
+
+void AppendTones(std::vector<int16_t>& pcm, int sample_rate, std::initializer_list<Tone> tones, float amplitude) {
+    for (auto& tone : tones) {
+        size_t count = (size_t)sample_rate * tone.ms / 1000;
+        size_t fade = std::min(count / 2, (size_t)sample_rate * kToneFadeMs / 1000);
+        for (size_t i = 0; i < count; i++) {
+            float envelope = 1.0f;
+            if (i < fade) {
+                envelope = (float)i / fade;
+            } else if (i >= count - fade) {
+                envelope = (float)(count - i) / fade;
+            }
+            double phase = 2 * kPi * tone.hz * i / sample_rate;
+            pcm.push_back((int16_t)(amplitude * envelope * std::sin(phase)));
+        }
+    }
+}
+
+// "success.p3" is known as "P3_SUCCESS"
+std::string NameForFile(const std::filesystem::path& path) {
+    std::string name = "P3_" + path.stem().string();
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) {
+        return (char)std::toupper(c);
+    });
+    return name;
+}
+
+} // namespace
+
+bool SoundCache::ParseP3(const uint8_t* data, size_t size, std::vector<std::vector<uint8_t>>& packets) {
+    size_t offset = 0;
+    while (offset < size) {
+        if (size - offset < kP3HeaderSize) {
+            return false;
+        }
+        size_t payload = ((size_t)data[offset + 2] << 8) | data[offset + 3];
+        offset += kP3HeaderSize;
+        if (size - offset < payload) {
+            return false;
+        }
+        packets.emplace_back(data + offset, data + offset + payload);
+        offset += payload;
+    }
+    return true;
+}
+
+void SoundCache::Add(const std::string& name, std::vector<int16_t>&& pcm) {
+    auto& slot = sounds_[name];
+    if (slot) {
+        total_samples_ -= slot->size();
+    }
+    total_samples_ += pcm.size();
+    slot = std::make_shared<const std::vector<int16_t>>(std::move(pcm));
+}
+
+// Stand-ins for the firmware prompts
+void SoundCache::AddBuiltInSounds() {
+    std::vector<int16_t> pcm;
+    AppendTones(pcm, sample_rate_, {{660, 90}, {0, 30}, {990, 140}}, 8000);
+    Add("P3_SUCCESS", std::move(pcm));
+
+    pcm.clear();
+    AppendTones(pcm, sample_rate_, {{880, 80}, {0, 60}, {880, 80}, {0, 60}, {880, 80}}, 9000);
+    Add("P3_EXCLAMATION", std::move(pcm));
+
+    pcm.clear();
+    AppendTones(pcm, sample_rate_, {{150, 120}, {0, 60}, {150, 120}, {0, 60}, {150, 120}}, 12000);
+    Add("P3_VIBRATION", std::move(pcm));
+}
+
+bool SoundCache::LoadFile(const std::string& path, std::vector<int16_t>& pcm) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::vector<std::vector<uint8_t>> packets;
+    if (!ParseP3(data.data(), data.size(), packets)) {
+        ESP_LOGW(TAG, "%s is truncated", path.c_str());
+        return false;
+    }
+
+    // The assets are mono 60 ms frames, Opus decodes them at any rate
+    OpusDecoderWrapper decoder(sample_rate_, 1, 60);
+    std::vector<int16_t> frame;
+    for (auto& packet : packets) {
+        if (!decoder.Decode(std::move(packet), frame)) {
+            ESP_LOGW(TAG, "%s has a packet that does not decode", path.c_str());
+            return false;
+        }
+        pcm.insert(pcm.end(), frame.begin(), frame.end());
+    }
+    return !pcm.empty();
+}
+
+void SoundCache::Load(const std::string& directory, int sample_rate) {
+    sample_rate_ = sample_rate;
+    auto start = std::chrono::steady_clock::now();
+    AddBuiltInSounds();
+
+    int loaded = 0;
+    std::error_code ec;
+    for (auto it = std::filesystem::directory_iterator(directory, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        if (!it->is_regular_file() || it->path().extension() != ".p3") {
+            continue;
+        }
+        std::vector<int16_t> pcm;
+        if (LoadFile(it->path().string(), pcm)) {
+            Add(NameForFile(it->path()), std::move(pcm));
+            loaded++;
+        }
+    }
+
+    static auto& bytes = Metrics::GetInstance().GetGauge("xiaozhi_sound_cache_bytes",
+        "Memory held by the decoded prompt sounds.");
+    bytes.Set((double)total_samples_ * sizeof(int16_t));
+    auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    ESP_LOGI(TAG, "%zu sounds, %d from %s, %.1f s of audio decoded in %.1f ms", sounds_.size(), loaded,
+        directory.c_str(), (double)total_samples_ / sample_rate_, ms);
+}
+
+SoundCache::Pcm SoundCache::Get(std::string_view name) const {
+    auto it = sounds_.find(std::string(name));
+    return it == sounds_.end() ? nullptr : it->second;
+}
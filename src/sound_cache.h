@@ -0,0 +1,46 @@
+#ifndef SOUND_CACHE_H
+#define SOUND_CACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Prompt sounds, decoded to PCM at the playback rate once at startup and
+// kept in memory, so playing one is a copy into the prompt channel with no
+// decoder involved.
+//
+// Sounds are P3 files, the firmware's asset format: a sequence of Opus
+// packets, each behind a 4 byte header of type, reserved and the payload
+// size in big endian. They are looked up by the names the firmware uses,
+// "P3_SUCCESS" is success.p3 in the sounds directory. Names without a
+// file fall back to a few tones synthesized here, so the prompts work
+// without any assets.
+class SoundCache {
+public:
+    using Pcm = std::shared_ptr<const std::vector<int16_t>>;
+
+    // Decodes every .p3 file of the directory to sample_rate, replacing the
+    // built-in tones of the same name. Not thread safe, called before any
+    // Get.
+    void Load(const std::string& directory, int sample_rate);
+
+    // nullptr when there is no such sound
+    Pcm Get(std::string_view name) const;
+
+    // Splits a P3 file into its Opus packets, false if it is truncated
+    static bool ParseP3(const uint8_t* data, size_t size, std::vector<std::vector<uint8_t>>& packets);
+
+private:
+    int sample_rate_ = 16000;
+    std::unordered_map<std::string, Pcm> sounds_;
+    size_t total_samples_ = 0;
+
+    void Add(const std::string& name, std::vector<int16_t>&& pcm);
+    void AddBuiltInSounds();
+    bool LoadFile(const std::string& path, std::vector<int16_t>& pcm);
+};
+
+#endif // SOUND_CACHE_H
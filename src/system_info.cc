@@ -1,7 +1,14 @@
 #include "system_info.h"
+#include "impl/process_stats.h"
 
-//#include <freertos/task.h>
+#include <freertos/task.h>
 #include <esp_log.h>
+#include <esp_port.h>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <unordered_map>
 //#include <esp_flash.h>
 //#include <esp_mac.h>
 //#include <esp_system.h>
@@ -37,12 +44,28 @@ size_t SystemInfo::GetFlashSize() {
     return 16777216;
 }
 
+namespace {
+// Low watermark of every GetFreeHeapSize so far
+std::atomic<size_t> minimum_free_heap = SIZE_MAX;
+}
+
+// There is no fixed heap on a PC, the memory the system can still hand
+// out is the closest match
 size_t SystemInfo::GetMinimumFreeHeapSize() {
-    return 8318916;
+    GetFreeHeapSize();
+    size_t minimum = minimum_free_heap.load();
+    return minimum == SIZE_MAX ? 0 : minimum;
 }
 
 size_t SystemInfo::GetFreeHeapSize() {
-    return 8318916;
+    size_t free = ReadAvailableMemory();
+    if (free == 0) {
+        return 0;
+    }
+    size_t minimum = minimum_free_heap.load();
+    while (free < minimum && !minimum_free_heap.compare_exchange_weak(minimum, free)) {
+    }
+    return free;
 }
 
 std::string SystemInfo::GetMacAddress() {
@@ -53,6 +76,43 @@ std::string SystemInfo::GetChipModelName() {
     return "esp32s3";
 }
 
+// Same report as on the device: CPU time of every thread over the interval
 esp_err_t SystemInfo::PrintRealTimeStats(TickType_t xTicksToWait) {
-    return 0;
+    std::vector<ThreadCpuTime> start, end;
+    if (!ReadThreadCpuTimes(start)) {
+        return ESP_ERR;
+    }
+    auto start_time = std::chrono::steady_clock::now();
+    vTaskDelay(xTicksToWait);
+    if (!ReadThreadCpuTimes(end)) {
+        return ESP_ERR;
+    }
+    auto elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+    if (elapsed_us <= 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    std::unordered_map<int, uint64_t> start_times;
+    for (auto& thread : start) {
+        start_times[thread.id] = thread.cpu_us;
+    }
+    std::sort(end.begin(), end.end(), [](const ThreadCpuTime& a, const ThreadCpuTime& b) {
+        return a.cpu_us > b.cpu_us;
+    });
+
+    printf("| Task | Run Time | Percentage\n");
+    for (auto& thread : end) {
+        auto it = start_times.find(thread.id);
+        if (it == start_times.end()) {
+            printf("| %s | Created\n", thread.name.c_str());
+            continue;
+        }
+        uint64_t run_us = thread.cpu_us - it->second;
+        printf("| %s | %llu | %.1f%%\n", thread.name.c_str(), (unsigned long long)run_us, run_us * 100.0 / elapsed_us);
+        start_times.erase(it);
+    }
+    for (auto& it : start_times) {
+        printf("| %d | Deleted\n", it.first);
+    }
+    return ESP_OK;
 }
@@ -0,0 +1,111 @@
+// Times the DSP kernels of every version the CPU can run, and the noise
+// suppressor. Not a test, run it by hand on the machine that matters.
+#include "impl/dsp_kernels.h"
+#include "audio_processing/noise_suppressor.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::vector<int16_t> MakeSamples(std::mt19937& random, size_t count) {
+  std::uniform_int_distribution<int> distribution(-32768, 32767);
+  std::vector<int16_t> samples(count);
+  for (auto& sample : samples) {
+    sample = (int16_t)distribution(random);
+  }
+  return samples;
+}
+
+void BenchmarkDspKernels() {
+  const DspKernels* available[3];
+  size_t count = GetAvailableDspKernels(available, 3);
+
+  // One 60 ms frame at 16 kHz, in a loop long enough to time
+  constexpr size_t kSamples = 960;
+  constexpr int kIterations = 2000;
+  std::mt19937 random(1);
+  auto input = MakeSamples(random, kSamples * 2);
+  auto source = MakeSamples(random, kSamples * 2);
+  std::vector<float> gains(kSamples, 0.8f);
+  std::vector<float> floats(kSamples);
+  std::vector<int16_t> work(kSamples * 2);
+  volatile uint64_t sink = 0;
+
+  struct Kernel {
+    const char* name;
+    std::function<void(const DspKernels&)> run;
+  };
+  const Kernel kernels[] = {
+    {"gain", [&](const DspKernels& k) { k.gain(work.data(), kSamples, 0.8f); }},
+    {"gain_ramp", [&](const DspKernels& k) { k.gain_ramp(work.data(), kSamples, 0.8f, 1.0f); }},
+    {"gain_curve", [&](const DspKernels& k) { k.gain_curve(work.data(), gains.data(), kSamples); }},
+    {"mix", [&](const DspKernels& k) { k.mix(work.data(), source.data(), kSamples, 0.5f); }},
+    {"to_float", [&](const DspKernels& k) { k.to_float(work.data(), floats.data(), kSamples); }},
+    {"from_float", [&](const DspKernels& k) { k.from_float(floats.data(), work.data(), kSamples); }},
+    {"peak", [&](const DspKernels& k) { sink = sink + k.peak(work.data(), kSamples); }},
+    {"sum_of_squares", [&](const DspKernels& k) { sink = sink + k.sum_of_squares(work.data(), kSamples); }},
+    {"downmix_stereo", [&](const DspKernels& k) { k.downmix_stereo(source.data(), work.data(), kSamples); }},
+  };
+
+  std::string header = "ns per 960 samples";
+  for (size_t v = 0; v < count; v++) {
+    header += std::string("  ") + available[v]->name;
+  }
+  printf("%s\n", header.c_str());
+  for (auto& kernel : kernels) {
+    std::string line = kernel.name;
+    line.resize(18, ' ');
+    for (size_t v = 0; v < count; v++) {
+      work = input;
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < kIterations; i++) {
+        kernel.run(*available[v]);
+      }
+      double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+      char cell[32];
+      snprintf(cell, sizeof(cell), "  %*.0f", (int)strlen(available[v]->name), ns / kIterations);
+      line += cell;
+    }
+    printf("%s\n", line.c_str());
+  }
+}
+
+// Average cost of a 60 ms frame of noisy speech like input
+void BenchmarkNoiseSuppressor(int sample_rate, int frames) {
+  constexpr double kPi = 3.14159265358979323846;
+  NoiseSuppressor suppressor(sample_rate);
+  size_t frame_samples = sample_rate * 60 / 1000;
+  std::vector<int16_t> input(frame_samples * 16);
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < input.size(); i++) {
+    seed = seed * 1664525 + 1013904223;
+    double noise = (int32_t)(seed >> 16) % 2000 - 1000;
+    double tone = (i / frame_samples) % 4 < 2 ? 8000 * std::sin(2 * kPi * 440 * i / sample_rate) : 0;
+    input[i] = (int16_t)(noise + tone);
+  }
+
+  std::vector<int16_t> frame(frame_samples);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < frames; i++) {
+    size_t offset = (i % 16) * frame_samples;
+    std::copy(input.begin() + offset, input.begin() + offset + frame_samples, frame.begin());
+    suppressor.Process(frame.data(), frame.size());
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("noise suppression at %d Hz: %.0f ns per 60 ms frame\n", sample_rate, ns / frames);
+}
+
+} // namespace
+
+int main() {
+  BenchmarkDspKernels();
+  BenchmarkNoiseSuppressor(16000, 500);
+  return 0;
+}
@@ -0,0 +1,163 @@
+// Checks the DSP kernels on a few hand computed values, then compares
+// every version the CPU can run with the scalar one, exactly, on random
+// signals with the extremes in them. Exits non-zero on any failure.
+#include "impl/dsp_kernels.h"
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+std::vector<int16_t> MakeSamples(std::mt19937& random, size_t count) {
+  std::uniform_int_distribution<int> distribution(-32768, 32767);
+  std::vector<int16_t> samples(count);
+  for (auto& sample : samples) {
+    sample = (int16_t)distribution(random);
+  }
+  for (size_t i = 0; i < count; i += 37) {
+    samples[i] = i % 2 ? 32767 : -32768;
+  }
+  return samples;
+}
+
+// Known answers, so the scalar reference itself is checked too
+bool CheckValues(const DspKernels& kernels) {
+  bool ok = true;
+  auto check = [&](const char* what, bool right) {
+    if (!right) {
+      printf("%s %s gives a wrong result\n", kernels.name, what);
+      ok = false;
+    }
+  };
+
+  std::vector<int16_t> samples = {100, -100, 30000, -30000};
+  kernels.gain(samples.data(), samples.size(), 0.37f);
+  check("gain", samples == std::vector<int16_t>{37, -37, 11100, -11100});
+  samples = {100, -100, 30000, -30000};
+  kernels.gain(samples.data(), samples.size(), 2.0f);
+  check("gain saturation", samples == std::vector<int16_t>{200, -200, 32767, -32768});
+
+  samples = {1000, 1000, 1000, 1000};
+  kernels.gain_ramp(samples.data(), samples.size(), 0.0f, 1.0f);
+  check("gain_ramp", samples == std::vector<int16_t>{0, 250, 500, 750});
+
+  samples = {1000, 1000, 1000};
+  std::vector<float> gains = {0.5f, 0.0f, 3.0f};
+  kernels.gain_curve(samples.data(), gains.data(), samples.size());
+  check("gain_curve", samples == std::vector<int16_t>{500, 0, 3000});
+
+  samples = {30000, -30000, 100, -32768};
+  std::vector<int16_t> source = {10000, -10000, 50, 0};
+  kernels.mix(samples.data(), source.data(), samples.size(), 1.0f);
+  check("mix saturation", samples == std::vector<int16_t>{32767, -32768, 150, -32768});
+
+  std::vector<float> floats(2);
+  samples = {32767, -32768};
+  kernels.to_float(samples.data(), floats.data(), 2);
+  check("to_float", floats[0] == 32767.0f && floats[1] == -32768.0f);
+  floats = {40000.0f, -1e6f, 12.4f, -12.6f};
+  samples.assign(4, 0);
+  kernels.from_float(floats.data(), samples.data(), 4);
+  check("from_float", samples == std::vector<int16_t>{32767, -32768, 12, -13});
+
+  samples = {5, -32768, 7};
+  check("peak", kernels.peak(samples.data(), samples.size()) == 32768);
+  check("sum_of_squares", kernels.sum_of_squares(samples.data(), samples.size()) == 25 + 1073741824ull + 49);
+
+  std::vector<int16_t> stereo = {3, 4, -3, -4, 32767, 32767};
+  samples.assign(3, 0);
+  kernels.downmix_stereo(stereo.data(), samples.data(), 3);
+  check("downmix_stereo", samples == std::vector<int16_t>{3, -4, 32767});
+  return ok;
+}
+
+bool Check(const DspKernels& kernels) {
+  const DspKernels& reference = *GetScalarDspKernels();
+  std::mt19937 random(1);
+  bool ok = true;
+  auto check = [&](const char* kernel, size_t count, bool same) {
+    if (!same) {
+      printf("%s %s differs from the scalar version on %zu samples\n", kernels.name, kernel, count);
+      ok = false;
+    }
+  };
+
+  // Lengths around the vector widths, and an odd offset so the loads are
+  // unaligned
+  for (size_t count : {0, 1, 7, 8, 15, 16, 17, 31, 33, 960}) {
+    auto input = MakeSamples(random, count + 1);
+    auto other = MakeSamples(random, count + 1);
+    std::vector<float> gains(count);
+    for (size_t i = 0; i < count; i++) {
+      gains[i] = 0.01f * (float)(i % 300);
+    }
+
+    for (float gain : {0.0f, 0.37f, 1.0f, 2.9f}) {
+      auto a = input, b = input;
+      reference.gain(a.data() + 1, count, gain);
+      kernels.gain(b.data() + 1, count, gain);
+      check("gain", count, a == b);
+
+      a = input, b = input;
+      reference.gain_ramp(a.data() + 1, count, gain, 1.5f - gain);
+      kernels.gain_ramp(b.data() + 1, count, gain, 1.5f - gain);
+      check("gain_ramp", count, a == b);
+
+      a = input, b = input;
+      reference.mix(a.data() + 1, other.data() + 1, count, gain);
+      kernels.mix(b.data() + 1, other.data() + 1, count, gain);
+      check("mix", count, a == b);
+    }
+
+    auto a = input, b = input;
+    reference.gain_curve(a.data() + 1, gains.data(), count);
+    kernels.gain_curve(b.data() + 1, gains.data(), count);
+    check("gain_curve", count, a == b);
+
+    std::vector<float> floats_a(count), floats_b(count);
+    reference.to_float(input.data() + 1, floats_a.data(), count);
+    kernels.to_float(input.data() + 1, floats_b.data(), count);
+    check("to_float", count, floats_a == floats_b);
+
+    // Out of range values as well
+    for (size_t i = 0; i < count; i++) {
+      floats_a[i] = floats_a[i] * 1.3f + 0.5f;
+    }
+    a = input, b = input;
+    reference.from_float(floats_a.data(), a.data() + 1, count);
+    kernels.from_float(floats_a.data(), b.data() + 1, count);
+    check("from_float", count, a == b);
+
+    check("peak", count, reference.peak(input.data() + 1, count) == kernels.peak(input.data() + 1, count));
+    check("sum_of_squares", count,
+        reference.sum_of_squares(input.data() + 1, count) == kernels.sum_of_squares(input.data() + 1, count));
+
+    a.assign(count / 2 + 1, 0), b.assign(count / 2 + 1, 0);
+    reference.downmix_stereo(input.data() + 1, a.data(), count / 2);
+    kernels.downmix_stereo(input.data() + 1, b.data(), count / 2);
+    check("downmix_stereo", count, a == b);
+  }
+  return ok;
+}
+
+} // namespace
+
+int main() {
+  const DspKernels* available[3];
+  size_t count = GetAvailableDspKernels(available, 3);
+  bool ok = true;
+  for (size_t i = 0; i < count; i++) {
+    bool right = CheckValues(*available[i]);
+    bool same = i == 0 || Check(*available[i]);
+    printf("%s: %s\n", available[i]->name, right && same ? "ok" : "FAILED");
+    ok = ok && right && same;
+  }
+  // The runtime pick must be one of the versions checked above
+  const DspKernels* picked = &GetDspKernels();
+  bool known = false;
+  for (size_t i = 0; i < count; i++) {
+    known = known || picked == available[i];
+  }
+  printf("picked: %s%s\n", picked->name, known ? "" : ", not one of the checked versions");
+  return ok && known ? 0 : 1;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <functional>
+
+// Stands in for the real Application in tests of code that only schedules
+// work on the main loop; the test defines both members
+class Application {
+public:
+  static Application& GetInstance();
+  void Schedule(std::function<void()> callback);
+};
@@ -0,0 +1,123 @@
+// Drives MqttProtocol over a fake MQTT broker and a fake UDP socket whose
+// send queue the test fills and drains, and checks that uplink audio
+// resumes once the queue has drained.
+#include "protocols/mqtt_protocol.h"
+#include "application.h"
+#include "board.h"
+#include "settings.h"
+#include <cstdio>
+
+namespace {
+
+// Answers the client hello right away with a UDP channel
+class FakeMqtt : public Mqtt {
+public:
+  bool Connect(const std::string, int, const std::string, const std::string, const std::string) override {
+    return true;
+  }
+  void Disconnect() override {}
+  bool Publish(const std::string, const std::string payload, int) override {
+    if (payload.find("\"type\":\"hello\"") != std::string::npos && on_message_callback_) {
+      on_message_callback_("devices/test",
+          "{\"type\":\"hello\",\"transport\":\"udp\",\"session_id\":\"test\","
+          "\"udp\":{\"server\":\"127.0.0.1\",\"port\":8846,\"encryption\":\"aes-128-ctr\","
+          "\"key\":\"0585a874cc7cde39af478c7c634c3bcb\",\"nonce\":\"010000005cfd85170000000000000000\"}}");
+    }
+    return true;
+  }
+  bool Subscribe(const std::string, int) override { return true; }
+  bool Unsubscribe(const std::string) override { return true; }
+  bool IsConnected() override { return true; }
+};
+
+// The queue only changes when the test says so, like a socket whose
+// buffer the reactor drains on its own
+class FakeUdp : public Udp {
+public:
+  size_t sent = 0;
+  size_t queued = 0;
+
+  bool Connect(const std::string&, int) override {
+    connected_ = true;
+    return true;
+  }
+  void Disconnect() override { connected_ = false; }
+  int Send(const std::string& data) override {
+    sent++;
+    return (int)data.size();
+  }
+  size_t GetSendQueueSize() override { return queued; }
+};
+
+FakeUdp* udp = nullptr;
+
+class TestBoard : public Board {
+public:
+  std::string GetBoardType() override { return "test"; }
+  AudioCodec* GetAudioCodec() override { return nullptr; }
+  Http* CreateHttp() override { return nullptr; }
+  WebSocket* CreateWebSocket() override { return nullptr; }
+  Mqtt* CreateMqtt() override { return new FakeMqtt(); }
+  Udp* CreateUdp() override { return udp = new FakeUdp(); }
+  void StartNetwork() override {}
+  const char* GetNetworkStateIcon() override { return ""; }
+  void SetPowerSaveMode(bool) override {}
+  std::string GetBoardJson() override { return "{}"; }
+};
+
+bool ok = true;
+
+void Expect(bool condition, const char* what) {
+  printf("%s: %s\n", what, condition ? "ok" : "FAILED");
+  ok = ok && condition;
+}
+
+AudioStreamPacket MakePacket() {
+  AudioStreamPacket packet;
+  // Longer than a DTX frame, so it is sent
+  packet.payload.assign(40, 0x55);
+  return packet;
+}
+
+} // namespace
+
+DECLARE_BOARD(TestBoard)
+
+Application& Application::GetInstance() {
+  static Application* instance = new Application();
+  return *instance;
+}
+
+void Application::Schedule(std::function<void()> callback) {
+  callback();
+}
+
+int main() {
+  {
+    Settings settings("mqtt", true);
+    settings.SetString("endpoint", "127.0.0.1:1883");
+    settings.SetString("publish_topic", "devices/test");
+  }
+
+  MqttProtocol protocol;
+  Expect(protocol.Start(), "start");
+  Expect(protocol.OpenAudioChannel() && udp != nullptr, "open the audio channel");
+  Expect(!protocol.IsAudioChannelBusy(), "idle channel not busy");
+
+  protocol.SendAudio(MakePacket());
+  Expect(udp->sent == 1, "packet sent");
+
+  // Backpressure: the application stops encoding and sending
+  udp->queued = 4;
+  Expect(protocol.IsAudioChannelBusy(), "busy while the queue is full");
+
+  // The reactor drains the queue with no SendAudio in between
+  udp->queued = 0;
+  Expect(!protocol.IsAudioChannelBusy(), "not busy once the queue has drained");
+  protocol.SendAudio(MakePacket());
+  Expect(udp->sent == 2, "uplink resumes");
+
+  protocol.CloseAudioChannel();
+  Expect(!protocol.IsAudioChannelBusy(), "closed channel not busy");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+#include "trace.h"
+#include "impl/file_io.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define TAG "Tracer"
+
+namespace {
+
+// Per thread, at 24 bytes each; a few minutes of the audio path
+constexpr size_t kEventsPerThread = 16384;
+
+thread_local std::string t_thread_name;
+
+void AppendJsonString(std::string& out, const char* value) {
+    out += '"';
+    for (const char* p = value; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            out += '\\';
+        }
+        if ((unsigned char)*p >= 0x20) {
+            out += *p;
+        }
+    }
+    out += '"';
+}
+
+int ProcessId() {
+#ifdef _WIN32
+    return (int)GetCurrentProcessId();
+#else
+    return (int)getpid();
+#endif
+}
+
+} // namespace
+
+thread_local Tracer::ThreadBuffer* Tracer::local_buffer_ = nullptr;
+
+int64_t TraceScope::Now() {
+    return esp_timer_get_time();
+}
+
+void Tracer::Start() {
+    if (!enabled_.exchange(true)) {
+        ESP_LOGI(TAG, "Tracing started");
+    }
+}
+
+void Tracer::Stop() {
+    if (enabled_.exchange(false)) {
+        ESP_LOGI(TAG, "Tracing stopped");
+    }
+}
+
+Tracer::ThreadBuffer* Tracer::LocalBuffer() {
+    if (local_buffer_ == nullptr) {
+        auto buffer = std::make_shared<ThreadBuffer>();
+        buffer->name = t_thread_name;
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffer->id = next_thread_id_++;
+        buffers_.push_back(buffer);
+        local_buffer_ = buffer.get();
+    }
+    return local_buffer_;
+}
+
+void Tracer::Append(const Event& event) {
+    auto buffer = LocalBuffer();
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    if (buffer->events.size() < kEventsPerThread) {
+        buffer->events.push_back(event);
+        return;
+    }
+    buffer->events[buffer->next] = event;
+    buffer->next = (buffer->next + 1) % kEventsPerThread;
+}
+
+void Tracer::Record(const char* name, int64_t start_us, int64_t duration_us) {
+    Append({name, start_us, duration_us});
+}
+
+void Tracer::RecordInstant(const char* name) {
+    Append({name, esp_timer_get_time(), -1});
+}
+
+std::string Tracer::ExportJson() {
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffers = buffers_;
+    }
+
+    int pid = ProcessId();
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    char line[160];
+    auto separator = [&out, &first]() {
+        if (!first) {
+            out += ",\n";
+        }
+        first = false;
+    };
+
+    std::vector<Event> events;
+    for (auto& buffer : buffers) {
+        std::string name;
+        {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            name = buffer->name;
+            // Oldest first, next is only non-zero once the buffer is full
+            events.assign(buffer->events.begin() + buffer->next, buffer->events.end());
+            events.insert(events.end(), buffer->events.begin(), buffer->events.begin() + buffer->next);
+        }
+
+        separator();
+        snprintf(line, sizeof(line), "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", pid, buffer->id);
+        out += line;
+        AppendJsonString(out, name.empty() ? ("thread " + std::to_string(buffer->id)).c_str() : name.c_str());
+        out += "}}";
+
+        for (auto& event : events) {
+            separator();
+            out += "{\"name\":";
+            AppendJsonString(out, event.name);
+            if (event.duration_us >= 0) {
+                snprintf(line, sizeof(line), ",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+                         pid, buffer->id, (long long)event.start_us, (long long)event.duration_us);
+            } else {
+                snprintf(line, sizeof(line), ",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%lld}",
+                         pid, buffer->id, (long long)event.start_us);
+            }
+            out += line;
+        }
+    }
+    out += "\n]}\n";
+    return out;
+}
+
+bool Tracer::WriteJson(const std::string& path) {
+    std::string json = ExportJson();
+    int fd = file_open(path, kFileTruncate);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "Failed to create %s", path.c_str());
+        return false;
+    }
+    bool ok = file_write(fd, json.data(), json.size());
+    file_close(fd);
+    if (ok) {
+        ESP_LOGI(TAG, "Trace written to %s", path.c_str());
+    }
+    return ok;
+}
+
+void Tracer::SetThreadName(const char* name) {
+    if (name == nullptr) {
+        return;
+    }
+    t_thread_name = name;
+    if (local_buffer_ != nullptr) {
+        std::lock_guard<std::mutex> lock(local_buffer_->mutex);
+        local_buffer_->name = name;
+    }
+
+#ifdef _WIN32
+    std::wstring wide(name, name + strlen(name));
+    SetThreadDescription(GetCurrentThread(), wide.c_str());
+#elif defined(__APPLE__)
+    pthread_setname_np(name);
+#else
+    // Linux limits names to 15 characters
+    char truncated[16];
+    snprintf(truncated, sizeof(truncated), "%s", name);
+    pthread_setname_np(pthread_self(), truncated);
+#endif
+}
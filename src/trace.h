@@ -0,0 +1,114 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Scoped timeline events, exported as Chrome trace-event JSON (load it in
+ * chrome://tracing or ui.perfetto.dev). Every thread records into a buffer
+ * of its own that keeps the most recent events, a scope costs one relaxed
+ * load while tracing is stopped. Names must be string literals.
+ *
+ *   void Foo() {
+ *       TRACE_SCOPE("Foo");
+ *       ...
+ *   }
+ */
+class Tracer {
+public:
+    // Never destroyed, named threads keep pointers into its buffers and may
+    // still record while statics go away at exit
+    static Tracer& GetInstance() {
+        static Tracer* instance = new Tracer();
+        return *instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    void Start();
+    void Stop();
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    void Record(const char* name, int64_t start_us, int64_t duration_us);
+    void RecordInstant(const char* name);
+
+    std::string ExportJson();
+    bool WriteJson(const std::string& path);
+
+    // Names the calling thread for the OS (debuggers, top -H) and the trace
+    static void SetThreadName(const char* name);
+
+private:
+    Tracer() = default;
+
+    struct Event {
+        const char* name;
+        int64_t start_us;
+        int64_t duration_us;  // -1 for an instant event
+    };
+
+    struct ThreadBuffer {
+        int id = 0;
+        std::string name;
+        std::mutex mutex;  // only ever contended by an export
+        // Grows up to kEventsPerThread, then the oldest are overwritten
+        std::vector<Event> events;
+        size_t next = 0;
+    };
+
+    ThreadBuffer* LocalBuffer();
+    void Append(const Event& event);
+
+    // Kept after the thread exits, its events are still worth exporting
+    static thread_local ThreadBuffer* local_buffer_;
+
+    std::atomic<bool> enabled_{false};
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+    int next_thread_id_ = 1;
+};
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) {
+        if (Tracer::GetInstance().enabled()) {
+            name_ = name;
+            start_us_ = Now();
+        }
+    }
+    ~TraceScope() {
+        if (name_ != nullptr) {
+            Tracer::GetInstance().Record(name_, start_us_, Now() - start_us_);
+        }
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    static int64_t Now();
+
+    const char* name_ = nullptr;
+    int64_t start_us_ = 0;
+};
+
+#ifdef CONFIG_DISABLE_TRACE
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_INSTANT(name) do {} while (0)
+#else
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_INSTANT(name) do { \
+        if (Tracer::GetInstance().enabled()) { \
+            Tracer::GetInstance().RecordInstant(name); \
+        } \
+    } while (0)
+#endif
+
+#endif // TRACE_H
@@ -0,0 +1,361 @@
+#include "wake_word_detect.h"
+#include "metrics.h"
+#include "settings.h"
+#include "trace.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#define TAG "WakeWordDetect"
+
+namespace {
+
+constexpr int kSampleRate = 16000;
+constexpr int kMelBands = 40;
+// c1..c12, c0 only follows the level
+constexpr int kCepstra = 12;
+// Hops handed over per Feed, in step with the 30 ms audio loop
+constexpr int kHopsPerFeed = 3;
+// Leading and trailing template frames this far below the loudest one
+// are silence, about 22 dB
+constexpr float kTrimLogEnergy = 5.0f;
+constexpr int kMinTemplateFrames = 20;
+constexpr float kInfiniteCost = 1e30f;
+
+struct WavInfo {
+    size_t offset = 0;
+    size_t size = 0;
+};
+
+uint32_t ReadLe32(const char* p) {
+    return (uint8_t)p[0] | ((uint8_t)p[1] << 8) | ((uint8_t)p[2] << 16) | ((uint32_t)(uint8_t)p[3] << 24);
+}
+
+uint16_t ReadLe16(const char* p) {
+    return (uint8_t)p[0] | ((uint8_t)p[1] << 8);
+}
+
+// Finds the samples of a 16 kHz mono 16 bit PCM WAV file
+bool ParseWav(const std::string& data, WavInfo& info) {
+    if (data.size() < 12 || data.compare(0, 4, "RIFF") != 0 || data.compare(8, 4, "WAVE") != 0) {
+        return false;
+    }
+    bool format_ok = false;
+    size_t pos = 12;
+    while (pos + 8 <= data.size()) {
+        const char* chunk = data.data() + pos;
+        size_t size = ReadLe32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16 && pos + 8 + size <= data.size()) {
+            format_ok = ReadLe16(chunk + 8) == 1 && ReadLe16(chunk + 10) == 1 &&
+                        ReadLe32(chunk + 12) == kSampleRate && ReadLe16(chunk + 22) == 16;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            info.offset = pos + 8;
+            info.size = std::min(size, data.size() - info.offset);
+            return format_ok;
+        }
+        pos += 8 + size + (size & 1);
+    }
+    return false;
+}
+
+} // namespace
+
+WakeWordDetect::WakeWordDetect() : log_mel_(kSampleRate, 25, 10, kMelBands) {
+    // DCT-II rows 1..kCepstra
+    dct_.resize(kCepstra * kMelBands);
+    for (int c = 0; c < kCepstra; c++) {
+        for (int m = 0; m < kMelBands; m++) {
+            dct_[c * kMelBands + m] = (float)std::cos(3.14159265358979323846 * (c + 1) * (m + 0.5) / kMelBands);
+        }
+    }
+    mel_.resize(kMelBands);
+    cepstra_.resize(kCepstra);
+}
+
+WakeWordDetect::~WakeWordDetect() {
+}
+
+void WakeWordDetect::Initialize(AudioCodec* codec) {
+    codec_ = codec;
+
+    Settings settings("wake_word", false);
+    wake_word_ = settings.GetString("name", "你好小智");
+    threshold_ = settings.GetInt("threshold", 30) / 100.0f;
+    budget_us_ = settings.GetInt("budget_us", 1000);
+    std::string directory = settings.GetString("templates", "wake_word");
+
+    std::vector<std::string> paths;
+    std::error_code ec;
+    for (auto it = std::filesystem::directory_iterator(directory, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        auto extension = it->path().extension().string();
+        if (it->is_regular_file() && (extension == ".wav" || extension == ".pcm")) {
+            paths.push_back(it->path().string());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    for (auto& path : paths) {
+        LoadTemplate(path);
+    }
+
+    if (templates_.empty()) {
+        ESP_LOGW(TAG, "No wake word templates in %s, detection is off", directory.c_str());
+        return;
+    }
+    ESP_LOGI(TAG, "Loaded %zu templates for \"%s\", threshold %.2f, budget %d us per 10 ms",
+        templates_.size(), wake_word_.c_str(), threshold_, budget_us_);
+}
+
+bool WakeWordDetect::LoadTemplate(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    WavInfo wav;
+    if (!ParseWav(data, wav)) {
+        if (data.compare(0, 4, "RIFF") == 0) {
+            ESP_LOGW(TAG, "%s is not a 16 kHz mono 16 bit WAV file", path.c_str());
+            return false;
+        }
+        wav.offset = 0;
+        wav.size = data.size();
+    }
+    std::vector<int16_t> samples(wav.size / 2);
+    memcpy(samples.data(), data.data() + wav.offset, samples.size() * 2);
+
+    // Features of the whole recording, then trimmed to the spoken part
+    LogMel log_mel(kSampleRate, 25, 10, kMelBands);
+    int hop = log_mel.hop_samples();
+    std::vector<float> features;
+    std::vector<float> energies;
+    for (size_t i = 0; i + hop <= samples.size(); i += hop) {
+        if (!log_mel.Process(samples.data() + i, mel_.data())) {
+            continue;
+        }
+        float energy = 0;
+        for (int m = 0; m < kMelBands; m++) {
+            energy += std::exp(mel_[m]);
+        }
+        energies.push_back(std::log(energy));
+        ComputeCepstra(mel_.data(), cepstra_.data());
+        features.insert(features.end(), cepstra_.begin(), cepstra_.end());
+    }
+
+    int first = 0;
+    int last = (int)energies.size() - 1;
+    if (!energies.empty()) {
+        float floor = *std::max_element(energies.begin(), energies.end()) - kTrimLogEnergy;
+        while (first < last && energies[first] < floor) {
+            first++;
+        }
+        while (last > first && energies[last] < floor) {
+            last--;
+        }
+    }
+    int frames = last - first + 1;
+    if (frames < kMinTemplateFrames) {
+        ESP_LOGW(TAG, "%s is too short for a template", path.c_str());
+        return false;
+    }
+
+    Template entry;
+    entry.features.assign(features.begin() + first * kCepstra, features.begin() + (last + 1) * kCepstra);
+    entry.frames = frames;
+    entry.cost.assign(frames, kInfiniteCost);
+    entry.start.assign(frames, 0);
+    templates_.push_back(std::move(entry));
+    ESP_LOGD(TAG, "Template %s, %d frames", path.c_str(), frames);
+    return true;
+}
+
+// Cepstra scaled to unit length, the match is on the spectral shape and
+// not on the level
+void WakeWordDetect::ComputeCepstra(const float* mel, float* cepstra) {
+    float norm = 0;
+    for (int c = 0; c < kCepstra; c++) {
+        const float* row = dct_.data() + c * kMelBands;
+        float sum = 0;
+        for (int m = 0; m < kMelBands; m++) {
+            sum += row[m] * mel[m];
+        }
+        cepstra[c] = sum;
+        norm += sum * sum;
+    }
+    float scale = norm > 0 ? 1.0f / std::sqrt(norm) : 0.0f;
+    for (int c = 0; c < kCepstra; c++) {
+        cepstra[c] *= scale;
+    }
+}
+
+void WakeWordDetect::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
+    wake_word_detected_callback_ = callback;
+}
+
+void WakeWordDetect::StartDetection() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_ || templates_.empty()) {
+        return;
+    }
+    log_mel_.Reset();
+    pending_.clear();
+    ResetMatching();
+    credit_us_ = budget_us_;
+    frames_ = 0;
+    skipped_frames_ = 0;
+    total_us_ = 0;
+    max_us_ = 0;
+    running_ = true;
+}
+
+void WakeWordDetect::StopDetection() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+        return;
+    }
+    running_ = false;
+    if (frames_ > 0) {
+        ESP_LOGI(TAG, "Detection stopped after %llu frames, %.1f us per frame, %lld us max, %llu skipped",
+            (unsigned long long)frames_, (double)total_us_ / frames_, (long long)max_us_,
+            (unsigned long long)skipped_frames_);
+    }
+}
+
+bool WakeWordDetect::IsDetectionRunning() {
+    return running_;
+}
+
+size_t WakeWordDetect::GetFeedSize() {
+    if (!codec_ || !running_) {
+        return 0;
+    }
+    size_t samples = (size_t)log_mel_.hop_samples() * kHopsPerFeed;
+    return codec_->GetInputAvailableSamples() >= samples ? samples : 0;
+}
+
+void WakeWordDetect::Feed(const std::vector<int16_t>& data) {
+    bool detected = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        pending_.insert(pending_.end(), data.begin(), data.end());
+        size_t hop = log_mel_.hop_samples();
+        size_t offset = 0;
+        while (!detected && offset + hop <= pending_.size()) {
+            detected = ProcessHop(pending_.data() + offset);
+            offset += hop;
+        }
+        pending_.erase(pending_.begin(), pending_.begin() + offset);
+
+        if (detected) {
+            // Stays off until the application starts it again
+            running_ = false;
+            last_detected_wake_word_ = wake_word_;
+        }
+    }
+
+    if (detected) {
+        static auto& detections = Metrics::GetInstance().GetCounter("xiaozhi_wake_word_detections_total",
+            "Wake words detected.");
+        detections.Increment();
+        ESP_LOGI(TAG, "Detected \"%s\" after %llu frames, %.1f us per frame, %lld us max, %llu skipped",
+            last_detected_wake_word_.c_str(), (unsigned long long)frames_, (double)total_us_ / frames_,
+            (long long)max_us_, (unsigned long long)skipped_frames_);
+        if (wake_word_detected_callback_) {
+            wake_word_detected_callback_(last_detected_wake_word_);
+        }
+    }
+}
+
+bool WakeWordDetect::ProcessHop(const int16_t* samples) {
+    static auto& frame_time = Metrics::GetInstance().GetHistogram("xiaozhi_wake_word_frame_seconds",
+        "CPU time of the wake word detector per 10 ms hop.", Histogram::ExponentialBounds(0.00001, 2, 10));
+    static auto& skipped = Metrics::GetInstance().GetCounter("xiaozhi_wake_word_skipped_frames_total",
+        "Hops the wake word detector skipped to stay within its CPU budget.");
+
+    // Token bucket, every hop earns its budget and a burst may borrow up
+    // to a few hops ahead
+    credit_us_ = std::min<int64_t>(credit_us_ + budget_us_, (int64_t)budget_us_ * 4);
+    if (credit_us_ < 0) {
+        log_mel_.Skip(samples);
+        skipped_frames_++;
+        skipped.Increment();
+        return false;
+    }
+
+    TRACE_SCOPE("WakeWordDetect::ProcessHop");
+    int64_t start = esp_timer_get_time();
+    bool detected = false;
+    if (log_mel_.Process(samples, mel_.data())) {
+        ComputeCepstra(mel_.data(), cepstra_.data());
+        detected = MatchFrame(cepstra_.data());
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    credit_us_ -= elapsed;
+    frames_++;
+    total_us_ += elapsed;
+    max_us_ = std::max(max_us_, elapsed);
+    frame_time.Observe(elapsed / 1e6);
+    return detected;
+}
+
+// One step of subsequence DTW per template. A match may start at any
+// input frame, and each input frame advances the template by zero, one or
+// two frames, so a word is accepted from half to twice the template's
+// speed. Every cell keeps the path with the lowest average cosine distance.
+bool WakeWordDetect::MatchFrame(const float* frame) {
+    bool detected = false;
+    uint64_t now = matched_frames_++;
+    for (auto& entry : templates_) {
+        int frames = entry.frames;
+        float* cost = entry.cost.data();
+        uint64_t* start = entry.start.data();
+
+        // Descending, so cells j - 1 and j - 2 still hold the previous frame
+        for (int j = frames - 1; j >= 0; j--) {
+            const float* reference = entry.features.data() + j * kCepstra;
+            float dot = 0;
+            for (int c = 0; c < kCepstra; c++) {
+                dot += frame[c] * reference[c];
+            }
+            float distance = 1.0f - dot;
+
+            float best_cost = cost[j];
+            uint64_t best_start = start[j];
+            for (int step = 1; step <= 2 && step <= j; step++) {
+                // a / span_a < b / span_b without the divisions
+                if (cost[j - step] * (now - best_start + 1) < best_cost * (now - start[j - step] + 1)) {
+                    best_cost = cost[j - step];
+                    best_start = start[j - step];
+                }
+            }
+            if (j == 0 && best_cost >= distance * (now - best_start)) {
+                best_cost = 0;
+                best_start = now;
+            }
+            cost[j] = std::min(best_cost + distance, kInfiniteCost);
+            start[j] = best_start;
+        }
+
+        uint64_t span = now - start[frames - 1] + 1;
+        float average = cost[frames - 1] / span;
+        if (span <= (uint64_t)frames * 2 && average < threshold_) {
+            ESP_LOGD(TAG, "Match, average distance %.3f over %llu frames", average, (unsigned long long)span);
+            detected = true;
+        }
+    }
+    if (detected) {
+        ResetMatching();
+    }
+    return detected;
+}
+
+void WakeWordDetect::ResetMatching() {
+    for (auto& entry : templates_) {
+        std::fill(entry.cost.begin(), entry.cost.end(), kInfiniteCost);
+        std::fill(entry.start.begin(), entry.start.end(), matched_frames_);
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef WAKE_WORD_DETECT_H
+#define WAKE_WORD_DETECT_H
+
+#include "audio_codec.h"
+#include "audio_processing/log_mel.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Always-on keyword spotter for the idle and speaking states. Each 10 ms
+// hop of capture goes through a log-mel front end and a DCT into cepstra,
+// which are matched against recordings of the wake word by streaming
+// subsequence DTW. Runs on the audio loop, so every hop is held to a CPU
+// budget: when the detector has spent more than its share, hops are
+// skipped rather than delaying the capture path.
+//
+// Templates are 16 kHz mono 16 bit recordings, raw or WAV, in the
+// "templates" directory of the "wake_word" settings.
+class WakeWordDetect {
+public:
+    WakeWordDetect();
+    ~WakeWordDetect();
+
+    void Initialize(AudioCodec* codec);
+    void Feed(const std::vector<int16_t>& data);
+    void OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback);
+    void StartDetection();
+    void StopDetection();
+    bool IsDetectionRunning();
+    size_t GetFeedSize();
+    const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
+
+private:
+    struct Template {
+        // frames x kCepstra, unit length
+        std::vector<float> features;
+        int frames = 0;
+        // DTW column for the latest input frame: accumulated cost, and the
+        // input frame the path through each cell started at
+        std::vector<float> cost;
+        std::vector<uint64_t> start;
+    };
+
+    AudioCodec* codec_ = nullptr;
+    std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
+    std::atomic<bool> running_ = false;
+    std::mutex mutex_;
+
+    LogMel log_mel_;
+    std::vector<Template> templates_;
+    std::vector<float> dct_;
+    std::vector<float> mel_;
+    std::vector<float> cepstra_;
+    std::vector<int16_t> pending_;
+
+    std::string wake_word_;
+    std::string last_detected_wake_word_;
+    float threshold_ = 0.3f;
+    int budget_us_ = 1000;
+    int64_t credit_us_ = 0;
+
+    // Cost reporting, logged when the detection stops
+    uint64_t frames_ = 0;
+    // Frames run through the matcher since the start, the DTW time axis
+    uint64_t matched_frames_ = 0;
+    uint64_t skipped_frames_ = 0;
+    int64_t total_us_ = 0;
+    int64_t max_us_ = 0;
+
+    bool LoadTemplate(const std::string& path);
+    void ComputeCepstra(const float* mel, float* cepstra);
+    bool ProcessHop(const int16_t* samples);
+    bool MatchFrame(const float* frame);
+    void ResetMatching();
+};
+
+#endif // WAKE_WORD_DETECT_H